@@ -0,0 +1,98 @@
+// 词法分析微基准：比较各扫描路径的吞吐量，并校验结果与标量路径逐位一致
+// 用法：./lexbench [输入大小(MB)] [重复次数]
+#include "../rvcc.h"
+#include <time.h>
+
+// 生成类似机器生成代码的输入：长标识符、数字、缩进和空行
+static char *genInput(size_t size) {
+  char *buf = malloc(size + 256);
+  size_t n = 0;
+  n += sprintf(buf + n, "{\n");
+  for (int i = 0; n < size; i++) {
+    n += sprintf(buf + n,
+                 "        generated_variable_%d = counter_value_%d + %d * "
+                 "(another_identifier - %d);\n\n",
+                 i, i % 97, i * 7919, i % 1000);
+  }
+  n += sprintf(buf + n, "return 0; }\n");
+  return buf;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 拷贝一份终结符流，用于和其他路径的结果对比
+static TokenStream snapshot(void) {
+  TokenStream s = Tokens;
+  s.kinds = malloc(s.len);
+  s.locs = malloc(s.len * sizeof(*s.locs));
+  s.lens = malloc(s.len * sizeof(*s.lens));
+  s.numVals = malloc(s.numLen * sizeof(*s.numVals));
+  s.numToks = malloc(s.numLen * sizeof(*s.numToks));
+  memcpy(s.kinds, Tokens.kinds, s.len);
+  memcpy(s.locs, Tokens.locs, s.len * sizeof(*s.locs));
+  memcpy(s.lens, Tokens.lens, s.len * sizeof(*s.lens));
+  memcpy(s.numVals, Tokens.numVals, s.numLen * sizeof(*s.numVals));
+  memcpy(s.numToks, Tokens.numToks, s.numLen * sizeof(*s.numToks));
+  return s;
+}
+
+static bool sameAsRef(TokenStream *ref) {
+  return ref->len == Tokens.len && ref->numLen == Tokens.numLen &&
+         !memcmp(ref->kinds, Tokens.kinds, ref->len) &&
+         !memcmp(ref->locs, Tokens.locs, ref->len * sizeof(*ref->locs)) &&
+         !memcmp(ref->lens, Tokens.lens, ref->len * sizeof(*ref->lens)) &&
+         !memcmp(ref->numVals, Tokens.numVals,
+                 ref->numLen * sizeof(*ref->numVals)) &&
+         !memcmp(ref->numToks, Tokens.numToks,
+                 ref->numLen * sizeof(*ref->numToks));
+}
+
+int main(int argc, char **argv) {
+  DiagFile = stderr;
+  size_t mb = argc > 1 ? atoi(argv[1]) : 16;
+  int reps = argc > 2 ? atoi(argv[2]) : 5;
+  char *input = genInput(mb << 20);
+  size_t bytes = strlen(input);
+
+  static const struct {
+    LexPath path;
+    char *name;
+  } paths[] = {{LEX_SCALAR, "scalar"}, {LEX_SSE2, "sse2"}, {LEX_AVX2, "avx2"}};
+
+  TokenStream ref = {};
+  bool ok = true;
+  printf("input: %zu bytes\n", bytes);
+  for (int i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+    if (!setLexPath(paths[i].path)) {
+      printf("%-8s unsupported\n", paths[i].name);
+      continue;
+    }
+
+    double best = 1e30;
+    for (int r = 0; r < reps; r++) {
+      double t = now();
+      // 词法分析按需进行，逐个取出所有Token
+      for (TokenId tok = tokenize(input); tokKind(tok) != TK_EOF; tok++)
+        ;
+      t = now() - t;
+      if (t < best)
+        best = t;
+    }
+
+    bool same = true;
+    if (paths[i].path == LEX_SCALAR)
+      ref = snapshot();
+    else
+      same = sameAsRef(&ref);
+    ok = ok && same;
+
+    printf("%-8s %10.1f MB/s  %u tokens  %s\n", paths[i].name,
+           bytes / best / (1 << 20), Tokens.len,
+           same ? "identical" : "MISMATCH");
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// 编译服务器基准：比较每个程序启动一个rvcc进程与通过 rvcc --server 编译的耗时，
+// 并校验两种方式的输出逐字节一致
+// 用法：./serverbench [程序数量] [rvcc路径]
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// 类似test.sh中的小程序
+static char *Templates[] = {
+    "{ return %d; }",
+    "{ a=%d; b=a*4; if (b>10) return b; return 0; }",
+    "{ i=0; j=0; for (i=0; i<=%d; i=i+1) j=i+j; return j; }",
+    "{ x=%d; while (x) { x=x-1; } return x; }",
+    "{ foo2=70; bar4=%d; return foo2+bar4*(3-1)/2; }",
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 读取fd中的所有内容
+static char *readAll(int fd, size_t *len) {
+  size_t cap = 4096;
+  char *buf = malloc(cap);
+  *len = 0;
+  ssize_t n;
+  while ((n = read(fd, buf + *len, cap - *len)) > 0) {
+    *len += n;
+    if (*len == cap)
+      buf = realloc(buf, cap *= 2);
+  }
+  return buf;
+}
+
+// 启动一个rvcc进程编译程序，返回汇编代码
+static char *compileProcess(char *rvcc, char *prog, size_t *len) {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execl(rvcc, rvcc, prog, (char *)NULL);
+    _exit(127);
+  }
+  close(fds[1]);
+  char *out = readAll(fds[0], len);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  return out;
+}
+
+// 通过编译服务器编译程序，返回汇编代码
+static char *compileServer(FILE *req, FILE *rep, char *prog, size_t *len) {
+  fprintf(req, "%zu\n%s", strlen(prog), prog);
+  fflush(req);
+  int status;
+  size_t diagLen;
+  if (fscanf(rep, "%d %zu %zu", &status, len, &diagLen) != 3 ||
+      fgetc(rep) != '\n') {
+    fprintf(stderr, "invalid reply\n");
+    exit(1);
+  }
+  char *out = malloc(*len + diagLen + 1);
+  if (fread(out, 1, *len + diagLen, rep) != *len + diagLen) {
+    fprintf(stderr, "truncated reply\n");
+    exit(1);
+  }
+  return out;
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000;
+  char *rvcc = argc > 2 ? argv[2] : "./rvcc";
+
+  int numTemplates = sizeof(Templates) / sizeof(*Templates);
+  char **progs = malloc(n * sizeof(*progs));
+  for (int i = 0; i < n; i++) {
+    progs[i] = malloc(128);
+    snprintf(progs[i], 128, Templates[i % numTemplates], i % 100);
+  }
+
+  // 每个程序一个进程
+  char **ref = malloc(n * sizeof(*ref));
+  size_t *refLen = malloc(n * sizeof(*refLen));
+  double t = now();
+  for (int i = 0; i < n; i++)
+    ref[i] = compileProcess(rvcc, progs[i], &refLen[i]);
+  double perProcess = now() - t;
+
+  // 启动编译服务器，通过管道发送请求
+  int reqFds[2], repFds[2];
+  if (pipe(reqFds) < 0 || pipe(repFds) < 0) {
+    perror("pipe");
+    return 1;
+  }
+  t = now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(reqFds[0], 0);
+    dup2(repFds[1], 1);
+    close(reqFds[0]);
+    close(reqFds[1]);
+    close(repFds[0]);
+    close(repFds[1]);
+    execl(rvcc, rvcc, "--server", (char *)NULL);
+    _exit(127);
+  }
+  close(reqFds[0]);
+  close(repFds[1]);
+  FILE *req = fdopen(reqFds[1], "w");
+  FILE *rep = fdopen(repFds[0], "r");
+
+  bool same = true;
+  for (int i = 0; i < n; i++) {
+    size_t len;
+    char *out = compileServer(req, rep, progs[i], &len);
+    same = same && len == refLen[i] && !memcmp(out, ref[i], len);
+    free(out);
+  }
+  fclose(req);
+  fclose(rep);
+  waitpid(pid, NULL, 0);
+  double server = now() - t;
+
+  printf("%d programs\n", n);
+  printf("per-process %8.1f ms  %6.1f us/program\n", perProcess * 1e3,
+         perProcess / n * 1e6);
+  printf("server      %8.1f ms  %6.1f us/program  %s\n", server * 1e3,
+         server / n * 1e6, same ? "identical" : "MISMATCH");
+  printf("speedup     %8.1fx\n", perProcess / server);
+  return same ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// 流式编译基准：编译不同大小的程序，输出各自的耗时与峰值内存（RSS），
+// 分别从文件（映射到内存）和管道读入，汇编代码丢弃
+// 用法：./streambench [最大输入大小(MB)] [rvcc路径]
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// 生成约size字节的程序：循环、分支和算术语句，使用固定的一组变量
+static void genInput(char *path, size_t size) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  size_t n = fprintf(f, "{\n  s=0;\n");
+  for (int i = 0; n < size; i++) {
+    n += fprintf(f,
+                 "  for (i=0; i<%d; i=i+1) {\n"
+                 "    tmp_%d = s*%d + i;\n"
+                 "    if (tmp_%d > 1000) s = s - tmp_%d/%d; else s = s + i;\n"
+                 "  }\n",
+                 i % 50 + 1, i % 16, i % 7 + 1, i % 16, i % 16, i % 5 + 2);
+  }
+  fprintf(f, "  return s;\n}\n");
+  fclose(f);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 运行rvcc编译path，usePipe为真时通过管道输入，返回峰值RSS（KB）
+static long run(char *rvcc, char *path, bool usePipe, double *secs) {
+  double t = now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int in = open(path, O_RDONLY);
+    int out = open("/dev/null", O_WRONLY);
+    if (in < 0 || out < 0)
+      _exit(127);
+    dup2(out, 1);
+    if (!usePipe) {
+      execl(rvcc, rvcc, path, (char *)NULL);
+      _exit(127);
+    }
+    // 中间插入一个cat进程，rvcc的标准输入为管道
+    int fds[2];
+    if (pipe(fds) < 0)
+      _exit(127);
+    if (fork() == 0) {
+      dup2(in, 0);
+      dup2(fds[1], 1);
+      close(fds[0]);
+      execlp("cat", "cat", (char *)NULL);
+      _exit(127);
+    }
+    dup2(fds[0], 0);
+    close(fds[1]);
+    execl(rvcc, rvcc, "-", (char *)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage ru;
+  wait4(pid, &status, 0, &ru);
+  *secs = now() - t;
+  if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+    fprintf(stderr, "rvcc failed on %s\n", path);
+    exit(1);
+  }
+  return ru.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+  int maxMB = argc > 1 ? atoi(argv[1]) : 16;
+  char *rvcc = argc > 2 ? argv[2] : "./rvcc";
+  char path[] = "/tmp/streambench.XXXXXX";
+  close(mkstemp(path));
+
+  printf("%8s %12s %10s %12s %10s\n", "input", "file RSS", "time", "pipe RSS",
+         "time");
+  for (int mb = 1; mb <= maxMB; mb *= 4) {
+    genInput(path, (size_t)mb << 20);
+    double t1, t2;
+    long rss1 = run(rvcc, path, false, &t1);
+    long rss2 = run(rvcc, path, true, &t2);
+    printf("%6d MB %9ld KB %8.2f s %9ld KB %8.2f s\n", mb, rss1, t1, rss2, t2);
+  }
+  unlink(path);
+  return 0;
+}
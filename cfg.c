@@ -0,0 +1,663 @@
+#include "rvcc.h"
+
+/* 控制流图 */
+
+// 一条顶层语句的代码先生成到基本块中，每个块以无条件跳转或条件分支结束。
+// 语句结束后进行化简：跳转到只含跳转的空块时直接跳到最终目标（跳转穿透），
+// 不可达的块被删除，唯一前驱以无条件跳转进入的块并入前驱。
+// 之后按静态启发式排列各块：可能执行的后继紧跟在块后面，条件不成立时
+// 直接落入；循环按照入口跳到条件判断、循环体在前、条件判断在后的方式排列，
+// 每次迭代只执行一次分支。最后只为需要跳转到达的块输出标签。
+// -fno-reorder-blocks时不化简，可达的块按创建的顺序输出。
+// -fcost-report时估计各块的周期数，以及语句和循环沿着可能的路径执行的周期数。
+
+// 块的结束方式
+typedef enum {
+  TERM_JUMP,   // 无条件跳转到succ[0]
+  TERM_BRANCH, // 满足cond时跳转到succ[0]，否则到succ[1]
+} TermKind;
+
+typedef struct Block Block;
+struct Block {
+  char *name;       // 标签为.L.name.c
+  int c;            // 标签的编号
+  char *text;       // 块中的指令
+  size_t len;       // 指令的长度
+  size_t cap;       // 已分配的容量
+  TermKind term;    // 结束方式
+  BlockId succ[2];  // 后继
+  char *cond;       // 分支指令，如"beqz a0"
+  char *inv;        // 条件相反的分支指令，如"bnez a0"
+  bool loopHead;    // 循环条件判断所在的块
+  TokenId loopTok;  // 循环的开头，用于报告；跳转穿透后移到实际的循环入口
+  int64_t trips;    // 循环次数，未知时为-1
+  bool reachable;   // 从入口可达
+  bool placed;      // 已排列
+  bool label;       // 需要输出标签
+  uint32_t preds;   // 前驱数量
+  int cost;         // 估计的周期数
+  int64_t iterCost; // 循环每次迭代的周期数
+  bool costed;      // 已计算iterCost
+  uint32_t visit;   // 计算路径时已经过
+};
+
+// 块池，0号块保留为空，块的文本缓冲区在各语句之间重复使用
+static Block *Blocks;
+static uint32_t BlockLen;
+static uint32_t BlockCap;
+
+// 当前写入指令的块
+static BlockId Cur;
+// 入口、语句之后的代码、函数的.L.return
+static BlockId Entry;
+static BlockId Exit;
+static BlockId Return;
+// 语句的开头，及其估计的周期数
+static TokenId StmtTok;
+static int64_t StmtCost;
+
+// 排列后的顺序
+static BlockId *Order;
+static uint32_t OrderLen;
+
+static Block *blockAt(BlockId b) { return &Blocks[b]; }
+
+/**
+ * @brief 新建一个基本块，标签为.L.name.c
+ * @param  name
+ * @param  c
+ * @return BlockId
+ */
+BlockId cfgNewBlock(char *name, int c) {
+  if (BlockLen == 0)
+    BlockLen = 1;
+  if (BlockLen >= BlockCap) {
+    uint32_t cap = BlockCap ? BlockCap * 2 : 64;
+    Blocks = realloc(Blocks, cap * sizeof(*Blocks));
+    if (!Blocks)
+      error("out of memory");
+    memset(Blocks + BlockCap, 0, (cap - BlockCap) * sizeof(*Blocks));
+    BlockCap = cap;
+  }
+
+  Block *b = blockAt(BlockLen);
+  char *text = b->text;
+  size_t cap = b->cap;
+  *b = (Block){.name = name, .c = c, .text = text, .cap = cap};
+  b->term = TERM_JUMP;
+  return BlockLen++;
+}
+
+/**
+ * @brief 开始一条顶层语句，之后的指令写入入口块
+ * @param  c 语句的编号，用于语句之后的标签
+ * @param  tok 语句的开头
+ */
+void cfgBegin(int c, TokenId tok) {
+  BlockLen = 0;
+  StmtTok = tok;
+  Return = cfgNewBlock("return", 0);
+  Exit = cfgNewBlock("next", c);
+  Entry = cfgNewBlock("stmt", c);
+  Cur = Entry;
+}
+
+/**
+ * @brief 之后的指令写入块b
+ * @param  b
+ */
+void cfgSetBlock(BlockId b) { Cur = b; }
+
+/**
+ * @brief 当前写入指令的块
+ * @return BlockId
+ */
+BlockId cfgCurBlock(void) { return Cur; }
+
+/**
+ * @brief 向当前块追加一行指令
+ * @param  fmt
+ * @param  ap
+ */
+void cfgAppend(char *fmt, va_list ap) {
+  va_list ap2;
+  va_copy(ap2, ap);
+  int n = vsnprintf(NULL, 0, fmt, ap2);
+  va_end(ap2);
+
+  Block *b = blockAt(Cur);
+  if (b->len + n + 2 > b->cap) {
+    while (b->len + n + 2 > b->cap)
+      b->cap = b->cap ? b->cap * 2 : 256;
+    b->text = realloc(b->text, b->cap);
+    if (!b->text)
+      error("out of memory");
+  }
+  vsnprintf(b->text + b->len, n + 1, fmt, ap);
+  b->len += n;
+  b->text[b->len++] = '\n';
+}
+
+/**
+ * @brief 结束当前块，之后的指令不可达，写入新的块
+ */
+static void endBlock(void) { Cur = cfgNewBlock("dead", 0); }
+
+/**
+ * @brief 以无条件跳转结束当前块
+ * @param  target
+ */
+void cfgJump(BlockId target) {
+  blockAt(Cur)->term = TERM_JUMP;
+  blockAt(Cur)->succ[0] = target;
+  endBlock();
+}
+
+/**
+ * @brief 以条件分支结束当前块
+ * @param  cond 满足时跳转到taken的分支指令
+ * @param  inv 条件相反的分支指令
+ * @param  taken
+ * @param  fall
+ */
+void cfgBranch(char *cond, char *inv, BlockId taken, BlockId fall) {
+  Block *b = blockAt(Cur);
+  b->term = TERM_BRANCH;
+  b->cond = cond;
+  b->inv = inv;
+  b->succ[0] = taken;
+  b->succ[1] = fall;
+  endBlock();
+}
+
+/**
+ * @brief 以跳转到.L.return结束当前块
+ */
+void cfgReturn(void) { cfgJump(Return); }
+
+/**
+ * @brief 标记循环条件判断所在的块，排列时放到循环体之后
+ * @param  b
+ * @param  tok 循环的开头
+ * @param  trips 循环次数，未知时为-1，用于估计周期数
+ */
+void cfgMarkLoop(BlockId b, TokenId tok, int64_t trips) {
+  blockAt(b)->loopHead = true;
+  blockAt(b)->loopTok = tok;
+  blockAt(b)->trips = trips;
+}
+
+/* 化简 */
+
+// 语句之后的代码和.L.return在语句之外，不参与化简
+static bool isInner(BlockId b) { return b != Exit && b != Return; }
+
+/**
+ * @brief 跳过只含无条件跳转的空块，得到最终的目标
+ * @param  b
+ * @return BlockId
+ */
+static BlockId threadTarget(BlockId b) {
+  // 空块组成的环最多经过BlockLen次
+  for (uint32_t n = 0; n < BlockLen && isInner(b); n++) {
+    Block *t = blockAt(b);
+    if (t->len || t->term != TERM_JUMP)
+      break;
+    b = t->succ[0];
+  }
+  return b;
+}
+
+/**
+ * @brief 跳转穿透，两个后继相同的分支变为无条件跳转
+ */
+static void threadJumps(void) {
+  for (BlockId b = 1; b < BlockLen; b++) {
+    Block *blk = blockAt(b);
+    if (!isInner(b))
+      continue;
+    // 没有条件的循环，跳过条件判断后，循环体的开头是循环的入口
+    BlockId t = threadTarget(b);
+    if (blk->loopTok && t != b && isInner(t) && !blockAt(t)->loopTok) {
+      blockAt(t)->loopTok = blk->loopTok;
+      blockAt(t)->trips = blk->trips;
+    }
+    blk->succ[0] = threadTarget(blk->succ[0]);
+    if (blk->term == TERM_BRANCH) {
+      blk->succ[1] = threadTarget(blk->succ[1]);
+      if (blk->succ[0] == blk->succ[1])
+        blk->term = TERM_JUMP;
+    }
+  }
+}
+
+/**
+ * @brief 从入口开始标记可达的块，统计前驱数量
+ */
+static void markReachable(void) {
+  for (BlockId b = 1; b < BlockLen; b++) {
+    blockAt(b)->reachable = false;
+    blockAt(b)->preds = 0;
+  }
+
+  BlockId *stack = calloc(BlockLen, sizeof(BlockId));
+  uint32_t len = 0;
+  stack[len++] = Entry;
+  blockAt(Entry)->reachable = true;
+  while (len) {
+    Block *blk = blockAt(stack[--len]);
+    int n = blk->term == TERM_BRANCH ? 2 : 1;
+    for (int i = 0; i < n; i++) {
+      BlockId s = blk->succ[i];
+      blockAt(s)->preds++;
+      if (!blockAt(s)->reachable && isInner(s)) {
+        blockAt(s)->reachable = true;
+        stack[len++] = s;
+      }
+    }
+  }
+  free(stack);
+}
+
+/**
+ * @brief 唯一前驱以无条件跳转进入的块，并入前驱
+ */
+static void mergeBlocks(void) {
+  for (BlockId a = 1; a < BlockLen; a++) {
+    Block *blk = blockAt(a);
+    if (!blk->reachable)
+      continue;
+    for (;;) {
+      BlockId b = blk->succ[0];
+      if (blk->term != TERM_JUMP || !isInner(b) || b == a ||
+          blockAt(b)->preds != 1)
+        break;
+
+      // 将b的指令和结束方式拼接到a之后
+      Block *next = blockAt(b);
+      if (blk->len + next->len > blk->cap) {
+        while (blk->len + next->len > blk->cap)
+          blk->cap = blk->cap ? blk->cap * 2 : 256;
+        blk->text = realloc(blk->text, blk->cap);
+        if (!blk->text)
+          error("out of memory");
+      }
+      memcpy(blk->text + blk->len, next->text, next->len);
+      blk->len += next->len;
+      blk->term = next->term;
+      blk->cond = next->cond;
+      blk->inv = next->inv;
+      blk->succ[0] = next->succ[0];
+      blk->succ[1] = next->succ[1];
+      next->reachable = false;
+    }
+  }
+}
+
+/* 排列 */
+
+// 后继是否直接返回，返回的路径不太可能执行
+static bool returns(BlockId b) {
+  return b == Return ||
+         (blockAt(b)->term == TERM_JUMP && blockAt(b)->succ[0] == Return);
+}
+
+/**
+ * @brief 分支更可能到达的后继
+ * 条件不成立时落入的后继通常是then分支或循环体，直接返回的分支除外
+ * @param  blk
+ * @return BlockId
+ */
+static BlockId likelySucc(Block *blk) {
+  if (blk->term == TERM_JUMP)
+    return blk->succ[0];
+  BlockId taken = blk->succ[0], fall = blk->succ[1];
+  if (returns(fall) && !returns(taken))
+    return taken;
+  return fall;
+}
+
+// 块b结束时是否可以不跳转直接落入块t
+static bool fallsTo(Block *blk, BlockId t) {
+  return blk->succ[0] == t || (blk->term == TERM_BRANCH && blk->succ[1] == t);
+}
+
+static bool placeable(BlockId b) {
+  return isInner(b) && blockAt(b)->reachable && !blockAt(b)->placed;
+}
+
+/**
+ * @brief 在块b之后排列的块，没有时返回0
+ * 从循环外进入循环时，先排列循环体，条件判断在回边到达时排列
+ * @param  b
+ * @return BlockId
+ */
+static BlockId chainSucc(BlockId b) {
+  Block *blk = blockAt(b);
+  BlockId first = likelySucc(blk);
+  BlockId cand[2] = {first, blk->succ[0] == first ? blk->succ[1] : blk->succ[0]};
+  int n = blk->term == TERM_BRANCH ? 2 : 1;
+  for (int i = 0; i < n; i++) {
+    BlockId s = cand[i];
+    if (!placeable(s))
+      continue;
+    // 循环体中的块在条件判断之后创建，入口在之前
+    if (blockAt(s)->loopHead && b < s) {
+      BlockId body = likelySucc(blockAt(s));
+      if (placeable(body))
+        return body;
+    }
+    return s;
+  }
+  return 0;
+}
+
+/**
+ * @brief 排列各块：沿着可能的后继组成链，链断开时按创建顺序选择下一个块
+ */
+static void layout(void) {
+  free(Order);
+  Order = calloc(BlockLen, sizeof(BlockId));
+  OrderLen = 0;
+  for (BlockId b = 1; b < BlockLen; b++)
+    blockAt(b)->placed = false;
+
+  for (BlockId start = Entry; start < BlockLen; start++) {
+    for (BlockId b = start; b && placeable(b); b = chainSucc(b)) {
+      blockAt(b)->placed = true;
+      Order[OrderLen++] = b;
+    }
+  }
+
+  // 按是否落入下一个块，将顺序分为若干段，除入口所在的第一段外，各段可以任意排列。
+  // 可以落入语句之后的代码的最后一段移到最后，如循环旋转后的条件判断
+  uint32_t segStart = 0, move = 0, moveEnd = 0;
+  for (uint32_t i = 0; i < OrderLen; i++) {
+    Block *blk = blockAt(Order[i]);
+    if (i + 1 < OrderLen && fallsTo(blk, Order[i + 1]))
+      continue;
+    if (segStart && fallsTo(blk, Exit)) {
+      move = segStart;
+      moveEnd = i + 1;
+    }
+    segStart = i + 1;
+  }
+  if (moveEnd && moveEnd < OrderLen) {
+    uint32_t n = moveEnd - move;
+    BlockId *seg = calloc(n, sizeof(BlockId));
+    memcpy(seg, Order + move, n * sizeof(BlockId));
+    memmove(Order + move, Order + moveEnd, (OrderLen - moveEnd) * sizeof(BlockId));
+    memcpy(Order + OrderLen - n, seg, n * sizeof(BlockId));
+    free(seg);
+  }
+
+  // 语句之后的代码在最后
+  Order[OrderLen++] = Exit;
+}
+
+/**
+ * @brief 可达的块按创建的顺序排列
+ */
+static void layoutInOrder(void) {
+  free(Order);
+  Order = calloc(BlockLen, sizeof(BlockId));
+  OrderLen = 0;
+  for (BlockId b = Entry; b < BlockLen; b++)
+    if (isInner(b) && blockAt(b)->reachable)
+      Order[OrderLen++] = b;
+  Order[OrderLen++] = Exit;
+}
+
+/* 输出 */
+
+static void printLabel(FILE *out, BlockId b) {
+  if (b == Return)
+    fprintf(out, ".L.return");
+  else
+    fprintf(out, ".L.%s.%d", blockAt(b)->name, blockAt(b)->c);
+}
+
+// 块的结束方式对应的指令，后继紧跟在之后时省略跳转
+typedef struct Jump Jump;
+struct Jump {
+  char *op;       // "j"或分支指令
+  BlockId target; // 跳转的目标
+};
+
+/**
+ * @brief 计算块的结束方式需要的跳转指令
+ * @param  blk
+ * @param  next 排列在之后的块
+ * @param  jumps
+ * @return int 跳转指令的数量
+ */
+static int termJumps(Block *blk, BlockId next, Jump *jumps) {
+  BlockId taken = blk->succ[0];
+  if (blk->term == TERM_JUMP) {
+    if (taken == next)
+      return 0;
+    jumps[0] = (Jump){"j", taken};
+    return 1;
+  }
+
+  BlockId fall = blk->succ[1];
+  if (taken == next) {
+    jumps[0] = (Jump){blk->inv, fall};
+    return 1;
+  }
+  jumps[0] = (Jump){blk->cond, taken};
+  if (fall == next)
+    return 1;
+  jumps[1] = (Jump){"j", fall};
+  return 2;
+}
+
+/**
+ * @brief 按排列的顺序输出后的指令数量
+ * @return int64_t
+ */
+static int64_t countInsns(void) {
+  int64_t n = 0;
+  Jump jumps[2];
+  for (uint32_t i = 0; i + 1 < OrderLen; i++) {
+    Block *blk = blockAt(Order[i]);
+    // 注释、伪指令和空行不计，块中没有标签
+    for (size_t j = 0; j < blk->len; j++) {
+      if (j && blk->text[j - 1] != '\n')
+        continue;
+      while (j < blk->len && blk->text[j] == ' ')
+        j++;
+      if (j < blk->len && !strchr("#.\n", blk->text[j]))
+        n++;
+    }
+    n += termJumps(blk, Order[i + 1], jumps);
+  }
+  return n;
+}
+
+/* 周期估计 */
+
+/**
+ * @brief 按排列的顺序估计各块的周期数，包括结束时的跳转
+ */
+static void estimateCosts(void) {
+  // 目标排列在之前的分支是向后的分支，静态预测为跳转
+  uint32_t *pos = calloc(BlockLen, sizeof(uint32_t));
+  for (uint32_t i = 0; i < OrderLen; i++)
+    pos[Order[i]] = i + 1;
+
+  Jump jumps[2];
+  for (uint32_t i = 0; i + 1 < OrderLen; i++) {
+    Block *blk = blockAt(Order[i]);
+    costBlockBegin();
+    for (char *p = blk->text, *end = p + blk->len; p < end;) {
+      char *nl = memchr(p, '\n', end - p);
+      costInsn(p, nl);
+      p = nl + 1;
+    }
+    int n = termJumps(blk, Order[i + 1], jumps);
+    for (int j = 0; j < n; j++) {
+      char *op = jumps[j].op;
+      costInsn(op, op + strlen(op));
+      uint32_t target = pos[jumps[j].target];
+      if (op[0] != 'j' && target && target <= i + 1)
+        costTaken();
+    }
+    blk->cost = costBlockEnd();
+  }
+  free(pos);
+}
+
+// 计算路径时的标记
+static uint32_t Visit;
+
+static int64_t loopCost(BlockId b);
+
+/**
+ * @brief 从块b沿着可能的后继到达stop的周期数
+ * 经过的内层循环计入各次迭代，循环次数未知时计一次
+ * @param  b
+ * @param  stop
+ * @return int64_t
+ */
+static int64_t pathCost(BlockId b, BlockId stop) {
+  int64_t cycles = 0;
+  uint32_t visit = ++Visit;
+  while (b != stop && isInner(b) && blockAt(b)->visit != visit) {
+    Block *blk = blockAt(b);
+    blk->visit = visit;
+    cycles += blk->cost;
+    BlockId next = likelySucc(blk);
+    // 内层循环的条件判断，各次迭代之后从循环的出口继续
+    if (blk->loopTok && blk->term == TERM_BRANCH) {
+      cycles += loopCost(b) * (blk->trips >= 0 ? blk->trips : 1);
+      next = blk->succ[0] == next ? blk->succ[1] : blk->succ[0];
+    }
+    b = next;
+  }
+  return cycles;
+}
+
+/**
+ * @brief 循环每次迭代的周期数，包括条件判断和其中的内层循环
+ * @param  b 循环的条件判断
+ * @return int64_t
+ */
+static int64_t loopCost(BlockId b) {
+  Block *blk = blockAt(b);
+  if (!blk->costed) {
+    blk->costed = true;
+    blk->iterCost = blk->cost + pathCost(likelySucc(blk), b);
+  }
+  return blk->iterCost;
+}
+
+/**
+ * @brief 估计语句和其中各循环的周期数，记录到报告中
+ */
+static void reportCosts(void) {
+  estimateCosts();
+  StmtCost = pathCost(Entry, Exit);
+  costRecord(StmtTok, false, StmtCost);
+
+  for (uint32_t i = 0; i + 1 < OrderLen; i++) {
+    BlockId b = Order[i];
+    if (blockAt(b)->loopTok)
+      costRecord(blockAt(b)->loopTok, true, loopCost(b));
+  }
+}
+
+/**
+ * @brief 按排列的顺序输出各块
+ * @param  out
+ * @param  annotate 以注释标出估计的周期数
+ */
+static void emit(FILE *out, bool annotate) {
+  int line, col;
+  if (annotate) {
+    tokLineCol(StmtTok, &line, &col);
+    fprintf(out, "# cost: statement at line %d: %lld cycles\n", line,
+            (long long)StmtCost);
+  }
+
+  // 只有跳转到达的块需要标签
+  Jump jumps[2];
+  for (uint32_t i = 0; i < OrderLen; i++)
+    blockAt(Order[i])->label = false;
+  for (uint32_t i = 0; i + 1 < OrderLen; i++) {
+    int n = termJumps(blockAt(Order[i]), Order[i + 1], jumps);
+    for (int j = 0; j < n; j++)
+      blockAt(jumps[j].target)->label = true;
+  }
+
+  for (uint32_t i = 0; i < OrderLen; i++) {
+    BlockId b = Order[i];
+    Block *blk = blockAt(b);
+    if (blk->label) {
+      printLabel(out, b);
+      fprintf(out, ":\n");
+    }
+    if (b == Exit)
+      break;
+
+    if (annotate) {
+      if (blk->loopTok) {
+        tokLineCol(blk->loopTok, &line, &col);
+        fprintf(out, "# cost: loop at line %d: %lld cycles per iteration\n",
+                line, (long long)blk->iterCost);
+      }
+      fprintf(out, "# cost: block %d cycles\n", blk->cost);
+    }
+    if (blk->len)
+      fwrite(blk->text, 1, blk->len, out);
+    int n = termJumps(blk, Order[i + 1], jumps);
+    for (int j = 0; j < n; j++) {
+      fprintf(out, "  %s%s", jumps[j].op, jumps[j].op[0] == 'j' ? " " : ", ");
+      printLabel(out, jumps[j].target);
+      fprintf(out, "\n");
+    }
+  }
+}
+
+/**
+ * @brief 结束一条顶层语句，化简控制流图并按排列的顺序输出
+ * @param  out
+ */
+void cfgEnd(FILE *out) {
+  cfgJump(Exit);
+  markReachable();
+  layoutInOrder();
+  if (passPrintAfter(PASS_VECTORIZE)) {
+    fprintf(DiagFile, "# IR after vectorize\n");
+    emit(DiagFile, false);
+  }
+  // 超优化在代码生成中替换了表达式的指令序列
+  if (passPrintAfter(PASS_SUPEROPT)) {
+    fprintf(DiagFile, "# IR after superopt\n");
+    emit(DiagFile, false);
+  }
+  // if转换在代码生成中用选择的指令序列代替了分支
+  if (passPrintAfter(PASS_IF_CONVERT)) {
+    fprintf(DiagFile, "# IR after if-convert\n");
+    emit(DiagFile, false);
+  }
+
+  if (OptReorderBlocks) {
+    int64_t before = OptTimeReport ? countInsns() : -1;
+    uint64_t start = passClock();
+    threadJumps();
+    markReachable();
+    mergeBlocks();
+    layout();
+    passAccount(PASS_REORDER_BLOCKS, start, before,
+                OptTimeReport ? countInsns() : 0);
+    if (passPrintAfter(PASS_REORDER_BLOCKS)) {
+      fprintf(DiagFile, "# IR after reorder-blocks\n");
+      emit(DiagFile, false);
+    }
+  }
+
+  if (OptCostReport)
+    reportCosts();
+  emit(out, OptCostReport);
+}
@@ -4,7 +4,60 @@
 
 /* 语义分析与代码生成 */
 
+// 输出文件
+static FILE *OutputFile;
+// 记录栈深度
 static int Depth;
+// 正在生成顶层语句，指令写入控制流图
+static bool InStmt;
+// -g时待输出的源代码位置
+static TokenId LocTok;
+static bool LocPending;
+// 最近输出的源代码位置，与之前相同时省略，块中的第一条指令总是需要标出
+static BlockId LocBlock;
+static int LocLine;
+static int LocCol;
+
+static void printLn(char *fmt, ...);
+
+/**
+ * @brief 输出待输出的源代码位置
+ */
+static void flushLoc(void) {
+  LocPending = false;
+  int line, col;
+  tokLineCol(LocTok, &line, &col);
+  BlockId b = cfgCurBlock();
+  if (b == LocBlock && line == LocLine && col == LocCol)
+    return;
+  LocBlock = b;
+  LocLine = line;
+  LocCol = col;
+  printLn("  .loc 1 %d %d", line, col);
+}
+
+/**
+ * @brief 输出字符串到目标文件并换行
+ * 语句中的指令先写入当前的基本块，语句结束后再输出
+ * @param  fmt
+ * @param  ...
+ */
+static void printLn(char *fmt, ...) {
+  // 注释之外的行是指令
+  if (LocPending && fmt[0] != '#' && fmt[0] != '\n')
+    flushLoc();
+
+  va_list ap;
+  va_start(ap, fmt);
+  if (InStmt) {
+    cfgAppend(fmt, ap);
+  } else {
+    vfprintf(OutputFile, fmt, ap);
+    fprintf(OutputFile, "\n");
+  }
+  va_end(ap);
+}
+
 /**
  * @brief 压栈，将结果临时压入栈中备用
  * 当前栈指针的地址就是sp，将a0的值压入栈
@@ -12,9 +65,9 @@ static int Depth;
  * 不使用寄存器存储的原因是因为需要存储的值的数量是变化的。
  */
 static void push(void) {
-  printf("# push stack, push the value of a0 into stack\n");
-  printf("  addi sp, sp, -8\n");
-  printf("  sd a0, 0(sp)\n");
+  printLn("# push stack, push the value of a0 into stack");
+  printLn("  addi sp, sp, -8");
+  printLn("  sd a0, 0(sp)");
   Depth++;
 }
 
@@ -23,9 +76,9 @@ static void push(void) {
  * @param  reg
  */
 static void pop(char *reg) {
-  printf("# pop stack, pop the value of top of stack\n");
-  printf("  ld %s, 0(sp)\n", reg);
-  printf("  addi sp, sp, 8\n");
+  printLn("# pop stack, pop the value of top of stack");
+  printLn("  ld %s, 0(sp)", reg);
+  printLn("  addi sp, sp, 8");
   Depth--;
 }
 
@@ -36,6 +89,17 @@ static int i = 1;
  */
 static int count(void) { return i++; }
 
+/**
+ * @brief -g时标出之后的指令对应的源代码位置，在输出下一条指令前输出
+ * @param  tok
+ */
+static void genLoc(TokenId tok) {
+  if (!OptDebug)
+    return;
+  LocTok = tok;
+  LocPending = true;
+}
+
 /**
  * @brief align to
  * @param  N
@@ -47,239 +111,1403 @@ static int alignTo(int n, int align) {
   return (n + align - 1) / align * align;
 }
 
+/* 指令选择 */
+
+// int为32位，运算使用字（w）指令，结果在寄存器中符号扩展到64位，
+// 变量以lw、sw访问。表达式树按以下的模式覆盖：
+// 常量操作数在12位以内时使用立即数指令；常量、变量和公共子表达式的值
+// 作为寄存器操作数直接使用，不经过栈；其余的二元运算先算右侧压栈，
+// 再算左侧后弹栈
+
+// 子树是否有副作用，按NodeId索引，0为未计算，1为无，2为有
+static uint8_t *EffectMemo;
+static uint32_t EffectCap;
+
 /**
- * @brief get address of variable
+ * @brief 子树中是否给变量赋值或保存公共子表达式，有副作用时操作数不能调换求值的顺序
  * @param  node
+ * @return true
+ * @return false
+ */
+static bool hasEffect(NodeId node) {
+  if (!EffectMemo[node]) {
+    bool effect;
+    if (CseUse && CseUse[node])
+      effect = false;
+    else if ((CseDef && CseDef[node]) || nodeKind(node) == ND_ASSIGN)
+      effect = true;
+    else if (nodeKind(node) == ND_NUM || nodeKind(node) == ND_VAR)
+      effect = false;
+    else if (nodeKind(node) == ND_NEG)
+      effect = hasEffect(nodeLhs(node));
+    else
+      effect = hasEffect(nodeLhs(node)) || hasEffect(nodeRhs(node));
+    EffectMemo[node] = effect ? 2 : 1;
+  }
+  return EffectMemo[node] == 2;
+}
+
+/**
+ * @brief 是否为12位有符号立即数
+ * @param  val
+ * @return true
+ * @return false
+ */
+static bool isImm(int64_t val) { return val >= -2048 && val <= 2047; }
+
+/**
+ * @brief 将常量装入寄存器，12位以内为li，否则为lui和addiw
+ * @param  reg
+ * @param  val
  */
-static void getAddr(Node *node) {
-  if (node->kind == ND_VAR) {
-    printf("# get address of variable %s in the stack, it's %d(fp)\n",
-           node->var->name, node->var->offset);
-    printf("addi a0, fp, -%d\n", node->var->offset);
+static void genConst(char *reg, int val) {
+  if (isImm(val)) {
+    printLn("  li %s, %d", reg, val);
     return;
   }
+  // addiw的立即数符号扩展，低12位不小于0x800时高20位需加1
+  int lo = (int)(((uint32_t)val & 0xfff) ^ 0x800) - 0x800;
+  uint32_t hi = ((uint32_t)val - (uint32_t)lo) >> 12;
+  printLn("  lui %s, %u", reg, hi);
+  if (lo)
+    printLn("  addiw %s, %s, %d", reg, reg, lo);
+}
 
-  errorTok(node->tok, "not an value");
+// 公共子表达式使用的寄存器
+static char *SavedRegs[] = {"s0", "s1", "s2", "s3", "s4",  "s5",
+                            "s6", "s7", "s8", "s9", "s10", "s11"};
+
+/**
+ * @brief 是否可作为寄存器操作数：常量、变量，或已在寄存器中的公共子表达式
+ * @param  node
+ * @return true
+ * @return false
+ */
+static bool isOperand(NodeId node) {
+  if (CseUse && CseUse[node])
+    return true;
+  if (CseDef && CseDef[node])
+    return false;
+  return nodeKind(node) == ND_NUM || nodeKind(node) == ND_VAR;
 }
 
 /**
- * @brief genrate expression
+ * @brief 将常量或变量装入寄存器
  * @param  node
+ * @param  reg
  */
-static void genExpr(Node *node) {
-  switch (node->kind) {
-  case ND_NUM:
-    printf("# load the value of node %d into a0\n", node->val);
-    printf("  li a0, %d\n", node->val);
+static void genLeaf(NodeId node, char *reg) {
+  if (nodeKind(node) == ND_NUM) {
+    genConst(reg, nodeVal(node));
+    return;
+  }
+  Obj *var = nodeVar(node);
+  printLn("# load variable %s from the stack, it's %d(fp)", var->name,
+          var->offset);
+  printLn("  lw %s, -%d(fp)", reg, var->offset);
+}
+
+static void genExpr(NodeId node);
+
+/**
+ * @brief 求操作数的值
+ * @param  node
+ * @param  reg 需要装入时使用的寄存器
+ * @return char* 值所在的寄存器
+ */
+static char *genOperand(NodeId node, char *reg) {
+  if (!isOperand(node)) {
+    genExpr(node);
+    return "a0";
+  }
+  if (CseUse && CseUse[node])
+    return SavedRegs[CseUse[node]];
+  genLoc(nodeTok(node));
+  genLeaf(node, reg);
+  return reg;
+}
+
+/**
+ * @brief 常量的以2为底的对数，不是2的正整数次幂时返回-1
+ * @param  val
+ * @return int
+ */
+static int log2Const(int64_t val) {
+  if (val <= 0 || (val & (val - 1)))
+    return -1;
+  int k = 0;
+  while (val >> k != 1)
+    k++;
+  return k;
+}
+
+/**
+ * @brief 一侧为常量的二元运算，结果写入a0
+ * @param  kind
+ * @param  x 另一侧的值所在的寄存器
+ * @param  c 常量
+ * @param  left 常量在运算符左侧
+ * @return true
+ * @return false 没有比装入寄存器更短的指令序列
+ */
+static bool genImmOp(NodeKind kind, char *x, int64_t c, bool left) {
+  switch (kind) {
+  case ND_ADD:
+    if (!isImm(c))
+      return false;
+    printLn("  addiw a0, %s, %d", x, (int)c);
+    return true;
+  case ND_SUB:
+    // c-x = -x+c
+    if (left) {
+      if (!isImm(c))
+        return false;
+      printLn("  negw a0, %s", x);
+      if (c)
+        printLn("  addiw a0, a0, %d", (int)c);
+      return true;
+    }
+    if (!isImm(-c))
+      return false;
+    printLn("  addiw a0, %s, %d", x, (int)-c);
+    return true;
+  case ND_MUL:
+    if (c == 0) {
+      printLn("  li a0, 0");
+      return true;
+    }
+    if (c == -1) {
+      printLn("  negw a0, %s", x);
+      return true;
+    }
+    if (log2Const(c) < 0)
+      return false;
+    if (c > 1)
+      printLn("  slliw a0, %s, %d", x, log2Const(c));
+    else if (strcmp(x, "a0"))
+      printLn("  mv a0, %s", x);
+    return true;
+  case ND_DIV: {
+    if (left)
+      return false;
+    if (c == -1) {
+      printLn("  negw a0, %s", x);
+      return true;
+    }
+    // 向零取整：负数先加上2^k-1再算术右移
+    int k = log2Const(c);
+    if (k < 0)
+      return false;
+    if (k == 0) {
+      if (strcmp(x, "a0"))
+        printLn("  mv a0, %s", x);
+      return true;
+    }
+    if (k == 1) {
+      printLn("  srliw a1, %s, 31", x);
+    } else {
+      printLn("  sraiw a1, %s, 31", x);
+      printLn("  srliw a1, a1, %d", 32 - k);
+    }
+    printLn("  addw a0, %s, a1", x);
+    printLn("  sraiw a0, a0, %d", k);
+    return true;
+  }
+  case ND_EQ:
+  case ND_NE:
+    if (!isImm(c))
+      return false;
+    if (c) {
+      printLn("  xori a0, %s, %d", x, (int)c);
+      x = "a0";
+    }
+    printLn(kind == ND_EQ ? "  seqz a0, %s" : "  snez a0, %s", x);
+    return true;
+  case ND_LT:
+  case ND_LE: {
+    // x<c, x<=c即x<c+1；c<x即!(x<c+1)，c<=x即!(x<c)
+    bool le = kind == ND_LE;
+    int64_t bound = left != le ? c + 1 : c;
+    if (!isImm(bound))
+      return false;
+    printLn("  slti a0, %s, %d", x, (int)bound);
+    if (left)
+      printLn("  xori a0, a0, 1");
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief 两侧都在寄存器中的二元运算，结果写入a0
+ * @param  kind
+ * @param  l 左侧的值所在的寄存器
+ * @param  r 右侧的值所在的寄存器
+ */
+static void genBinOp(NodeKind kind, char *l, char *r) {
+  switch (kind) {
+  case ND_ADD:
+    printLn("  addw a0, %s, %s", l, r);
+    return;
+  case ND_SUB:
+    printLn("  subw a0, %s, %s", l, r);
+    return;
+  case ND_MUL:
+    printLn("  mulw a0, %s, %s", l, r);
+    return;
+  case ND_DIV:
+    printLn("  divw a0, %s, %s", l, r);
+    return;
+  case ND_EQ:
+  case ND_NE:
+    // 异或后等于0则置1，或不等于0则置1
+    printLn("  xor a0, %s, %s", l, r);
+    printLn(kind == ND_EQ ? "  seqz a0, a0" : "  snez a0, a0");
+    return;
+  case ND_LT:
+    printLn("  slt a0, %s, %s", l, r);
+    return;
+  case ND_LE:
+    // l<=r等价于!(r<l)
+    printLn("  slt a0, %s, %s", r, l);
+    printLn("  xori a0, a0, 1");
     return;
+  default:
+    unreachable();
+  }
+}
+
+/* 超优化的表 */
+
+// tools/superopt.c对小的表达式树搜索出的最短指令序列，按规范形式排序，
+// 由make superopt-table重新生成。序列中x在a1中，y在a2中，
+// 中间结果在a3、a4中，结果写入a0
+typedef struct {
+  char *key;      // 规范形式，如(+ x (* y 3))
+  int saved;      // 比指令选择节省的指令数
+  int uses;       // 读取的变量，第0位为x，第1位为y
+  char *insns[3]; // 指令序列
+} SuperoptEntry;
+
+static SuperoptEntry SuperoptTable[] = {
+#include "superopt.inc"
+};
+
+// 查表的树最多的运算节点数
+#define SUPEROPT_OPS 3
+
+// 查表的次数、命中的次数和节省的指令数，用于-fopt-report
+static int SuperoptTries;
+static int SuperoptHits;
+static int SuperoptSaved;
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void superoptBegin(void) { SuperoptTries = SuperoptHits = SuperoptSaved = 0; }
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void superoptEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile,
+            "superopt: %d expressions matched, %d instructions saved\n",
+            SuperoptHits, SuperoptSaved);
+}
+
+/**
+ * @brief 子树中的运算节点数，负的常量算作常量
+ * @param  node
+ * @param  depth 距查表的树的根的层数
+ * @return int 不能查表时返回-1：有赋值、除法或公共子表达式，或运算过多
+ */
+static int superoptOps(NodeId node, int depth) {
+  if (depth > SUPEROPT_OPS)
+    return -1;
+  if (depth && CseDef && (CseDef[node] || CseUse[node]))
+    return -1;
+  NodeKind kind = nodeKind(node);
+  if (kind == ND_NUM || kind == ND_VAR)
+    return 0;
+  if (kind == ND_NEG) {
+    if (nodeKind(nodeLhs(node)) == ND_NUM)
+      return 0;
+    int n = superoptOps(nodeLhs(node), depth + 1);
+    return n < 0 ? -1 : n + 1;
+  }
+  if (kind != ND_ADD && kind != ND_SUB && kind != ND_MUL && kind != ND_EQ &&
+      kind != ND_NE && kind != ND_LT && kind != ND_LE)
+    return -1;
+  int l = superoptOps(nodeLhs(node), depth + 1);
+  int r = superoptOps(nodeRhs(node), depth + 1);
+  if (l < 0 || r < 0 || l + r + 1 > SUPEROPT_OPS)
+    return -1;
+  return l + r + 1;
+}
+
+// 序列化的状态，与tools/superopt.c中的规范形式一致
+typedef struct {
+  int mask;     // 按前序第i个满足交换律的运算交换操作数
+  int nth;      // 已经过的满足交换律的运算数量
+  Obj *vars[3]; // 按首次出现的顺序命名为x、y
+  int numVars;
+} SuperoptCanon;
+
+static bool isCommutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL || kind == ND_EQ || kind == ND_NE;
+}
+
+static char *superoptOpName(NodeKind kind) {
+  switch (kind) {
+  case ND_ADD:
+    return "+";
+  case ND_SUB:
+    return "-";
+  case ND_MUL:
+    return "*";
+  case ND_EQ:
+    return "==";
+  case ND_NE:
+    return "!=";
+  case ND_LT:
+    return "<";
+  default:
+    return "<=";
+  }
+}
+
+/**
+ * @brief 序列化子树，变量按首次出现的顺序命名
+ * @param  node
+ * @param  c
+ * @param  buf
+ * @param  end 缓冲区的结尾
+ * @return char* 写入的结尾
+ */
+static char *superoptSerialize(NodeId node, SuperoptCanon *c, char *buf,
+                               char *end) {
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    return buf + snprintf(buf, end - buf, "%d", nodeVal(node));
+  case ND_VAR: {
+    Obj *var = nodeVar(node);
+    int n = 0;
+    while (n < c->numVars && c->vars[n] != var)
+      n++;
+    if (n == c->numVars && c->numVars < 3)
+      c->vars[c->numVars++] = var;
+    return buf + snprintf(buf, end - buf, "%s", n ? n == 1 ? "y" : "z" : "x");
+  }
   case ND_NEG:
-    genExpr(node->lhs);
-    printf("# negative the value of a0\n");
-    printf("  neg a0, a0\n");
+    if (nodeKind(nodeLhs(node)) == ND_NUM)
+      return buf + snprintf(buf, end - buf, "%d",
+                            (int32_t)(0 - (uint32_t)nodeVal(nodeLhs(node))));
+    buf += snprintf(buf, end - buf, "(neg ");
+    buf = superoptSerialize(nodeLhs(node), c, buf, end);
+    return buf + snprintf(buf, end - buf, ")");
+  default:
+    break;
+  }
+  NodeKind kind = nodeKind(node);
+  bool swap = isCommutative(kind) && (c->mask >> c->nth++ & 1);
+  buf += snprintf(buf, end - buf, "(%s ", superoptOpName(kind));
+  buf = superoptSerialize(swap ? nodeRhs(node) : nodeLhs(node), c, buf, end);
+  buf += snprintf(buf, end - buf, " ");
+  buf = superoptSerialize(swap ? nodeLhs(node) : nodeRhs(node), c, buf, end);
+  return buf + snprintf(buf, end - buf, ")");
+}
+
+static int countCommutative(NodeId node) {
+  NodeKind kind = nodeKind(node);
+  if (kind == ND_NUM || kind == ND_VAR)
+    return 0;
+  if (kind == ND_NEG)
+    return countCommutative(nodeLhs(node));
+  return isCommutative(kind) + countCommutative(nodeLhs(node)) +
+         countCommutative(nodeRhs(node));
+}
+
+static int cmpSuperopt(const void *key, const void *entry) {
+  return strcmp(key, ((SuperoptEntry *)entry)->key);
+}
+
+/**
+ * @brief 查超优化的表，命中时生成表中的指令序列，结果写入a0
+ * 规范形式为交换律运算的各种交换中字典序最小的序列化结果
+ * @param  node
+ * @return true
+ * @return false 不能查表或表中没有
+ */
+static bool genSuperopt(NodeId node) {
+  if (superoptOps(node, 0) <= 0)
+    return false;
+  uint64_t start = passClock();
+  SuperoptTries++;
+
+  char key[64] = "";
+  Obj *vars[2] = {NULL, NULL};
+  int n = countCommutative(node);
+  for (int mask = 0; mask < 1 << n; mask++) {
+    char buf[64];
+    SuperoptCanon c = {.mask = mask};
+    superoptSerialize(node, &c, buf, buf + sizeof(buf));
+    // 表中只有两个变量
+    if (c.numVars > 2) {
+      passAccount(PASS_SUPEROPT, start, -1, 0);
+      return false;
+    }
+    if (!key[0] || strcmp(buf, key) < 0) {
+      strcpy(key, buf);
+      vars[0] = c.vars[0];
+      vars[1] = c.vars[1];
+    }
+  }
+
+  size_t num = sizeof(SuperoptTable) / sizeof(*SuperoptTable);
+  SuperoptEntry *e =
+      bsearch(key, SuperoptTable, num, sizeof(*SuperoptTable), cmpSuperopt);
+  if (!e) {
+    passAccount(PASS_SUPEROPT, start, -1, 0);
+    return false;
+  }
+
+  printLn("# superoptimized %s", key);
+  int len = 0;
+  for (int i = 0; i < 2; i++) {
+    if (!(e->uses >> i & 1))
+      continue;
+    printLn("  lw a%d, -%d(fp)", i + 1, vars[i]->offset);
+    len++;
+  }
+  for (int i = 0; i < 3 && e->insns[i]; i++, len++)
+    printLn("  %s", e->insns[i]);
+
+  SuperoptHits++;
+  SuperoptSaved += e->saved;
+  passAccount(PASS_SUPEROPT, start, len + e->saved, len);
+  return true;
+}
+
+/**
+ * @brief 按覆盖的模式生成表达式，结果写入a0
+ * 小的表达式树先查超优化的表
+ * @param  node
+ */
+static void genExprNode(NodeId node) {
+  if (OptSuperopt && genSuperopt(node))
     return;
+
+  NodeKind kind = nodeKind(node);
+  switch (kind) {
+  case ND_NUM:
   case ND_VAR:
-    getAddr(node);
-    printf("# load the value of a0\n");
-    printf("  ld a0, 0(a0)\n");
+    genLeaf(node, "a0");
     return;
-  case ND_ASSIGN:
-    getAddr(node->lhs);
+  case ND_NEG:
+    // 负的常量直接装入
+    if (nodeKind(nodeLhs(node)) == ND_NUM) {
+      genConst("a0", (int32_t)(0 - (uint32_t)nodeVal(nodeLhs(node))));
+      return;
+    }
+    printLn("# negative the value");
+    printLn("  negw a0, %s", genOperand(nodeLhs(node), "a0"));
+    return;
+  case ND_ASSIGN: {
+    NodeId lhs = nodeLhs(node);
+    if (nodeKind(lhs) != ND_VAR)
+      errorTok(nodeTok(lhs), "not an value");
+    genExpr(nodeRhs(node));
+    Obj *var = nodeVar(lhs);
+    printLn("# store a0 to variable %s, it's %d(fp)", var->name, var->offset);
+    printLn("  sw a0, -%d(fp)", var->offset);
+    return;
+  }
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    break;
+  default:
+    errorTok(nodeTok(node), "invalid expression");
+  }
+
+  NodeId lhs = nodeLhs(node), rhs = nodeRhs(node);
+
+  // 一侧为常量时使用立即数指令，不能使用时将常量装入a1
+  if (nodeKind(rhs) == ND_NUM || nodeKind(lhs) == ND_NUM) {
+    bool left = nodeKind(rhs) != ND_NUM;
+    int c = nodeVal(left ? lhs : rhs);
+    char *x = genOperand(left ? rhs : lhs, "a0");
+    if (genImmOp(kind, x, c, left))
+      return;
+    genConst("a1", c);
+    if (left)
+      genBinOp(kind, "a1", x);
+    else
+      genBinOp(kind, x, "a1");
+    return;
+  }
+
+  // 右侧为寄存器操作数，左侧没有副作用时才能先算左侧
+  char *l, *r;
+  if (isOperand(rhs) && !hasEffect(lhs)) {
+    l = genOperand(lhs, "a0");
+    r = genOperand(rhs, "a1");
+  } else if (isOperand(lhs)) {
+    r = genOperand(rhs, "a0");
+    l = genOperand(lhs, "a1");
+  } else {
+    genExpr(rhs);
     push();
-    genExpr(node->rhs);
+    genExpr(lhs);
     pop("a1");
-    printf("# assign the value of a1 to a0\n");
-    printf("  sd a0, 0(a1)\n");
+    l = "a0";
+    r = "a1";
+  }
+  genBinOp(kind, l, r);
+}
+
+/* RISC-V向量扩展（RVV）自动向量化 */
+
+// 一个归约：acc = acc op expr
+typedef struct VecReduction VecReduction;
+struct VecReduction {
+  Obj *acc;       // 累加变量
+  NodeKind op;    // ND_ADD, ND_SUB, ND_MUL
+  NodeId expr;    // 每次迭代累加的表达式
+  NodeId accNode; // expr中代表累加变量的节点，向量计算时取0
+};
+
+// 累加器使用v8~v15，最多8个归约
+#define VEC_MAX_RED 8
+// 表达式求值使用v16~v31，限制表达式树的深度
+#define VEC_MAX_DEPTH 16
+
+// 可向量化的循环：for (i=...; i<end 或 i<=end; i=i+1) 若干归约;
+typedef struct VecLoop VecLoop;
+struct VecLoop {
+  Obj *iv;        // 归纳变量，步长为1
+  NodeId end;     // 循环上界，循环内不变
+  TokenId tok;    // 循环的开头
+  bool inclusive; // 条件为i<=end
+  VecReduction reds[VEC_MAX_RED];
+  int numRed;
+};
+
+static bool isVarNode(NodeId node, Obj *var) {
+  return nodeKind(node) == ND_VAR && nodeVar(node) == var;
+}
+
+static bool isReductionVar(VecLoop *l, Obj *var) {
+  for (int i = 0; i < l->numRed; i++)
+    if (l->reds[i].acc == var)
+      return true;
+  return false;
+}
+
+/**
+ * @brief 判断表达式能否逐元素向量化计算
+ * 只能使用归纳变量和循环内不变的变量，不能有赋值
+ * @param  node
+ * @param  l
+ * @param  allowIV 是否允许使用归纳变量
+ * @param  depth
+ * @return true
+ * @return false
+ */
+static bool isVecExpr(NodeId node, VecLoop *l, bool allowIV, int depth) {
+  if (depth >= VEC_MAX_DEPTH)
+    return false;
+
+  for (int i = 0; i < l->numRed; i++)
+    if (l->reds[i].accNode == node)
+      return true;
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    return true;
+  case ND_VAR:
+    if (nodeVar(node) == l->iv)
+      return allowIV;
+    return !isReductionVar(l, nodeVar(node));
+  case ND_NEG:
+    return isVecExpr(nodeLhs(node), l, allowIV, depth + 1);
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+    return isVecExpr(nodeLhs(node), l, allowIV, depth + 1) &&
+           isVecExpr(nodeRhs(node), l, allowIV, depth + 1);
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief 识别归约语句 acc = acc + e, acc = e + acc, acc = acc - e,
+ * acc = acc * e, acc = e * acc，以及acc = acc + e1 - e2 ...这样
+ * 累加变量位于加减链最左侧的形式
+ * @param  stmt
+ * @param  l
+ * @return true
+ * @return false
+ */
+static bool addReduction(NodeId stmt, VecLoop *l) {
+  if (nodeKind(stmt) == ND_BLOCK && nodeBodyLen(stmt) == 0)
+    return true;
+  if (nodeKind(stmt) != ND_EXPR_STMT || l->numRed == VEC_MAX_RED)
+    return false;
+
+  NodeId assign = nodeLhs(stmt);
+  if (nodeKind(assign) != ND_ASSIGN || nodeKind(nodeLhs(assign)) != ND_VAR)
+    return false;
+  Obj *acc = nodeVar(nodeLhs(assign));
+  if (acc == l->iv || isReductionVar(l, acc))
+    return false;
+
+  NodeId rhs = nodeRhs(assign);
+  NodeKind op = nodeKind(rhs);
+  if (op != ND_ADD && op != ND_SUB && op != ND_MUL)
+    return false;
+  if (isVarNode(nodeLhs(rhs), acc)) {
+    l->reds[l->numRed++] = (VecReduction){acc, op, nodeRhs(rhs), 0};
+    return true;
+  }
+  if (op != ND_SUB && isVarNode(nodeRhs(rhs), acc)) {
+    l->reds[l->numRed++] = (VecReduction){acc, op, nodeLhs(rhs), 0};
+    return true;
+  }
+  if (op == ND_MUL)
+    return false;
+
+  // 沿加减链的左侧向下查找累加变量
+  NodeId n = nodeLhs(rhs);
+  while (nodeKind(n) == ND_ADD || nodeKind(n) == ND_SUB) {
+    if (isVarNode(nodeLhs(n), acc)) {
+      l->reds[l->numRed++] = (VecReduction){acc, ND_ADD, rhs, nodeLhs(n)};
+      return true;
+    }
+    n = nodeLhs(n);
+  }
+  return false;
+}
+
+/**
+ * @brief 分析循环能否向量化
+ * 归纳变量步长为1，上界循环内不变，循环体只有互不依赖的归约，
+ * 加法和乘法在模2^32下满足结合律，向量化不改变结果
+ * @param  node
+ * @param  l
+ * @return true
+ * @return false
+ */
+static bool analyzeVecLoop(NodeId node, VecLoop *l) {
+  memset(l, 0, sizeof(*l));
+  l->tok = nodeTok(node);
+  NodeId cond = nodeCond(node), inc = nodeInc(node), body = nodeThen(node);
+  if (!cond || !inc)
+    return false;
+
+  // 条件：i < end 或 i <= end
+  if ((nodeKind(cond) != ND_LT && nodeKind(cond) != ND_LE) ||
+      nodeKind(nodeLhs(cond)) != ND_VAR)
+    return false;
+  l->iv = nodeVar(nodeLhs(cond));
+  l->end = nodeRhs(cond);
+  l->inclusive = nodeKind(cond) == ND_LE;
+
+  // 增量：i = i + 1 或 i = 1 + i
+  if (nodeKind(inc) != ND_ASSIGN || !isVarNode(nodeLhs(inc), l->iv))
+    return false;
+  NodeId step = nodeRhs(inc);
+  if (nodeKind(step) != ND_ADD)
+    return false;
+  NodeId one;
+  if (isVarNode(nodeLhs(step), l->iv))
+    one = nodeRhs(step);
+  else if (isVarNode(nodeRhs(step), l->iv))
+    one = nodeLhs(step);
+  else
+    return false;
+  if (nodeKind(one) != ND_NUM || nodeVal(one) != 1)
+    return false;
+
+  // 循环体：归约语句
+  if (nodeKind(body) == ND_BLOCK) {
+    for (uint32_t i = 0; i < nodeBodyLen(body); i++)
+      if (!addReduction(nodeBody(body, i), l))
+        return false;
+  } else if (!addReduction(body, l)) {
+    return false;
+  }
+  if (l->numRed == 0)
+    return false;
+
+  // 累加的表达式不能依赖其他累加变量，上界不能依赖归纳变量和累加变量
+  for (int i = 0; i < l->numRed; i++)
+    if (!isVecExpr(l->reds[i].expr, l, true, 0))
+      return false;
+  return isVecExpr(l->end, l, false, 0);
+}
+
+/**
+ * @brief 生成向量表达式，结果存入v(16+depth)
+ * v2中为归纳变量各元素的值
+ * @param  node
+ * @param  l
+ * @param  depth
+ */
+static void genVecExpr(NodeId node, VecLoop *l, int depth) {
+  int vd = 16 + depth;
+  for (int i = 0; i < l->numRed; i++) {
+    if (l->reds[i].accNode == node) {
+      printLn("  vmv.v.i v%d, 0", vd);
+      return;
+    }
+  }
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    if (nodeVal(node) >= -16 && nodeVal(node) <= 15) {
+      printLn("  vmv.v.i v%d, %d", vd, nodeVal(node));
+      return;
+    }
+    genConst("t0", nodeVal(node));
+    printLn("  vmv.v.x v%d, t0", vd);
+    return;
+  case ND_VAR:
+    if (nodeVar(node) == l->iv) {
+      printLn("  vmv.v.v v%d, v2", vd);
+      return;
+    }
+    printLn("  lw t0, -%d(fp)", nodeVar(node)->offset);
+    printLn("  vmv.v.x v%d, t0", vd);
+    return;
+  case ND_NEG:
+    genVecExpr(nodeLhs(node), l, depth);
+    printLn("  vrsub.vx v%d, v%d, zero", vd, vd);
     return;
   default:
     break;
   }
 
-  genExpr(node->rhs);
-  push();
-  genExpr(node->lhs);
-  pop("a1");
-
-  /* 生成二叉树结点 */
-  switch (node->kind) {
+  genVecExpr(nodeLhs(node), l, depth);
+  genVecExpr(nodeRhs(node), l, depth + 1);
+  switch (nodeKind(node)) {
   case ND_ADD:
-    printf("  add a0, a0, a1\n");
+    printLn("  vadd.vv v%d, v%d, v%d", vd, vd, vd + 1);
     return;
   case ND_SUB:
-    printf("  sub a0, a0, a1\n");
+    printLn("  vsub.vv v%d, v%d, v%d", vd, vd, vd + 1);
     return;
   case ND_MUL:
-    printf("  mul a0, a0, a1\n");
+    printLn("  vmul.vv v%d, v%d, v%d", vd, vd, vd + 1);
     return;
   case ND_DIV:
-    printf("  div a0, a0, a1\n");
-    return;
-  case ND_EQ:
-  case ND_NE:
-    // a0=a0^a1，异或指令
-    printf("  xor a0, a0, a1\n");
-
-    if (node->kind == ND_EQ)
-      // a0==a1
-      // a0=a0^a1, sltiu a0, a0, 1
-      // 等于0则置1
-      printf("  seqz a0, a0\n");
-    else
-      // a0!=a1
-      // a0=a0^a1, sltu a0, x0, a0
-      // 不等于0则置1
-      printf("  snez a0, a0\n");
-    return;
-  case ND_LT:
-    printf("  slt a0, a0, a1\n");
+    printLn("  vdiv.vv v%d, v%d, v%d", vd, vd, vd + 1);
     return;
-  case ND_LE:
-    // a0<=a1等价于
-    // a0=a1<a0, a0=a1^1
-    printf("  slt a0, a1, a0\n");
-    printf("  xori a0, a0, 1\n");
+  default:
+    unreachable();
+  }
+}
+
+/**
+ * @brief 生成向量化的循环主体
+ * 每次处理VLMAX个迭代，剩余不足VLMAX个迭代时跳出，
+ * 由随后的标量循环作为尾部处理
+ * @param  l
+ * @param  c
+ */
+static void genVecLoop(VecLoop *l, int c) {
+  int iv = l->iv->offset;
+
+  printLn("\n# ========== Vectorized loop %d ==========", c);
+  // t1 = VLMAX，v1 = {0, 1, ..., VLMAX-1}
+  printLn("  vsetvli t1, zero, e32, m1, ta, ma");
+  printLn("  vid.v v1");
+  // 累加器初始化为单位元
+  for (int i = 0; i < l->numRed; i++)
+    printLn("  vmv.v.i v%d, %d", 8 + i, l->reds[i].op == ND_MUL);
+
+  BlockId head = cfgNewBlock("vec.begin", c);
+  BlockId body = cfgNewBlock("vec.body", c);
+  BlockId end = cfgNewBlock("vec.end", c);
+  cfgJump(head);
+  cfgSetBlock(head);
+  genLoc(l->tok);
+  cfgMarkLoop(head, l->tok, -1);
+  printLn("# remaining iterations = end - i");
+  genExpr(l->end);
+  printLn("  lw a1, -%d(fp)", iv);
+  printLn("  sub a0, a0, a1");
+  if (l->inclusive)
+    printLn("  addi a0, a0, 1");
+  cfgBranch("blt a0, t1", "bge a0, t1", end, body);
+
+  cfgSetBlock(body);
+  genLoc(l->tok);
+
+  // v2 = {i, i+1, ..., i+VLMAX-1}
+  printLn("  vadd.vx v2, v1, a1");
+  for (int i = 0; i < l->numRed; i++) {
+    VecReduction *r = &l->reds[i];
+    genVecExpr(r->expr, l, 0);
+    printLn("  %s v%d, v%d, v16",
+           r->op == ND_ADD ? "vadd.vv" : r->op == ND_SUB ? "vsub.vv" : "vmul.vv",
+           8 + i, 8 + i);
+  }
+  printLn("  lw a0, -%d(fp)", iv);
+  printLn("  addw a0, a0, t1");
+  printLn("  sw a0, -%d(fp)", iv);
+  cfgJump(head);
+  cfgSetBlock(end);
+  genLoc(l->tok);
+
+  // 将各元素归约后合并到变量中
+  for (int i = 0; i < l->numRed; i++) {
+    VecReduction *r = &l->reds[i];
+    int acc = r->acc->offset;
+    if (r->op != ND_MUL) {
+      printLn("# reduce v%d into %s by sum", 8 + i, r->acc->name);
+      printLn("  vsetvli t1, zero, e32, m1, ta, ma");
+      printLn("  lw a0, -%d(fp)", acc);
+      printLn("  vmv.s.x v3, a0");
+      printLn("  vredsum.vs v3, v%d, v3", 8 + i);
+      printLn("  vmv.x.s a0, v3");
+      printLn("  sw a0, -%d(fp)", acc);
+      continue;
+    }
+
+    // 没有乘法归约指令，每次将后一半元素乘到前一半上
+    printLn("# reduce v%d into %s by product", 8 + i, r->acc->name);
+    printLn("  vsetvli t2, zero, e32, m1, ta, ma");
+    int red = count();
+    BlockId redHead = cfgNewBlock("vec.red", red);
+    BlockId redBody = cfgNewBlock("vec.red.body", red);
+    BlockId redEnd = cfgNewBlock("vec.red.end", red);
+    cfgJump(redHead);
+    cfgSetBlock(redHead);
+    genLoc(l->tok);
+    cfgMarkLoop(redHead, l->tok, -1);
+    printLn("  srli t2, t2, 1");
+    cfgBranch("beqz t2", "bnez t2", redEnd, redBody);
+    cfgSetBlock(redBody);
+    genLoc(l->tok);
+    printLn("  vslidedown.vx v3, v%d, t2", 8 + i);
+    printLn("  vsetvli zero, t2, e32, m1, ta, ma");
+    printLn("  vmul.vv v%d, v%d, v3", 8 + i, 8 + i);
+    cfgJump(redHead);
+    cfgSetBlock(redEnd);
+    genLoc(l->tok);
+    printLn("  vmv.x.s t0, v%d", 8 + i);
+    printLn("  lw a0, -%d(fp)", acc);
+    printLn("  mulw a0, a0, t0");
+    printLn("  sw a0, -%d(fp)", acc);
+  }
+}
+
+/**
+ * @brief 生成表达式，处理公共子表达式
+ * 值已保存在寄存器中时直接拷贝，首次计算后保存到寄存器中
+ * @param  node
+ */
+static void genExpr(NodeId node) {
+  genLoc(nodeTok(node));
+  if (CseUse && CseUse[node]) {
+    printLn("# reuse common subexpression in s%d", CseUse[node]);
+    printLn("  mv a0, s%d", CseUse[node]);
     return;
+  }
+
+  genExprNode(node);
+
+  if (CseDef && CseDef[node])
+    printLn("  mv s%d, a0", CseDef[node]);
+}
+
+/* if转换 */
+
+// 两个分支都只给同一个变量赋值的if语句，先计算两侧的值，再以无分支的
+// 指令序列选择其一，避免数据相关的条件使分支预测错误。条件在a5中，
+// 先算出的一侧在a6中。基本指令集以掩码选择：m=-cond，x=b^((a^b)&m)；
+// 支持Zicond时以czero.eqz、czero.nez清零未选择的一侧后相或。
+// 两侧和选择的指令数超过-fif-convert-budget时不转换
+
+// 转换的if语句数，用于-fopt-report
+static int IfConverted;
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void ifConvertBegin(void) { IfConverted = 0; }
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void ifConvertEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile, "if-convert: %d if statements converted\n",
+            IfConverted);
+}
+
+/**
+ * @brief 只给一个变量赋值的语句，或只含这样一条语句的语句块
+ * @param  stmt
+ * @param  var 赋值的变量
+ * @return NodeId 赋的值，不是这样的语句时返回0
+ */
+static NodeId selectArm(NodeId stmt, Obj **var) {
+  if (nodeKind(stmt) == ND_BLOCK && nodeBodyLen(stmt) == 1)
+    stmt = nodeBody(stmt, 0);
+  if (nodeKind(stmt) != ND_EXPR_STMT)
+    return 0;
+  NodeId expr = nodeLhs(stmt);
+  if (nodeKind(expr) != ND_ASSIGN || nodeKind(nodeLhs(expr)) != ND_VAR ||
+      (CseDef && CseDef[expr]))
+    return 0;
+  *var = nodeVar(nodeLhs(expr));
+  return nodeRhs(expr);
+}
+
+/**
+ * @brief 估计计算没有副作用的表达式的指令数
+ * @param  node
+ * @return int 有除法时返回-1，除法的延迟大于分支预测错误的代价
+ */
+static int selectCost(NodeId node) {
+  if (CseUse && CseUse[node])
+    return 0;
+  NodeKind kind = nodeKind(node);
+  switch (kind) {
+  case ND_NUM:
+    return isImm(nodeVal(node)) ? 1 : 2;
+  case ND_VAR:
+    return 1;
+  case ND_NEG: {
+    int c = selectCost(nodeLhs(node));
+    return c < 0 ? -1 : c + 1;
+  }
+  case ND_DIV:
+    return -1;
   default:
     break;
   }
 
-  errorTok(node->tok, "invalid expression");
+  NodeId lhs = nodeLhs(node), rhs = nodeRhs(node);
+  int l = selectCost(lhs), r = selectCost(rhs);
+  if (l < 0 || r < 0)
+    return -1;
+  int c = l + r + (kind == ND_EQ || kind == ND_NE || kind == ND_LE ? 2 : 1);
+  // 两侧都不是寄存器操作数时经过栈
+  if (!isOperand(lhs) && !isOperand(rhs))
+    c += 4;
+  return c;
+}
+
+static bool isZero(NodeId node) {
+  return nodeKind(node) == ND_NUM && nodeVal(node) == 0;
+}
+
+/**
+ * @brief 对if语句进行if转换
+ * @param  node
+ * @return true
+ * @return false 不能转换或代价超过上限
+ */
+static bool genSelect(NodeId node) {
+  // 没有else时，条件为假的一侧是变量原来的值，以0表示
+  Obj *var, *elsVar;
+  NodeId a = selectArm(nodeThen(node), &var), b = 0;
+  if (!a)
+    return false;
+  if (nodeEls(node) &&
+      (!(b = selectArm(nodeEls(node), &elsVar)) || elsVar != var))
+    return false;
+
+  uint64_t start = passClock();
+  NodeId cond = nodeCond(node);
+  NodeKind condKind = nodeKind(cond);
+  bool isBool = condKind == ND_EQ || condKind == ND_NE || condKind == ND_LT ||
+                condKind == ND_LE;
+  bool za = isZero(a), zb = b && isZero(b);
+  int ca = hasEffect(a) ? -1 : za ? 0 : selectCost(a);
+  int cb = !b ? 1 : hasEffect(b) ? -1 : zb ? 0 : selectCost(b);
+  if (ca < 0 || cb < 0 || (za && zb)) {
+    passAccount(PASS_IF_CONVERT, start, -1, 0);
+    return false;
+  }
+
+  // 保存条件、暂存先算出的一侧、选择的指令数
+  bool spill = !za && !isOperand(a) && b && !zb && !isOperand(b);
+  int cost = ca + cb + spill + (za || zb ? 1 : 3);
+  cost += OptZicond ? 1 : 1 + !isBool;
+  if (cost > OptIfConvertBudget) {
+    passAccount(PASS_IF_CONVERT, start, -1, 0);
+    return false;
+  }
+
+  printLn("\n# ========== If-converted statement %d ==========", count());
+  genExpr(cond);
+  if (OptZicond) {
+    printLn("  mv a5, a0");
+  } else {
+    if (!isBool)
+      printLn("  snez a0, a0");
+    // 为真的一侧是0时，以条件为假时全为1的掩码选择另一侧
+    printLn(za ? "  addi a5, a0, -1" : "  neg a5, a0");
+  }
+
+  // 两侧的值所在的寄存器，先计算不是寄存器操作数的一侧
+  char *ra = NULL, *rb = NULL;
+  if (!za && !isOperand(a)) {
+    genExpr(a);
+    ra = "a0";
+  }
+  if (b && !zb && !isOperand(b)) {
+    if (ra) {
+      printLn("  mv a6, a0");
+      ra = "a6";
+    }
+    genExpr(b);
+    rb = "a0";
+  }
+  if (!za && !ra)
+    ra = genOperand(a, "a6");
+  if (!b) {
+    printLn("# load variable %s from the stack, it's %d(fp)", var->name,
+            var->offset);
+    printLn("  lw a7, -%d(fp)", var->offset);
+    rb = "a7";
+  } else if (!zb && !rb) {
+    rb = genOperand(b, "a7");
+  }
+
+  if (za) {
+    printLn(OptZicond ? "  czero.nez a0, %s, a5" : "  and a0, %s, a5", rb);
+  } else if (zb) {
+    printLn(OptZicond ? "  czero.eqz a0, %s, a5" : "  and a0, %s, a5", ra);
+  } else if (OptZicond) {
+    printLn("  czero.eqz a6, %s, a5", ra);
+    printLn("  czero.nez a5, %s, a5", rb);
+    printLn("  or a0, a6, a5");
+  } else {
+    printLn("  xor a6, %s, %s", ra, rb);
+    printLn("  and a6, a6, a5");
+    printLn("  xor a0, %s, a6", rb);
+  }
+  printLn("# store a0 to variable %s, it's %d(fp)", var->name, var->offset);
+  printLn("  sw a0, -%d(fp)", var->offset);
+
+  IfConverted++;
+  passAccount(PASS_IF_CONVERT, start, b ? 2 : 1, 0);
+  return true;
 }
 
 /**
  * @brief 生成语句
  * @param  Nd
  */
-static void genStmt(Node *node) {
-  switch (node->kind) {
+static void genStmt(NodeId node) {
+  if (nodeKind(node) != ND_BLOCK)
+    genLoc(nodeTok(node));
+  switch (nodeKind(node)) {
   // if语句
   case ND_IF: {
+    if (OptIfConvert && genSelect(node))
+      return;
     int c = count();
-    printf("\n# ========== Branching statement ==========\n");
-    printf("\n# cond expression %d \n", c);
-    genExpr(node->cond);
-
-    printf("# if cond is false, jump to else statement\n");
-    printf("  beqz a0, .L.else.%d\n", c);
-    printf("# if cond is true, execute then statement\n");
-    genStmt(node->then);
-
-    printf("# jump to end statement\n");
-    printf("  j .L.end.%d\n", c);
-    printf("# else statement %d\n", c);
-    printf(".L.else.%d:\n", c);
-    if (node->els)
-      genStmt(node->els);
-
-    printf(".L.end.%d:\n", c);
+    printLn("\n# ========== Branching statement ==========");
+    printLn("\n# cond expression %d ", c);
+    genExpr(nodeCond(node));
+
+    BlockId then = cfgNewBlock("then", c);
+    BlockId els = nodeEls(node) ? cfgNewBlock("else", c) : 0;
+    BlockId end = cfgNewBlock("end", c);
+    // cond为假时跳转到else语句，没有else时跳转到结尾
+    cfgBranch("beqz a0", "bnez a0", els ? els : end, then);
+
+    cfgSetBlock(then);
+    genStmt(nodeThen(node));
+    cfgJump(end);
+    if (els) {
+      cfgSetBlock(els);
+      genStmt(nodeEls(node));
+      cfgJump(end);
+    }
+
+    cfgSetBlock(end);
     return;
   }
   // for
   case ND_FOR: {
     int c = count();
-    printf("\n# ========== Loop statement ==========\n");
-    if (node->init) {
-      printf("# init expression %d\n", c);
-      genStmt(node->init);
+    printLn("\n# ========== Loop statement ==========");
+    if (nodeInit(node)) {
+      printLn("# init expression %d", c);
+      genStmt(nodeInit(node));
+    }
+
+    // 可向量化时先执行向量循环，之后的标量循环处理剩余的迭代
+    VecLoop l;
+    bool vectorized = false;
+    if (OptRVV && OptVectorize) {
+      uint64_t start = passClock();
+      vectorized = analyzeVecLoop(node, &l);
+      if (vectorized)
+        genVecLoop(&l, c);
+      passAccount(PASS_VECTORIZE, start, -1, 0);
     }
-    printf("# the %d segement label of %d times loop\n", c, c);
-    printf(".L.begin.%d:\n", c);
 
-    printf("# cond expression %d\n", c);
-    if (node->cond) {
-      genExpr(node->cond);
-      printf("  beqz a0, .L.end.%d\n", c);
+    BlockId head = cfgNewBlock("begin", c);
+    BlockId body = cfgNewBlock("body", c);
+    BlockId end = cfgNewBlock("end", c);
+    cfgJump(head);
+
+    // 条件判断，cond为假时跳出循环
+    cfgSetBlock(head);
+    cfgMarkLoop(head, nodeTok(node), vectorized ? -1 : loopTrips(node));
+    if (nodeCond(node)) {
+      printLn("# cond expression %d", c);
+      genExpr(nodeCond(node));
+      cfgBranch("beqz a0", "bnez a0", end, body);
+    } else {
+      cfgJump(body);
     }
 
-    genStmt(node->then);
-    if (node->inc)
-      genExpr(node->inc);
-    printf("  j .L.begin.%d\n", c);
-    printf(".L.end.%d:\n", c);
+    // 循环体和inc，之后回到条件判断
+    cfgSetBlock(body);
+    genStmt(nodeThen(node));
+    if (nodeInc(node))
+      genExpr(nodeInc(node));
+    cfgJump(head);
+    cfgSetBlock(end);
     return;
   }
 
   // 语句块
   case ND_BLOCK:
-    for (Node *n = node->body; n; n = n->next)
-      genStmt(n);
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      genStmt(nodeBody(node, i));
     return;
   // return语句
   case ND_RETURN:
-    genExpr(node->lhs);
-    printf(" j .L.return\n");
+    genExpr(nodeLhs(node));
+    cfgReturn();
     return;
   // 表达式语句
   case ND_EXPR_STMT:
-    genExpr(node->lhs);
+    genExpr(nodeLhs(node));
     return;
 
   default:
     break;
   }
 
-  errorTok(node->tok, "invalid statement");
+  errorTok(nodeTok(node), "invalid statement");
 }
 
+// 函数中使用到的公共子表达式寄存器数量，即各语句中的最大值
+static int NumSavedRegs;
+// fp之下保存s1~s11的区域的大小，sN固定在-8N(fp)，本地变量排在其下
+static int SaveAreaSize;
+
+/**
+ * @brief 给新出现的本地变量分配栈上的位置，变量按出现的顺序依次向下排列
+ * @param  prog
+ */
 static void assignLocalVarOffset(Function *prog) {
-  int offset = 0;
-  for (Obj *var = prog->locals; var; var = var->next) {
+  // locals中新的变量在前
+  for (Obj *var = prog->locals; var && !var->offset; var = var->next) {
     // allocate 8 bytes for each local variable
-    offset += 8;
     // set offset from fp
-    var->offset = offset;
+    var->offset = SaveAreaSize + (var->id + 1) * 8;
   }
+}
 
-  prog->stack_size = alignTo(offset, 16);
+/**
+ * @brief 保存或恢复公共子表达式使用的寄存器，它们是被调用者保存的寄存器
+ * -g时CFI随之标出寄存器保存在栈上或已恢复
+ * @param  op "sd"或"ld"
+ */
+static void saveCseRegs(char *op) {
+  bool save = !strcmp(op, "sd");
+  for (int r = 1; r <= NumSavedRegs; r++) {
+    printLn("  %s s%d, -%d(fp)", op, r, 8 * r);
+    if (OptDebug && save)
+      printLn("  .cfi_offset s%d, -%d", r, 8 + 8 * r);
+    else if (OptDebug)
+      printLn("  .cfi_restore s%d", r);
+  }
 }
 
 /**
- * @brief 代码生成入口函数
- * @param  node
+ * @brief 代码生成入口函数，输出函数的开头
+ * 栈的大小在生成所有语句后才能确定，分配栈的代码放在函数的末尾
+ * @param  out 汇编代码的输出文件
  */
-void codegen(Function *prog) {
-  assignLocalVarOffset(prog);
+void codegenBegin(FILE *out) {
+  OutputFile = out;
+  // 每次编译从头计数，保证同一程序的输出相同
+  Depth = 0;
+  i = 1;
+  NumSavedRegs = 0;
+  SaveAreaSize = OptCSE ? 8 * CSE_NUM_REGS : 0;
+  // 上次编译可能在语句的代码生成中报错退出（--server），
+  // 此时仍处于语句中，函数开头不能写入控制流图；块在cfgBegin时重新分配
+  InStmt = false;
+  LocPending = false;
+  LocBlock = 0;
+  if (OptCostReport)
+    costBegin();
+
+  // 启用向量扩展，汇编器才能识别向量指令
+  if (OptRVV)
+    printLn("  .option arch, +v");
+  if (OptZicond)
+    printLn("  .option arch, +zicond");
+
+  // 调试信息中的源文件
+  if (OptDebug) {
+    fprintf(OutputFile, "  .file 1 \"");
+    for (char *p = sourceName(); *p; p++)
+      fprintf(OutputFile, *p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+    fprintf(OutputFile, "\"\n");
+  }
 
   // 声明一个全局main段，同时也是程序入口段
-  printf(".globl main\n");
+  printLn(".globl main");
+  if (OptDebug)
+    printLn("  .type main, @function");
   // main段标签
-  printf("main:\n");
+  printLn("main:");
+  // CFI：调用者的栈顶（CFA）相对于sp或fp的位置，以及保存的fp和s1~sN的位置
+  if (OptDebug)
+    printLn("  .cfi_startproc");
 
   // 栈布局
   //-------------------------------// sp
   //              fp                  fp = sp-8
   //-------------------------------// fp
-  //              'a'                 fp-8
-  //              'b'                 fp-16
+  //            s1~s11                sN在fp-8N，开启公共子表达式消除时
+  //-------------------------------// fp-SaveAreaSize
+  //              'a'                 fp-SaveAreaSize-8
+  //              'b'                 fp-SaveAreaSize-16
   //              ...
-  //              'z'                 fp-208
-  //-------------------------------// sp=sp-8-208
+  //-------------------------------// sp=sp-8-stack_size
   //           表达式计算
   //-------------------------------//
 
   /* Prologue, 前言 */
-  printf("# push fp to stack\n");
+  printLn("# push fp to stack");
   // 将fp压入栈中，保存fp的值
-  printf("  addi sp, sp, -8\n");
-  printf("  sd fp, 0(sp)\n");
+  printLn("  addi sp, sp, -8");
+  if (OptDebug)
+    printLn("  .cfi_def_cfa_offset 8");
+  printLn("  sd fp, 0(sp)");
+  if (OptDebug)
+    printLn("  .cfi_offset fp, -8");
   // 将sp写入fp
-  printf("  mv fp, sp\n");
-
-  // 26个字母*8字节=208字节，栈腾出208字节的空间
-  printf("  addi sp, sp, -%d\n", prog->stack_size);
+  printLn("  mv fp, sp");
+  if (OptDebug)
+    printLn("  .cfi_def_cfa fp, 8");
+  // 跳转到函数末尾分配栈，之后返回到函数体
+  printLn("  j .L.prologue");
+  printLn(".L.body:");
+}
 
-  genStmt(prog->body);
+/**
+ * @brief 生成一条顶层语句，语句的代码生成到控制流图中，化简、排列后输出
+ * @param  node
+ */
+static void genTopStmt(NodeId node) {
+  InStmt = true;
+  cfgBegin(count(), nodeTok(node));
+  LocBlock = 0;
+  LocPending = false;
+  genStmt(node);
+  InStmt = false;
+  cfgEnd(OutputFile);
   assert(Depth == 0);
+}
+
+/**
+ * @brief 生成当前的顶层语句
+ * @param  prog
+ */
+void codegen(Function *prog) {
+  // 公共子表达式消除的分析已经确定需要使用的寄存器。
+  // 它们在函数开头已保存到固定的位置，之前未改写，首次使用前在CFI中标出即可
+  if (OptCSE && CseNumRegs > NumSavedRegs) {
+    for (int r = NumSavedRegs + 1; OptDebug && r <= CseNumRegs; r++)
+      fprintf(OutputFile, "  .cfi_offset s%d, -%d\n", r, 8 + 8 * r);
+    NumSavedRegs = CseNumRegs;
+  }
+  assignLocalVarOffset(prog);
+  if (Nodes.len > EffectCap) {
+    EffectCap = Nodes.len;
+    EffectMemo = realloc(EffectMemo, EffectCap);
+  }
+  memset(EffectMemo, 0, Nodes.len);
+
+  // 一组语句仍逐条生成，公共子表达式的寄存器在语句之间保持
+  if (prog->group && nodeKind(prog->body) == ND_BLOCK) {
+    for (uint32_t i = 0; i < nodeBodyLen(prog->body); i++)
+      genTopStmt(nodeBody(prog->body, i));
+    return;
+  }
+  genTopStmt(prog->body);
+}
+
+/**
+ * @brief 输出函数的结尾，以及分配栈的代码
+ * @param  prog
+ */
+void codegenEnd(Function *prog) {
+  if (OptCostReport)
+    costEnd();
+
+  // fp之下保存公共子表达式使用的寄存器s1~sN，之后是本地变量
+  prog->stack_size = alignTo(SaveAreaSize + prog->numLocals * 8, 16);
 
   /* Epilogue，后语 */
 
   // 输出return段标签
-  printf(".L.return:\n");
+  printLn(".L.return:");
+  saveCseRegs("ld");
+  // 之后分配栈的代码中，CFA仍相对于fp
+  if (OptDebug)
+    printLn("  .cfi_remember_state");
   // 将fp的值改写回sp
-  printf("  mv sp, fp\n");
+  printLn("  mv sp, fp");
+  if (OptDebug)
+    printLn("  .cfi_def_cfa sp, 8");
   // 将最早fp保存的值弹栈，恢复fp。
-  printf("  ld fp, 0(sp)\n");
-  printf("  addi sp, sp, 8\n");
+  printLn("  ld fp, 0(sp)");
+  if (OptDebug)
+    printLn("  .cfi_restore fp");
+  printLn("  addi sp, sp, 8");
+  if (OptDebug)
+    printLn("  .cfi_def_cfa_offset 0");
 
   // 生成程序结束指令
-  printf("  ret\n");
-}
\ No newline at end of file
+  printLn("  ret");
+  if (OptDebug)
+    printLn("  .cfi_restore_state");
+
+  // 为本地变量分配栈，保存被调用者保存的寄存器
+  printLn(".L.prologue:");
+  printLn("  addi sp, sp, -%d", prog->stack_size);
+  saveCseRegs("sd");
+  printLn("  j .L.body");
+  if (OptDebug) {
+    printLn("  .cfi_endproc");
+    printLn("  .size main, .-main");
+  }
+}
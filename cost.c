@@ -0,0 +1,311 @@
+#include "rvcc.h"
+
+/* 静态周期估计 */
+
+// 按处理器模型估计生成的汇编代码中每个基本块的周期数，不运行代码。
+// 指令按顺序发射，源寄存器就绪后才能发射，因此访存读之后立即使用结果会停顿；
+// 每个周期最多使用一次访存和乘除法部件，除法器不流水。
+// 跳转和静态预测为跳转的分支（向后的分支）使取指中断，
+// 向前的分支预测为不跳转，不计代价。寄存器的就绪时间只在块内跟踪。
+
+// 处理器模型，由-mtune选择
+typedef struct CoreModel CoreModel;
+struct CoreModel {
+  char *name;
+  int width; // 每个周期最多发射的指令数
+  int alu;   // 整数运算的延迟
+  int load;  // 访存读的延迟
+  int mul;   // 乘法的延迟
+  int div;   // 除法的延迟
+  int vec;   // 向量指令的延迟
+  int taken; // 跳转使取指中断的周期数
+};
+
+static CoreModel Models[] = {
+    // 单发射的五级流水线
+    {"rocket", 1, 1, 2, 4, 33, 4, 2},
+    // 双发射的顺序流水线
+    {"sifive-u74", 2, 1, 3, 3, 35, 4, 1},
+};
+
+static CoreModel *Model = &Models[0];
+
+/**
+ * @brief 选择处理器模型，-mtune=
+ * @param  name
+ */
+void costSetModel(char *name) {
+  for (size_t i = 0; i < sizeof(Models) / sizeof(*Models); i++) {
+    if (!strcmp(Models[i].name, name)) {
+      Model = &Models[i];
+      return;
+    }
+  }
+  error("unknown -mtune: %s", name);
+}
+
+/* 块内的调度 */
+
+// 指令种类，决定延迟和使用的部件
+typedef enum {
+  INSN_ALU,
+  INSN_LOAD,
+  INSN_STORE,
+  INSN_MUL,
+  INSN_DIV,
+  INSN_VEC,
+  INSN_BRANCH,
+  INSN_JUMP,
+} InsnKind;
+
+// x0~x31按ABI名称排列，v0~v31的编号从32开始
+static char *RegNames[] = {
+    "zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "fp", "s1", "a0",
+    "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+    "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// 寄存器的值就绪的周期
+static int Ready[64];
+// 当前发射的周期，及其中已发射的指令数、是否已使用访存和乘除法部件
+static int Cycle;
+static int Issued;
+static bool MemBusy;
+static bool MulBusy;
+// 除法器空闲的周期
+static int DivFree;
+// 跳转的代价
+static int Penalty;
+
+/**
+ * @brief 寄存器的编号
+ * @param  p
+ * @param  len
+ * @return int 不是寄存器或为zero时返回-1
+ */
+static int regIndex(char *p, int len) {
+  if (len == 2 && !strncmp(p, "s0", 2))
+    return 8;
+  for (int i = 1; i < 32; i++)
+    if ((int)strlen(RegNames[i]) == len && !strncmp(RegNames[i], p, len))
+      return i;
+  if (len >= 2 && len <= 3 && p[0] == 'v' && isdigit(p[1])) {
+    int n = atoi(p + 1);
+    if (n < 32 && (len == 2 || isdigit(p[2])))
+      return 32 + n;
+  }
+  return -1;
+}
+
+static bool isOp(char *op, int len, char *s) {
+  return (int)strlen(s) == len && !strncmp(op, s, len);
+}
+
+static InsnKind insnKind(char *op, int len) {
+  if (isOp(op, len, "j") || isOp(op, len, "jr") || isOp(op, len, "jal") ||
+      isOp(op, len, "ret"))
+    return INSN_JUMP;
+  if (op[0] == 'b')
+    return INSN_BRANCH;
+  if (op[0] == 'v') {
+    if (!strncmp(op, "vle", 3))
+      return INSN_LOAD;
+    if (!strncmp(op, "vse", 3))
+      return INSN_STORE;
+    return INSN_VEC;
+  }
+  if (isOp(op, len, "ld") || isOp(op, len, "lw") || isOp(op, len, "lh") ||
+      isOp(op, len, "lb") || isOp(op, len, "lwu") || isOp(op, len, "lhu") ||
+      isOp(op, len, "lbu"))
+    return INSN_LOAD;
+  if (isOp(op, len, "sd") || isOp(op, len, "sw") || isOp(op, len, "sh") ||
+      isOp(op, len, "sb"))
+    return INSN_STORE;
+  if (!strncmp(op, "mul", 3))
+    return INSN_MUL;
+  if (!strncmp(op, "div", 3) || !strncmp(op, "rem", 3))
+    return INSN_DIV;
+  return INSN_ALU;
+}
+
+/**
+ * @brief 开始估计一个块
+ */
+void costBlockBegin(void) {
+  memset(Ready, 0, sizeof(Ready));
+  Cycle = Issued = DivFree = Penalty = 0;
+  MemBusy = MulBusy = false;
+}
+
+/**
+ * @brief 发射一行汇编代码，注释、标签和空行不计
+ * @param  p 行的开头
+ * @param  end 行的结尾，不包括换行
+ */
+void costInsn(char *p, char *end) {
+  while (p < end && isspace(*p))
+    p++;
+  if (p == end || *p == '#' || *p == '.' || end[-1] == ':')
+    return;
+
+  char *op = p;
+  while (p < end && !isspace(*p))
+    p++;
+  int opLen = p - op;
+  InsnKind kind = insnKind(op, opLen);
+
+  // 操作数以逗号分隔，访存的地址为off(reg)；
+  // 除了写内存和分支之外，第一个操作数为目的寄存器
+  int dst = -1, srcs[4], numSrcs = 0;
+  bool first = kind != INSN_STORE && kind != INSN_BRANCH;
+  while (p < end) {
+    while (p < end && (isspace(*p) || *p == ','))
+      p++;
+    char *arg = p;
+    while (p < end && *p != ',')
+      p++;
+    char *argEnd = p;
+    while (argEnd > arg && isspace(argEnd[-1]))
+      argEnd--;
+    char *lp = memchr(arg, '(', argEnd - arg);
+    if (lp && argEnd[-1] == ')') {
+      arg = lp + 1;
+      argEnd--;
+    }
+    if (arg == argEnd)
+      continue;
+
+    int r = regIndex(arg, argEnd - arg);
+    if (first)
+      dst = r;
+    else if (r >= 0 && numSrcs < 4)
+      srcs[numSrcs++] = r;
+    first = false;
+  }
+
+  // 源寄存器就绪、部件空闲后才能发射
+  int t = Cycle;
+  for (int i = 0; i < numSrcs; i++)
+    if (Ready[srcs[i]] > t)
+      t = Ready[srcs[i]];
+  bool mem = kind == INSN_LOAD || kind == INSN_STORE;
+  bool mul = kind == INSN_MUL || kind == INSN_DIV;
+  if (kind == INSN_DIV && DivFree > t)
+    t = DivFree;
+  if (t == Cycle && (Issued == Model->width || (mem && MemBusy) ||
+                     (mul && MulBusy)))
+    t++;
+  if (t > Cycle) {
+    Cycle = t;
+    Issued = 0;
+    MemBusy = MulBusy = false;
+  }
+  Issued++;
+  MemBusy |= mem;
+  MulBusy |= mul;
+
+  int lat = Model->alu;
+  switch (kind) {
+  case INSN_LOAD:
+    lat = Model->load;
+    break;
+  case INSN_MUL:
+    lat = Model->mul;
+    break;
+  case INSN_DIV:
+    lat = Model->div;
+    DivFree = t + lat;
+    break;
+  case INSN_VEC:
+    lat = Model->vec;
+    break;
+  case INSN_JUMP:
+    Penalty += Model->taken;
+    break;
+  default:
+    break;
+  }
+  if (dst >= 0)
+    Ready[dst] = t + lat;
+}
+
+/**
+ * @brief 预测为跳转的分支，使取指中断
+ */
+void costTaken(void) { Penalty += Model->taken; }
+
+/**
+ * @brief 结束估计一个块
+ * @return int 块的周期数
+ */
+int costBlockEnd(void) { return (Issued ? Cycle + 1 : Cycle) + Penalty; }
+
+/* 报告 */
+
+// 报告中按周期数从高到低保留的条目数，语句和循环分别保留，
+// 输入再大占用的内存也不变
+#define COST_TOP 10
+
+typedef struct CostEntry CostEntry;
+struct CostEntry {
+  int64_t cycles; // 周期数，循环为每次迭代
+  int line;       // 源代码的行
+  char text[48];  // 语句的源代码的开头
+};
+
+typedef struct CostTop CostTop;
+struct CostTop {
+  CostEntry entries[COST_TOP];
+  int len;
+  int total; // 记录过的条目数
+};
+
+static CostTop TopStmts;
+static CostTop TopLoops;
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void costBegin(void) {
+  TopStmts.len = TopStmts.total = 0;
+  TopLoops.len = TopLoops.total = 0;
+}
+
+/**
+ * @brief 记录一条顶层语句或一个循环的周期数
+ * @param  tok 语句或循环的开头
+ * @param  loop
+ * @param  cycles 语句沿着可能的路径执行一次的周期数，循环为每次迭代
+ */
+void costRecord(TokenId tok, bool loop, int64_t cycles) {
+  CostTop *top = loop ? &TopLoops : &TopStmts;
+  top->total++;
+  if (top->len == COST_TOP && top->entries[top->len - 1].cycles >= cycles)
+    return;
+
+  // 插入排序，满时替换掉最小的条目
+  CostEntry *e = top->entries;
+  int i = top->len < COST_TOP ? top->len++ : COST_TOP - 1;
+  for (; i > 0 && e[i - 1].cycles < cycles; i--)
+    e[i] = e[i - 1];
+  e[i].cycles = cycles;
+  e[i].line = tokSourceText(tok, stmtEnd(tok), e[i].text, sizeof(e[i].text));
+}
+
+/**
+ * @brief 函数结束时分别输出最耗时的语句和循环
+ */
+void costEnd(void) {
+  fprintf(DiagFile, "cost: -mtune=%s, %d statements, %d loops\n", Model->name,
+          TopStmts.total, TopLoops.total);
+  for (int i = 0; i < TopStmts.len; i++) {
+    CostEntry *e = &TopStmts.entries[i];
+    fprintf(DiagFile, "%d: statement %lld cycles: %s\n", e->line,
+            (long long)e->cycles, e->text);
+  }
+  for (int i = 0; i < TopLoops.len; i++) {
+    CostEntry *e = &TopLoops.entries[i];
+    fprintf(DiagFile, "%d: loop %lld cycles per iteration: %s\n", e->line,
+            (long long)e->cycles, e->text);
+  }
+}
@@ -0,0 +1,527 @@
+#include "rvcc.h"
+
+/* 公共子表达式消除（基于值编号） */
+
+// 纯表达式按（种类，操作数的值编号）哈希，相同的键得到相同的值编号。
+// 变量的值编号在每次赋值后更新，因此赋值会使依赖该变量的表达式失效。
+// 在支配树上按作用域记录已计算的值：if的条件支配两个分支，
+// 分支中计算的值在分支结束后不再可用；循环中被赋值的变量在循环入口得到新的值编号。
+// 之后被重复使用的值保存在s1~s11中，重复的计算替换为寄存器拷贝。
+// 开启时每次解析一组顶层语句，分析在一组之内进行，值可以在组内的语句之间复用。
+
+// 值编号分析的结果，按NodeId索引，值为寄存器编号，0表示无
+uint8_t *CseDef;
+uint8_t *CseUse;
+// 使用到的寄存器数量
+int CseNumRegs;
+
+// 哈希表的键
+typedef struct VNKey VNKey;
+struct VNKey {
+  uint32_t kind;
+  int64_t a;
+  int64_t b;
+};
+
+// 值编号哈希表，开放寻址
+static VNKey *Keys;
+static uint32_t *KeyVN;
+static uint32_t KeyCap;
+static uint32_t KeyLen;
+// 下一个值编号，0表示不是纯表达式
+static uint32_t NextVN;
+
+// 每个变量当前的值编号
+static uint32_t *VarVN;
+// 每个节点的值编号
+static uint32_t *NodeVN;
+
+// 候选的公共子表达式：首次计算的节点及其之后的使用
+typedef struct CseCand CseCand;
+struct CseCand {
+  NodeId leader; // 首次计算的节点
+  uint32_t def;  // 首次计算的位置
+  uint32_t last; // 最后一次使用的位置
+  int uses;      // 使用次数
+  int reg;       // 分配的寄存器，0表示未分配
+};
+
+static CseCand *Cands;
+static uint32_t CandLen;
+static uint32_t CandCap;
+
+// 使用：节点和对应的候选
+typedef struct CseUseRec CseUseRec;
+struct CseUseRec {
+  NodeId node;
+  uint32_t cand;
+};
+
+static CseUseRec *Uses;
+static uint32_t UseLen;
+static uint32_t UseCap;
+
+// 值编号当前可用的候选下标+1，0表示不可用
+static uint32_t *Avail;
+static uint32_t AvailCap;
+// 作用域撤销日志：记录设置过Avail的值编号
+static uint32_t *AvailLog;
+static uint32_t AvailLogLen;
+static uint32_t AvailLogCap;
+
+// 循环在代码顺序中的起止位置
+typedef struct LoopRange LoopRange;
+struct LoopRange {
+  uint32_t start;
+  uint32_t end;
+};
+
+static LoopRange *Loops;
+static uint32_t LoopLen;
+static uint32_t LoopCap;
+
+// 当前位置，按代码生成的求值顺序递增
+static uint32_t Pos;
+
+// 函数中复用的次数和保存在寄存器中的表达式数量，用于报告
+static int NumHits;
+static int NumKept;
+static int MaxRegs;
+
+// 按需扩容动态数组
+#define GROW(arr, len, cap)                                                    \
+  do {                                                                         \
+    if ((len) >= (cap)) {                                                      \
+      (cap) = (cap) ? (cap) * 2 : 64;                                          \
+      while ((len) >= (cap))                                                   \
+        (cap) *= 2;                                                            \
+      (arr) = realloc((arr), (cap) * sizeof(*(arr)));                          \
+      if (!(arr))                                                              \
+        error("out of memory");                                                \
+    }                                                                          \
+  } while (0)
+
+static uint32_t freshVN(void) { return NextVN++; }
+
+static uint64_t hashKey(VNKey *k) {
+  uint64_t h = k->kind * 0x9e3779b97f4a7c15ULL;
+  h ^= (uint64_t)k->a + 0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+  h ^= (uint64_t)k->b + 0x94d049bb133111ebULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+/**
+ * @brief 查找键对应的值编号，不存在时新建
+ * @param  kind
+ * @param  a
+ * @param  b
+ * @return uint32_t
+ */
+static uint32_t lookupVN(NodeKind kind, int64_t a, int64_t b) {
+  if (KeyLen * 2 >= KeyCap) {
+    uint32_t oldCap = KeyCap;
+    VNKey *oldKeys = Keys;
+    uint32_t *oldVN = KeyVN;
+    KeyCap = KeyCap ? KeyCap * 2 : 256;
+    Keys = calloc(KeyCap, sizeof(*Keys));
+    KeyVN = calloc(KeyCap, sizeof(*KeyVN));
+    for (uint32_t i = 0; i < oldCap; i++) {
+      if (!oldVN[i])
+        continue;
+      uint32_t j = hashKey(&oldKeys[i]) & (KeyCap - 1);
+      while (KeyVN[j])
+        j = (j + 1) & (KeyCap - 1);
+      Keys[j] = oldKeys[i];
+      KeyVN[j] = oldVN[i];
+    }
+    free(oldKeys);
+    free(oldVN);
+  }
+
+  VNKey key = {kind, a, b};
+  uint32_t i = hashKey(&key) & (KeyCap - 1);
+  while (KeyVN[i]) {
+    if (Keys[i].kind == key.kind && Keys[i].a == key.a && Keys[i].b == key.b)
+      return KeyVN[i];
+    i = (i + 1) & (KeyCap - 1);
+  }
+  Keys[i] = key;
+  KeyLen++;
+  return KeyVN[i] = freshVN();
+}
+
+/**
+ * @brief 计算纯表达式的值编号，同时记录子树中各节点的值编号
+ * @param  node
+ * @return uint32_t 含有赋值时为0
+ */
+static uint32_t valueNumber(NodeId node) {
+  uint32_t vn = 0;
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    vn = lookupVN(ND_NUM, nodeVal(node), 0);
+    break;
+  case ND_VAR:
+    vn = VarVN[nodeVar(node)->id];
+    break;
+  case ND_NEG: {
+    uint32_t a = valueNumber(nodeLhs(node));
+    vn = a ? lookupVN(ND_NEG, a, 0) : 0;
+    break;
+  }
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    uint32_t a = valueNumber(nodeLhs(node));
+    uint32_t b = valueNumber(nodeRhs(node));
+    if (!a || !b)
+      break;
+    // 满足交换律的运算，操作数按值编号排序
+    NodeKind kind = nodeKind(node);
+    if ((kind == ND_ADD || kind == ND_MUL || kind == ND_EQ || kind == ND_NE) &&
+        a > b) {
+      uint32_t t = a;
+      a = b;
+      b = t;
+    }
+    vn = lookupVN(kind, a, b);
+    break;
+  }
+  default:
+    break;
+  }
+  return NodeVN[node] = vn;
+}
+
+static void setAvail(uint32_t vn, uint32_t cand) {
+  if (vn >= AvailCap) {
+    // 扩容部分清零，表示不可用
+    uint32_t oldCap = AvailCap;
+    GROW(Avail, vn, AvailCap);
+    memset(Avail + oldCap, 0, (AvailCap - oldCap) * sizeof(*Avail));
+  }
+  GROW(AvailLog, AvailLogLen, AvailLogCap);
+  Avail[vn] = cand + 1;
+  AvailLog[AvailLogLen++] = vn;
+}
+
+static uint32_t getAvail(uint32_t vn) { return vn < AvailCap ? Avail[vn] : 0; }
+
+// 离开作用域时，撤销作用域内新增的可用值
+static void popScope(uint32_t mark) {
+  while (AvailLogLen > mark)
+    Avail[AvailLog[--AvailLogLen]] = 0;
+}
+
+/**
+ * @brief 按代码生成的求值顺序分析表达式
+ * @param  node
+ * @param  known 值编号是否已由父节点计算
+ */
+static void cseExpr(NodeId node, bool known) {
+  uint32_t vn = known ? NodeVN[node] : valueNumber(node);
+  NodeKind kind = nodeKind(node);
+
+  // 已经计算过，记录一次使用，整棵子树不再求值
+  if (vn && kind != ND_NUM && getAvail(vn)) {
+    uint32_t c = getAvail(vn) - 1;
+    Cands[c].uses++;
+    Cands[c].last = Pos++;
+    GROW(Uses, UseLen, UseCap);
+    Uses[UseLen++] = (CseUseRec){node, c};
+    return;
+  }
+
+  switch (kind) {
+  case ND_NUM:
+    return;
+  case ND_VAR:
+    break;
+  case ND_NEG:
+    cseExpr(nodeLhs(node), vn);
+    break;
+  case ND_ASSIGN: {
+    // 左侧只取地址，右侧的值成为变量新的值编号
+    NodeId rhs = nodeRhs(node);
+    cseExpr(rhs, false);
+    uint32_t rvn = NodeVN[rhs];
+    if (nodeKind(nodeLhs(node)) == ND_VAR)
+      VarVN[nodeVar(nodeLhs(node))->id] = rvn ? rvn : freshVN();
+    return;
+  }
+  default:
+    // 先右后左，与genExpr一致
+    cseExpr(nodeRhs(node), vn);
+    cseExpr(nodeLhs(node), vn);
+    break;
+  }
+
+  if (!vn)
+    return;
+
+  // 首次计算，成为候选
+  GROW(Cands, CandLen, CandCap);
+  Cands[CandLen] = (CseCand){node, Pos, Pos, 0, 0};
+  Pos++;
+  setAvail(vn, CandLen++);
+}
+
+/**
+ * @brief 收集子树中被赋值的变量
+ * @param  node
+ * @param  vars
+ * @param  len
+ * @param  seen
+ */
+static void collectAssigned(NodeId node, int *vars, int *len, bool *seen) {
+  if (!node)
+    return;
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+  case ND_VAR:
+    return;
+  case ND_IF:
+  case ND_FOR: {
+    NodeExt e = *nodeExt(node);
+    collectAssigned(e.cond, vars, len, seen);
+    collectAssigned(e.then, vars, len, seen);
+    collectAssigned(e.els, vars, len, seen);
+    collectAssigned(e.init, vars, len, seen);
+    collectAssigned(e.inc, vars, len, seen);
+    return;
+  }
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      collectAssigned(nodeBody(node, i), vars, len, seen);
+    return;
+  case ND_ASSIGN:
+    if (nodeKind(nodeLhs(node)) == ND_VAR) {
+      int id = nodeVar(nodeLhs(node))->id;
+      if (!seen[id]) {
+        seen[id] = true;
+        vars[(*len)++] = id;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  collectAssigned(nodeLhs(node), vars, len, seen);
+  collectAssigned(nodeRhs(node), vars, len, seen);
+}
+
+// 分析时使用的变量数量
+static int NumVars;
+
+/**
+ * @brief 给子树中被赋值的变量分配新的值编号
+ * @param  a
+ * @param  b
+ * @param  c
+ * @param  vars 输出被赋值的变量，可为NULL
+ * @return int 被赋值的变量数量
+ */
+static int killAssigned(NodeId a, NodeId b, NodeId c, int *vars) {
+  bool *seen = calloc(NumVars + 1, sizeof(bool));
+  int *buf = vars ? vars : calloc(NumVars + 1, sizeof(int));
+  int len = 0;
+  collectAssigned(a, buf, &len, seen);
+  collectAssigned(b, buf, &len, seen);
+  collectAssigned(c, buf, &len, seen);
+  for (int i = 0; i < len; i++)
+    VarVN[buf[i]] = freshVN();
+  free(seen);
+  if (!vars)
+    free(buf);
+  return len;
+}
+
+/**
+ * @brief 按代码生成的顺序分析语句
+ * @param  node
+ */
+static void cseStmt(NodeId node) {
+  switch (nodeKind(node)) {
+  case ND_IF: {
+    NodeId then = nodeThen(node), els = nodeEls(node);
+    cseExpr(nodeCond(node), false);
+
+    // 条件中计算的值在两个分支中都可用，
+    // else分支从条件之后的变量值编号开始，不受then分支中赋值的影响
+    uint32_t mark = AvailLogLen;
+    uint32_t *condVN = calloc(NumVars + 1, sizeof(uint32_t));
+    memcpy(condVN, VarVN, NumVars * sizeof(uint32_t));
+    cseStmt(then);
+    popScope(mark);
+    if (els) {
+      memcpy(VarVN, condVN, NumVars * sizeof(uint32_t));
+      cseStmt(els);
+      popScope(mark);
+    }
+    memcpy(VarVN, condVN, NumVars * sizeof(uint32_t));
+    free(condVN);
+    killAssigned(then, els, 0, NULL);
+    return;
+  }
+  case ND_FOR: {
+    NodeId cond = nodeCond(node), then = nodeThen(node), inc = nodeInc(node);
+    if (nodeInit(node))
+      cseStmt(nodeInit(node));
+
+    // 循环中被赋值的变量在循环入口有新的值编号，循环退出时恢复为入口的值编号
+    int *vars = calloc(NumVars + 1, sizeof(int));
+    int n = killAssigned(cond, then, inc, vars);
+    uint32_t *entryVN = calloc(n + 1, sizeof(uint32_t));
+    for (int i = 0; i < n; i++)
+      entryVN[i] = VarVN[vars[i]];
+
+    uint32_t start = Pos;
+    // 条件在循环入口求值，支配循环体和循环出口
+    if (cond)
+      cseExpr(cond, false);
+    uint32_t mark = AvailLogLen;
+    cseStmt(then);
+    if (inc)
+      cseExpr(inc, false);
+    popScope(mark);
+
+    GROW(Loops, LoopLen, LoopCap);
+    Loops[LoopLen++] = (LoopRange){start, Pos};
+    Pos++;
+
+    for (int i = 0; i < n; i++)
+      VarVN[vars[i]] = entryVN[i];
+    free(vars);
+    free(entryVN);
+    return;
+  }
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      cseStmt(nodeBody(node, i));
+    return;
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+    cseExpr(nodeLhs(node), false);
+    return;
+  default:
+    return;
+  }
+}
+
+/**
+ * @brief 给被使用的候选分配寄存器
+ * 在循环外计算、循环内使用的值，需要在整个循环内保持
+ */
+static void allocRegs(void) {
+  for (uint32_t i = 0; i < CandLen; i++) {
+    CseCand *c = &Cands[i];
+    // 变量的读取只需两条指令，至少被使用两次才值得占用寄存器
+    int minUses = nodeKind(c->leader) == ND_VAR ? 2 : 1;
+    if (c->uses < minUses) {
+      c->uses = 0;
+      continue;
+    }
+
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (uint32_t j = 0; j < LoopLen; j++) {
+        LoopRange *l = &Loops[j];
+        if (c->def < l->start && l->start <= c->last && c->last < l->end) {
+          c->last = l->end;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // 候选按首次计算的位置有序，线性扫描分配
+  uint32_t busyUntil[CSE_NUM_REGS + 1] = {0};
+  bool busy[CSE_NUM_REGS + 1] = {0};
+  for (uint32_t i = 0; i < CandLen; i++) {
+    CseCand *c = &Cands[i];
+    if (!c->uses)
+      continue;
+    for (int r = 1; r <= CSE_NUM_REGS; r++) {
+      if (!busy[r] || busyUntil[r] < c->def) {
+        busy[r] = true;
+        busyUntil[r] = c->last;
+        c->reg = r;
+        if (r > CseNumRegs)
+          CseNumRegs = r;
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * @brief 公共子表达式消除的分析入口，结果存入CseDef和CseUse
+ * @param  prog
+ */
+void cseAnalyze(Function *prog) {
+  NumVars = prog->numLocals;
+  CseNumRegs = 0;
+  CandLen = UseLen = LoopLen = AvailLogLen = Pos = 0;
+  KeyLen = 0;
+  NextVN = 1;
+  if (KeyCap) {
+    memset(KeyVN, 0, KeyCap * sizeof(*KeyVN));
+  }
+  if (AvailCap)
+    memset(Avail, 0, AvailCap * sizeof(*Avail));
+
+  free(VarVN);
+  VarVN = calloc(NumVars + 1, sizeof(*VarVN));
+  for (int i = 0; i < NumVars; i++)
+    VarVN[i] = freshVN();
+
+  free(NodeVN);
+  free(CseDef);
+  free(CseUse);
+  NodeVN = calloc(Nodes.len + 1, sizeof(*NodeVN));
+  CseDef = calloc(Nodes.len + 1, sizeof(*CseDef));
+  CseUse = calloc(Nodes.len + 1, sizeof(*CseUse));
+
+  cseStmt(prog->body);
+  allocRegs();
+  if (CseNumRegs > MaxRegs)
+    MaxRegs = CseNumRegs;
+
+  for (uint32_t i = 0; i < UseLen; i++) {
+    CseCand *c = &Cands[Uses[i].cand];
+    if (!c->reg)
+      continue;
+    CseUse[Uses[i].node] = c->reg;
+    NumHits++;
+  }
+  for (uint32_t i = 0; i < CandLen; i++) {
+    CseCand *c = &Cands[i];
+    if (!c->reg)
+      continue;
+    CseDef[c->leader] = c->reg;
+    NumKept++;
+    if (OptReport)
+      note(nodeTok(c->leader), "cse: value reused %d times, kept in s%d",
+           c->uses, c->reg);
+  }
+}
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void cseBegin(void) { NumHits = NumKept = MaxRegs = 0; }
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void cseEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile, "cse: %d hits, %d expressions kept in %d registers\n",
+            NumHits, NumKept, MaxRegs);
+}
@@ -1,23 +1,259 @@
 #include "rvcc.h"
 
-int main(int Argc, char **Argv) {
-  // 判断传入程序的参数是否为2个，Argv[0]为程序名称，Argv[1]为传入的第一个参数
-  if (Argc != 2) {
+// 目标是否支持向量扩展（V），由-march设置
+bool OptRVV;
+// 目标是否支持条件清零扩展（Zicond），由-march设置
+bool OptZicond;
+// 输出各优化所做的变换
+bool OptReport;
+// 循环展开
+bool OptUnroll;
+int OptUnrollFactor = 4;
+int OptUnrollBudget = 128;
+// 公共子表达式消除
+bool OptCSE;
+// 稀疏条件常量传播
+bool OptSCCP;
+// 标量演化
+bool OptScev;
+bool OptDumpScev;
+// 向量化循环
+bool OptVectorize;
+// 超优化的表
+bool OptSuperopt;
+// if转换
+bool OptIfConvert;
+int OptIfConvertBudget = 10;
+// 跳转穿透和块排列
+bool OptReorderBlocks;
+// 输出各优化的耗时和IR大小的变化
+bool OptTimeReport;
+// 估计周期数
+bool OptCostReport;
+// 调试信息
+bool OptDebug;
+
+/**
+ * @brief 解析-march，如rv64gc、rv64gcv、rv64gc_zicond
+ * 单字母扩展位于rv64之后、第一个'_'之前，之后是以'_'分隔的多字母扩展
+ * @param  arch
+ */
+static void parseMarch(char *arch) {
+  if (strncmp(arch, "rv64", 4))
+    error("unsupported -march: %s", arch);
+
+  char *p = arch + 4;
+  for (; *p && *p != '_'; p++) {
+    if (*p == 'v')
+      OptRVV = true;
+  }
+  while (*p == '_') {
+    char *ext = ++p;
+    while (*p && *p != '_')
+      p++;
+    if (p - ext == 6 && !strncmp(ext, "zicond", 6))
+      OptZicond = true;
+  }
+}
+
+// 编译服务器模式，及其监听的Unix域套接字路径
+static bool OptServer;
+static char *OptServerPath;
+
+/**
+ * @brief 解析命令行参数，返回输入的程序或文件名
+ * @param  Argc
+ * @param  Argv
+ * @return char*
+ */
+static char *parseArgs(int Argc, char **Argv) {
+  char *input = NULL;
+
+  for (int i = 1; i < Argc; i++) {
+    // --server，从标准输入读取编译请求
+    // --server=PATH，在Unix域套接字PATH上接受编译请求
+    if (!strcmp(Argv[i], "--server")) {
+      OptServer = true;
+      continue;
+    }
+    if (!strncmp(Argv[i], "--server=", 9)) {
+      OptServer = true;
+      OptServerPath = Argv[i] + 9;
+      continue;
+    }
+
+    // -march=
+    if (!strncmp(Argv[i], "-march=", 7)) {
+      parseMarch(Argv[i] + 7);
+      continue;
+    }
+
+    // -funroll-factor=N，部分展开时的展开因子
+    if (!strncmp(Argv[i], "-funroll-factor=", 16)) {
+      OptUnrollFactor = atoi(Argv[i] + 16);
+      continue;
+    }
+
+    // -funroll-budget=N，展开后循环的大小上限，以AST节点数计
+    if (!strncmp(Argv[i], "-funroll-budget=", 16)) {
+      OptUnrollBudget = atoi(Argv[i] + 16);
+      continue;
+    }
+
+    // -fif-convert-budget=N，if转换时两侧和选择的指令数上限
+    if (!strncmp(Argv[i], "-fif-convert-budget=", 20)) {
+      OptIfConvertBudget = atoi(Argv[i] + 20);
+      continue;
+    }
+
+    // -fopt-report，向stderr输出各优化所做的变换
+    if (!strcmp(Argv[i], "-fopt-report")) {
+      OptReport = true;
+      continue;
+    }
+
+    // -fdump-scev，向stderr输出各循环的递推和循环次数
+    if (!strcmp(Argv[i], "-fdump-scev")) {
+      OptDumpScev = true;
+      continue;
+    }
+
+    // -ftime-report，向stderr输出各优化的耗时和IR大小的变化
+    if (!strcmp(Argv[i], "-ftime-report")) {
+      OptTimeReport = true;
+      continue;
+    }
+
+    // -g，输出行号信息和CFI，供调试器和性能分析工具使用
+    if (!strcmp(Argv[i], "-g")) {
+      OptDebug = true;
+      continue;
+    }
+
+    // -fcost-report，按处理器模型估计各块、语句和循环的周期数
+    if (!strcmp(Argv[i], "-fcost-report")) {
+      OptCostReport = true;
+      continue;
+    }
+
+    // -mtune=，估计周期数使用的处理器模型，如rocket、sifive-u74
+    if (!strncmp(Argv[i], "-mtune=", 7)) {
+      costSetModel(Argv[i] + 7);
+      continue;
+    }
+
+    // -O0、-O1、-O2，-f<pass>、-fno-<pass>，如-fsccp、-fno-reorder-blocks，
+    // -print-after=<pass>，在优化之后向stderr输出IR
+    if (passOption(Argv[i]))
+      continue;
+
+    // 程序以'{'开头，"-"表示标准输入，其他'-'开头的都是选项
+    if (Argv[i][0] == '-' && Argv[i][1] != '\0')
+      error("unknown argument: %s", Argv[i]);
+
+    // 只能传入一个程序
+    if (input)
+      error("%s: invalid number of arguments", Argv[0]);
+    input = Argv[i];
+  }
+
+  // 编译服务器的程序来自请求
+  if (OptServer) {
+    if (input)
+      error("%s: --server does not take a program", Argv[0]);
+    return NULL;
+  }
+
+  if (!input) {
     // 异常处理，提示参数数量不对。
     // fprintf，格式化文件输出，往文件内写入字符串
     // stderr，异常文件（Linux一切皆文件），用于往屏幕显示异常信息
     // %s，字符串
     error("%s: invalid number of arguments", Argv[0]);
   }
+  return input;
+}
+
+// 正在编译的函数，编译出错返回服务循环时由compileAbort释放
+static Function *CurProg;
 
-  // 词法分析，解析参数
-  Token *tok = tokenize(Argv[1]);
+// 公共子表达式消除需要知道值之后的使用，开启时每次解析一组顶层语句，
+// 值可以在组内的语句之间复用。节点数达到上限时结束一组，内存的使用仍然有界
+#define GROUP_NODES (1 << 16)
 
+/**
+ * @brief 从tok开始编译函数体
+ * 每解析一条（或一组）顶层语句就进行优化并生成代码，之后释放它的Token和节点，
+ * 因此内存的使用不随程序的大小增长
+ * @param  tok
+ * @param  out
+ */
+static void compileTokens(TokenId tok, FILE *out) {
   // 语法分析，解析语法树
-  Function *prog= parse(tok);
+  Function *prog = CurProg = parseBegin(&tok, tok);
+  passBegin();
+  codegenBegin(out);
+
+  while (parseStmt(prog, &tok, tok, OptCSE ? GROUP_NODES : 0)) {
+    // 按依赖的顺序运行开启的优化，常量传播可能删除整条语句
+    if (passRun(prog))
+      // 代码生成
+      codegen(prog);
+    releaseTokens(tok);
+  }
+
+  codegenEnd(prog);
+  passEnd();
+  free(prog);
+  CurProg = NULL;
+}
+
+/**
+ * @brief 编译出错返回服务循环后，释放未编译完的函数
+ * 其余的编译状态在下一次编译开始时重置
+ */
+void compileAbort(void) {
+  free(CurProg);
+  CurProg = NULL;
+}
+
+/**
+ * @brief 编译一个程序
+ * @param  input
+ * @param  out
+ */
+void compile(char *input, FILE *out) {
+  // 词法分析，按需解析参数
+  compileTokens(tokenize(input), out);
+}
+
+/**
+ * @brief 编译一个文件，path为"-"时读取标准输入
+ * @param  path
+ * @param  out
+ */
+void compileFile(char *path, FILE *out) {
+  compileTokens(tokenizeFile(path), out);
+}
+
+int main(int Argc, char **Argv) {
+  DiagFile = stderr;
+
+  // 解析命令行参数，Argv[0]为程序名称
+  char *input = parseArgs(Argc, Argv);
+  passInit();
 
-  // 代码生成
-  codegen(prog);
+  // 编译服务器，处理请求直到输入结束
+  if (OptServer)
+    return runServer(OptServerPath);
 
+  // 以'{'开头的参数是程序本身，否则为文件名，"-"表示标准输入
+  char *p = input;
+  while (isspace(*p))
+    p++;
+  if (*p == '{')
+    compile(input, stdout);
+  else
+    compileFile(input, stdout);
   return 0;
 }
@@ -1,14 +1,72 @@
 #include "rvcc.h"
 
+// 节点池
+NodePool Nodes;
+
 /**
  * @brief create a new Node
+ * 节点追加到节点池末尾，0号节点保留为空节点
  * @param  kind
- * @return Node*
+ * @return NodeId
  */
-static Node *newNode(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+NodeId newNode(NodeKind kind, TokenId tok) {
+  NodePool *np = &Nodes;
+  if (np->len == 0)
+    np->len = 1;
+  if (np->len >= np->cap) {
+    np->cap = np->cap ? np->cap * 2 : 256;
+    np->nodes = realloc(np->nodes, np->cap * sizeof(*np->nodes));
+    if (!np->nodes)
+      error("out of memory");
+  }
+  Node *node = &np->nodes[np->len];
+  memset(node, 0, sizeof(*node));
   node->kind = kind;
   node->tok = tok;
+  return np->len++;
+}
+
+/**
+ * @brief 新建一个控制流节点，额外字段分配在侧表中
+ * @param  kind
+ * @param  tok
+ * @return NodeId
+ */
+NodeId newCtrl(NodeKind kind, TokenId tok) {
+  NodePool *np = &Nodes;
+  if (np->extLen == np->extCap) {
+    np->extCap = np->extCap ? np->extCap * 2 : 64;
+    np->exts = realloc(np->exts, np->extCap * sizeof(*np->exts));
+    if (!np->exts)
+      error("out of memory");
+  }
+  memset(&np->exts[np->extLen], 0, sizeof(*np->exts));
+  NodeId node = newNode(kind, tok);
+  nodeAt(node)->ext = np->extLen++;
+  return node;
+}
+
+/**
+ * @brief 新建一个代码块节点，语句列表拷贝到节点池的Lists中
+ * @param  stmts
+ * @param  len
+ * @param  tok
+ * @return NodeId
+ */
+NodeId newBlock(NodeId *stmts, uint32_t len, TokenId tok) {
+  NodePool *np = &Nodes;
+  if (np->listLen + len > np->listCap) {
+    while (np->listLen + len > np->listCap)
+      np->listCap = np->listCap ? np->listCap * 2 : 256;
+    np->lists = realloc(np->lists, np->listCap * sizeof(*np->lists));
+    if (!np->lists)
+      error("out of memory");
+  }
+  memcpy(np->lists + np->listLen, stmts, len * sizeof(*stmts));
+  NodeId node = newNode(ND_BLOCK, tok);
+  nodeAt(node)->body = np->listLen;
+  nodeAt(node)->bodyLen = len;
+  np->listLen += len;
   return node;
 }
 
@@ -16,11 +74,11 @@ static Node *newNode(NodeKind kind, Token *tok) {
  * @brief 新建一个单插树
  * @param  kind
  * @param  expr
- * @return Node*
+ * @return NodeId
  */
-static Node *newUnary(NodeKind kind, Node *expr, Token *tok) {
-  Node *node = newNode(kind, tok);
-  node->lhs = expr;
+NodeId newUnary(NodeKind kind, NodeId expr, TokenId tok) {
+  NodeId node = newNode(kind, tok);
+  nodeAt(node)->lhs = expr;
   return node;
 }
 
@@ -29,37 +87,108 @@ static Node *newUnary(NodeKind kind, Node *expr, Token *tok) {
  * @param  kind
  * @param  lhs
  * @param  rhs
- * @return Node*
+ * @return NodeId
  */
-static Node *newBinary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
-  Node *node = newNode(kind, tok);
-  node->lhs = lhs;
-  node->rhs = rhs;
+NodeId newBinary(NodeKind kind, NodeId lhs, NodeId rhs, TokenId tok) {
+  NodeId node = newNode(kind, tok);
+  nodeAt(node)->lhs = lhs;
+  nodeAt(node)->rhs = rhs;
   return node;
 }
 
 /**
  * @brief creat a new variable Node
  * @param  name
- * @return Node*
+ * @return NodeId
  */
-static Node *newVarNode(Obj *var, Token *tok) {
-  Node *node = newNode(ND_VAR, tok);
-  node->var = var;
+NodeId newVarNode(Obj *var, TokenId tok) {
+  NodeId node = newNode(ND_VAR, tok);
+  nodeAt(node)->var = var;
   return node;
 }
 
 /**
  * @brief create a new number Node
  * @param  val
- * @return Node*
+ * @return NodeId
  */
-static Node *newNum(int val, Token *tok) {
-  Node *node = newNode(ND_NUM, tok);
-  node->val = val;
+NodeId newNum(int val, TokenId tok) {
+  NodeId node = newNode(ND_NUM, tok);
+  nodeAt(node)->val = val;
   return node;
 }
 
+/**
+ * @brief 深拷贝一棵子树
+ * @param  node
+ * @return NodeId
+ */
+NodeId copyNode(NodeId node) {
+  if (!node)
+    return 0;
+
+  TokenId tok = nodeTok(node);
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    return newNum(nodeVal(node), tok);
+  case ND_VAR:
+    return newVarNode(nodeVar(node), tok);
+  case ND_IF:
+  case ND_FOR: {
+    NodeExt ext = *nodeExt(node);
+    NodeId copy = newCtrl(nodeKind(node), tok);
+    NodeExt e = {copyNode(ext.cond), copyNode(ext.then), copyNode(ext.els),
+                 copyNode(ext.init), copyNode(ext.inc)};
+    *nodeExt(copy) = e;
+    return copy;
+  }
+  case ND_BLOCK: {
+    uint32_t len = nodeBodyLen(node);
+    NodeId *stmts = calloc(len + 1, sizeof(NodeId));
+    for (uint32_t i = 0; i < len; i++)
+      stmts[i] = copyNode(nodeBody(node, i));
+    NodeId copy = newBlock(stmts, len, tok);
+    free(stmts);
+    return copy;
+  }
+  default: {
+    NodeId lhs = copyNode(nodeLhs(node));
+    NodeId rhs = copyNode(nodeRhs(node));
+    return newBinary(nodeKind(node), lhs, rhs, tok);
+  }
+  }
+}
+
+/**
+ * @brief 统计子树的节点数，作为代码大小的估计
+ * @param  node
+ * @return int
+ */
+int countNodes(NodeId node) {
+  if (!node)
+    return 0;
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+  case ND_VAR:
+    return 1;
+  case ND_IF:
+  case ND_FOR: {
+    NodeExt *e = nodeExt(node);
+    return 1 + countNodes(e->cond) + countNodes(e->then) + countNodes(e->els) +
+           countNodes(e->init) + countNodes(e->inc);
+  }
+  case ND_BLOCK: {
+    int n = 1;
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      n += countNodes(nodeBody(node, i));
+    return n;
+  }
+  default:
+    return 1 + countNodes(nodeLhs(node)) + countNodes(nodeRhs(node));
+  }
+}
+
 // local variable list
 Obj *locals;
 
@@ -71,6 +200,7 @@ Obj *locals;
 static Obj *newLocalVar(char *name) {
   Obj *var = calloc(1, sizeof(Obj));
   var->name = name;
+  var->id = locals ? locals->id + 1 : 0;
   var->next = locals;
   locals = var;
   return var;
@@ -81,10 +211,10 @@ static Obj *newLocalVar(char *name) {
  * @param  name
  * @return Obj*
  */
-static Obj *findVar(Token *tok) {
+static Obj *findVar(TokenId tok) {
   for (Obj *var = locals; var; var = var->next) {
-    if (strlen(var->name) == tok->len &&
-        !strncmp(tok->loc, var->name, tok->len)) {
+    if (strlen(var->name) == (size_t)tokLen(tok) &&
+        !strncmp(tokLoc(tok), var->name, tokLen(tok))) {
       return var;
     }
   }
@@ -94,24 +224,14 @@ static Obj *findVar(Token *tok) {
 /* 语法解析 */
 
 // 复合语句解析
-static Node *compoundStmt(Token **rest, Token *tok);
+static NodeId compoundStmt(TokenId *rest, TokenId tok);
 // 语句解析
-static Node *stmt(Token **rest, Token *tok);
-static Node *exprStmt(Token **rest, Token *tok);
+static NodeId stmt(TokenId *rest, TokenId tok);
+static NodeId exprStmt(TokenId *rest, TokenId tok);
 // 表达式解析
-static Node *expr(Token **rest, Token *tok);
-// 比较解析
-static Node *equality(Token **rest, Token *tok);
-static Node *relational(Token **rest, Token *tok);
-static Node *add(Token **rest, Token *tok);
-// 乘除解析
-static Node *mul(Token **rest, Token *tok);
-// 一元解析 '-','+'，负号，正号
-static Node *unary(Token **Rest, Token *Tok);
-// 数字解析
-static Node *primary(Token **rest, Token *tok);
-// 赋值解析
-static Node *assign(Token **rest, Token *tok);
+static NodeId expr(TokenId *rest, TokenId tok);
+// 变量、数字解析
+static NodeId primary(TokenId tok);
 
 /**
  * @brief 语句解析
@@ -121,27 +241,31 @@ static Node *assign(Token **rest, Token *tok);
  *  | exprStmt
  * @param  rest
  * @param  tok
- * @return Node*
+ * @return NodeId
  */
-static Node *stmt(Token **rest, Token *tok) {
+static NodeId stmt(TokenId *rest, TokenId tok) {
   if (equal(tok, "return")) {
-    Node *node = newNode(ND_RETURN, tok);
-    node->lhs = expr(&tok, tok->next);
+    NodeId node = newNode(ND_RETURN, tok);
+    NodeId lhs = expr(&tok, tok + 1);
+    nodeAt(node)->lhs = lhs;
     *rest = skip(tok, ";");
     return node;
   }
 
   // 解析if语句
   if (equal(tok, "if")) {
-    Node *node = newNode(ND_IF, tok);
-    tok = skip(tok->next, "(");
-    node->cond = expr(&tok, tok);
+    NodeId node = newCtrl(ND_IF, tok);
+    tok = skip(tok + 1, "(");
+    NodeId cond = expr(&tok, tok);
+    nodeExt(node)->cond = cond;
     tok = skip(tok, ")");
     // then 符合条件后的语句
-    node->then = stmt(&tok, tok);
+    NodeId then = stmt(&tok, tok);
+    nodeExt(node)->then = then;
     // else
     if (equal(tok, "else")) {
-      node->els = stmt(&tok, tok->next);
+      NodeId els = stmt(&tok, tok + 1);
+      nodeExt(node)->els = els;
     }
 
     *rest = tok;
@@ -150,59 +274,83 @@ static Node *stmt(Token **rest, Token *tok) {
 
   // 解析for语句
   if (equal(tok, "for")) {
-    Node *node = newNode(ND_FOR, tok);
-    tok = skip(tok->next, "(");
-    node->init = exprStmt(&tok, tok);
+    NodeId node = newCtrl(ND_FOR, tok);
+    tok = skip(tok + 1, "(");
+    NodeId init = exprStmt(&tok, tok);
+    nodeExt(node)->init = init;
     if (!equal(tok, ";")) {
-      node->cond = expr(&tok, tok);
+      NodeId cond = expr(&tok, tok);
+      nodeExt(node)->cond = cond;
     }
     tok = skip(tok, ";");
 
     if (!equal(tok, ")")) {
-      node->inc = expr(&tok, tok);
+      NodeId inc = expr(&tok, tok);
+      nodeExt(node)->inc = inc;
     }
     tok = skip(tok, ")");
 
-    node->then = stmt(rest, tok);
+    NodeId then = stmt(rest, tok);
+    nodeExt(node)->then = then;
     return node;
   }
 
   // while
   if (equal(tok, "while")) {
-    Node *node = newNode(ND_FOR, tok);
-    tok = skip(tok->next, "(");
-    node->cond = expr(&tok, tok);
+    NodeId node = newCtrl(ND_FOR, tok);
+    tok = skip(tok + 1, "(");
+    NodeId cond = expr(&tok, tok);
+    nodeExt(node)->cond = cond;
     tok = skip(tok, ")");
-    node->then = stmt(rest, tok);
+    NodeId then = stmt(rest, tok);
+    nodeExt(node)->then = then;
     return node;
   }
 
   // "{" compoundStmt
   if (equal(tok, "{")) {
-    return compoundStmt(rest, tok->next);
+    return compoundStmt(rest, tok + 1);
   }
 
   // exprStmt
   return exprStmt(rest, tok);
 }
 
+// 解析代码块时暂存语句的栈，嵌套的代码块共用
+static NodeId *StmtStack;
+static uint32_t StmtStackLen;
+static uint32_t StmtStackCap;
+
+/**
+ * @brief 语句压入StmtStack
+ * @param  node
+ */
+static void pushStmt(NodeId node) {
+  if (StmtStackLen == StmtStackCap) {
+    StmtStackCap = StmtStackCap ? StmtStackCap * 2 : 64;
+    StmtStack = realloc(StmtStack, StmtStackCap * sizeof(*StmtStack));
+    if (!StmtStack)
+      error("out of memory");
+  }
+  StmtStack[StmtStackLen++] = node;
+}
+
 /**
  * @brief 复合语句解析
  * @param  rest
  * @param  tok
- * @return Node*
+ * @return NodeId
  */
-static Node *compoundStmt(Token **rest, Token *tok) {
-  Node *node = newNode(ND_BLOCK, tok);
-  Node head = {};
-  Node *cur = &head;
+static NodeId compoundStmt(TokenId *rest, TokenId tok) {
+  TokenId start = tok;
+  uint32_t base = StmtStackLen;
 
-  while (!equal(tok, "}")) {
-    cur = cur->next = stmt(&tok, tok);
-  }
+  while (!equal(tok, "}"))
+    pushStmt(stmt(&tok, tok));
 
-  node->body = head.next;
-  *rest = tok->next;
+  NodeId node = newBlock(StmtStack + base, StmtStackLen - base, start);
+  StmtStackLen = base;
+  *rest = tok + 1;
   return node;
 }
 
@@ -210,225 +358,324 @@ static Node *compoundStmt(Token **rest, Token *tok) {
  * @brief 表达式语句解析 expr?*";"
  * @param  rest
  * @param  tok
- * @return Node*
+ * @return NodeId
  */
-static Node *exprStmt(Token **rest, Token *tok) {
+static NodeId exprStmt(TokenId *rest, TokenId tok) {
   if (equal(tok, ";")) {
-    *rest = tok->next;
-    return newNode(ND_BLOCK, tok);
+    *rest = tok + 1;
+    return newBlock(NULL, 0, tok);
   }
 
-  Node *node = newNode(ND_EXPR_STMT, tok);
-  node->lhs = expr(&tok, tok);
+  NodeId node = newNode(ND_EXPR_STMT, tok);
+  NodeId lhs = expr(&tok, tok);
+  nodeAt(node)->lhs = lhs;
   *rest = skip(tok, ";");
   return node;
 }
-/**
- * @brief  表达式解析
- * @param  rest
- * @param  tok
- * @return Node*
- */
-static Node *expr(Token **rest, Token *tok) { return assign(rest, tok); }
+/* 表达式解析：使用显式栈的优先级爬升（Pratt）解析 */
+
+// 二元运算符
+typedef struct BinOp BinOp;
+struct BinOp {
+  char *punct;     // 运算符
+  NodeKind kind;   // 生成的节点种类
+  uint8_t prec;    // 优先级，越大结合越紧
+  bool rightAssoc; // 是否右结合
+  bool swap;       // 是否交换左右操作数，a>b等价于b<a
+};
+
+// 二元运算符表，0号为空，优先级从低到高：
+// 赋值 < 相等比较 < 大小比较 < 加减 < 乘除
+static const BinOp BinOps[] = {
+    {0},
+    {"=", ND_ASSIGN, 1, true, false},
+    {"==", ND_EQ, 2, false, false},
+    {"!=", ND_NE, 2, false, false},
+    {"<", ND_LT, 3, false, false},
+    {"<=", ND_LE, 3, false, false},
+    {">", ND_LT, 3, false, true},
+    {">=", ND_LE, 3, false, true},
+    {"+", ND_ADD, 4, false, false},
+    {"-", ND_SUB, 4, false, false},
+    {"*", ND_MUL, 5, false, false},
+    {"/", ND_DIV, 5, false, false},
+};
+
+// 运算符栈中的一元负号和左括号，前缀运算符比所有二元运算符结合得更紧
+#define OP_NEG 0xfe
+#define OP_PAREN 0xff
+
+// 通过首字符和长度查找二元运算符在BinOps中的下标
+static uint8_t BinOpIndex[128][2];
 
 /**
- * @brief 赋值解析
- * @param  rest
+ * @brief 查找终结符对应的二元运算符
  * @param  tok
- * @return Node*
+ * @return int BinOps中的下标，不是二元运算符时为0
  */
-static Node *assign(Token **rest, Token *tok) {
-  Node *node = equality(&tok, tok);
-  if (equal(tok, "=")) {
-    return node = newBinary(ND_ASSIGN, node, assign(rest, tok->next), tok);
+static int binOp(TokenId tok) {
+  if (!BinOpIndex['+'][0]) {
+    for (size_t i = 1; i < sizeof(BinOps) / sizeof(*BinOps); i++)
+      BinOpIndex[(int)BinOps[i].punct[0]][strlen(BinOps[i].punct) - 1] = i;
   }
-  *rest = tok;
-  return node;
-}
-
-/**
- * @brief 比较解析
- * @param  rest
- * @param  tok
- * @return Node*
- */
-static Node *equality(Token **rest, Token *tok) {
-  Node *node = relational(&tok, tok);
-  while (true) {
-    Token *start = tok;
 
-    // "=="
-    if (equal(tok, "==")) {
-      node = newBinary(ND_EQ, node, relational(&tok, tok->next), start);
-      continue;
-    }
+  int len = tokLen(tok);
+  unsigned char c = *tokLoc(tok);
+  if (tokKind(tok) != TK_PUNCT || len > 2 || c >= 128)
+    return 0;
+  int op = BinOpIndex[c][len - 1];
+  if (op && len == 2 && tokLoc(tok)[1] != BinOps[op].punct[1])
+    return 0;
+  return op;
+}
 
-    // "!="
-    if (equal(tok, "!=")) {
-      node = newBinary(ND_NE, node, relational(&tok, tok->next), start);
-      continue;
-    }
+// 运算符栈的元素
+typedef struct OpEntry OpEntry;
+struct OpEntry {
+  uint8_t op;  // BinOps中的下标，或OP_NEG、OP_PAREN
+  TokenId tok; // 运算符对应的终结符
+};
+
+// 运算符栈和操作数栈
+static OpEntry *OpStack;
+static uint32_t OpLen;
+static uint32_t OpCap;
+static NodeId *Operands;
+static uint32_t OperandLen;
+static uint32_t OperandCap;
+
+static void pushOp(uint8_t op, TokenId tok) {
+  if (OpLen == OpCap) {
+    OpCap = OpCap ? OpCap * 2 : 64;
+    OpStack = realloc(OpStack, OpCap * sizeof(*OpStack));
+    if (!OpStack)
+      error("out of memory");
+  }
+  OpStack[OpLen++] = (OpEntry){op, tok};
+}
 
-    *rest = tok;
-    return node;
+static void pushOperand(NodeId node) {
+  if (OperandLen == OperandCap) {
+    OperandCap = OperandCap ? OperandCap * 2 : 64;
+    Operands = realloc(Operands, OperandCap * sizeof(*Operands));
+    if (!Operands)
+      error("out of memory");
   }
+  Operands[OperandLen++] = node;
 }
 
 /**
- * @brief 解析比较关系
- * @param  Rest
- * @param  Tok
- * @return Node*
+ * @brief 弹出栈顶运算符，与栈顶的操作数合并为新节点
  */
-static Node *relational(Token **rest, Token *tok) {
-  Node *node = add(&tok, tok);
-  while (true) {
-    Token *start = tok;
-    // "<"
-    if (equal(tok, "<")) {
-      node = newBinary(ND_LT, node, add(&tok, tok->next), start);
-      continue;
-    }
-
-    // "<="
-    if (equal(tok, "<=")) {
-      node = newBinary(ND_LE, node, add(&tok, tok->next), start);
-      continue;
-    }
-
-    // ">"
-    if (equal(tok, ">")) {
-      node = newBinary(ND_LT, add(&tok, tok->next), node, start);
-      continue;
-    }
-
-    // ">="
-    if (equal(tok, ">=")) {
-      node = newBinary(ND_LE, add(&tok, tok->next), node, start);
-      continue;
-    }
-
-    *rest = tok;
-    return node;
+static void reduce(void) {
+  OpEntry e = OpStack[--OpLen];
+  if (e.op == OP_NEG) {
+    Operands[OperandLen - 1] =
+        newUnary(ND_NEG, Operands[OperandLen - 1], e.tok);
+    return;
   }
+
+  const BinOp *op = &BinOps[e.op];
+  NodeId rhs = Operands[--OperandLen];
+  NodeId lhs = Operands[OperandLen - 1];
+  Operands[OperandLen - 1] = op->swap ? newBinary(op->kind, rhs, lhs, e.tok)
+                                      : newBinary(op->kind, lhs, rhs, e.tok);
 }
 
 /**
- * @brief
+ * @brief  表达式解析
+ * expr = assign
+ * assign = equality ("=" assign)?
+ * equality = relational ("==" relational | "!=" relational)*
+ * relational = add ("<" add | "<=" add | ">" add | ">=" add)*
+ * add = mul ("+" mul | "-" mul)*
+ * mul = unary ("*" unary | "/" unary)*
+ * unary = ("+" | "-") unary | primary
+ * primary = "(" expr ")" | ident | num
+ * 各层级由BinOps中的优先级表示，运算符和括号都压入显式栈，嵌套深度不受C栈限制
  * @param  rest
  * @param  tok
- * @return Node*
+ * @return NodeId
  */
-static Node *add(Token **rest, Token *tok) {
-  Node *node = mul(&tok, tok);
+static NodeId expr(TokenId *rest, TokenId tok) {
+  uint32_t opBase = OpLen;
+  uint32_t operandBase = OperandLen;
+  int parens = 0;
 
   while (true) {
+    // 期望一个操作数：处理前缀运算符和左括号
     if (equal(tok, "+")) {
-      node = newBinary(ND_ADD, node, mul(&tok, tok->next), tok);
+      tok++;
       continue;
     }
-
     if (equal(tok, "-")) {
-      node = newBinary(ND_SUB, node, mul(&tok, tok->next), tok);
+      pushOp(OP_NEG, tok++);
+      continue;
+    }
+    if (equal(tok, "(")) {
+      pushOp(OP_PAREN, tok++);
+      parens++;
       continue;
     }
+    pushOperand(primary(tok++));
+
+    // 期望一个二元运算符：处理右括号
+    while (parens && equal(tok, ")")) {
+      while (OpStack[OpLen - 1].op != OP_PAREN)
+        reduce();
+      OpLen--;
+      parens--;
+      tok++;
+    }
 
-    *rest = tok;
-    return node;
+    int op = binOp(tok);
+    if (!op)
+      break;
+
+    // 合并栈中结合更紧的运算符，左结合时同级的也合并
+    int prec = BinOps[op].prec;
+    while (OpLen > opBase) {
+      uint8_t top = OpStack[OpLen - 1].op;
+      if (top == OP_PAREN)
+        break;
+      if (top != OP_NEG && (BinOps[top].prec < prec ||
+                            (BinOps[top].prec == prec && BinOps[op].rightAssoc)))
+        break;
+      reduce();
+    }
+    pushOp(op, tok++);
   }
+
+  if (parens)
+    errorTok(tok, "expected ')'");
+  while (OpLen > opBase)
+    reduce();
+
+  assert(OperandLen == operandBase + 1);
+  *rest = tok;
+  return Operands[--OperandLen];
 }
 
 /**
- * @brief 乘除解析
- * @param  rest
+ * @brief  variable, number
  * @param  tok
- * @return Node*
+ * @return NodeId
  */
-static Node *mul(Token **rest, Token *tok) {
-  Node *node = unary(&tok, tok);
-  while (true) {
-    if (equal(tok, "*")) {
-      node = newBinary(ND_MUL, node, unary(&tok, tok->next), tok);
-      continue;
-    }
-
-    if (equal(tok, "/")) {
-      node = newBinary(ND_DIV, node, unary(&tok, tok->next), tok);
-      continue;
+static NodeId primary(TokenId tok) {
+  // variable
+  if (tokKind(tok) == TK_IDENT) {
+    Obj *var = findVar(tok);
+    if (!var) {
+      var = newLocalVar(strndup(tokLoc(tok), tokLen(tok)));
     }
+    return newVarNode(var, tok);
+  }
 
-    *rest = tok;
-    return node;
+  // number
+  if (tokKind(tok) == TK_NUM) {
+    return newNum(tokVal(tok), tok);
   }
+
+  errorTok(tok, "expected an expression");
+  return 0;
 }
 
 /**
- * @brief 解析一元运算
- * @param  rest
- * @param  tok
- * @return Node*
+ * @brief 清空上一次编译的状态，节点池和各个栈保留容量重复使用
+ * 编译服务器中，上一次编译可能在出错时中途退出
  */
-static Node *unary(Token **rest, Token *tok) {
-  if (equal(tok, "+")) {
-    return unary(rest, tok->next);
+static void resetParser(void) {
+  while (locals) {
+    Obj *var = locals;
+    locals = var->next;
+    free(var->name);
+    free(var);
   }
-
-  if (equal(tok, "-")) {
-    return newUnary(ND_NEG, unary(rest, tok->next), tok);
-  }
-
-  return primary(rest, tok);
+  Nodes.len = Nodes.extLen = Nodes.listLen = 0;
+  StmtStackLen = OpLen = OperandLen = 0;
 }
 
 /**
- * @brief  bracket, number, variable
+ * @brief 语法解析入口函数，之后由parseStmt逐条解析顶层语句
  * @param  rest
  * @param  tok
- * @return Node*
+ * @return Function*
  */
-static Node *primary(Token **rest, Token *tok) {
-
-  // "(" expr ")"
-  if (equal(tok, "(")) {
-    Node *node = expr(&tok, tok->next);
-    *rest = skip(tok, ")");
-    return node;
-  }
+Function *parseBegin(TokenId *rest, TokenId tok) {
+  resetParser();
+  *rest = skip(tok, "{");
+  return calloc(1, sizeof(Function));
+}
 
-  // variable
-  if (tok->kind == TK_IDENT) {
-    Obj *var = findVar(tok);
-    if (!var) {
-      var = newLocalVar(strndup(tok->loc, tok->len));
-    }
-    *rest = tok->next;
-    return newVarNode(var, tok);
+/**
+ * @brief 从开头的括号找到匹配的括号
+ * @param  tok
+ * @param  open
+ * @param  close
+ * @return TokenId
+ */
+static TokenId matchParen(TokenId tok, char *open, char *close) {
+  for (int depth = 0;; tok++) {
+    if (equal(tok, open))
+      depth++;
+    else if (equal(tok, close) && --depth == 0)
+      return tok;
   }
+}
 
-  // number
-  if (tok->kind == TK_NUM) {
-    Node *node = newNum(tok->val, tok);
-    *rest = tok->next;
-    return node;
+/**
+ * @brief 已解析的语句的最后一个终结符，用于报告
+ * 语句已经解析成功，只需匹配括号
+ * @param  tok 语句的开头
+ * @return TokenId
+ */
+TokenId stmtEnd(TokenId tok) {
+  if (equal(tok, "{"))
+    return matchParen(tok, "{", "}");
+  if (equal(tok, "if") || equal(tok, "for") || equal(tok, "while")) {
+    TokenId end = stmtEnd(matchParen(tok + 1, "(", ")") + 1);
+    if (equal(tok, "if") && equal(end + 1, "else"))
+      return stmtEnd(end + 2);
+    return end;
   }
-
-  errorTok(tok, "expected an expression");
-  return NULL;
+  while (!equal(tok, ";"))
+    tok++;
+  return tok;
 }
 
 /**
- * @brief 语法解析入口函数
+ * @brief 解析函数体中的下一条顶层语句
+ * 上一条语句已生成代码，节点池只保存当前语句。
+ * maxNodes不为0时解析一组语句，直到函数体结束或节点数达到maxNodes，
+ * 组成代码块，之后的优化可以看到组内的所有语句
+ * @param  prog
+ * @param  rest
  * @param  tok
- * @return Node*
+ * @param  maxNodes 一组语句的节点数上限，为0时只解析一条语句
+ * @return false 函数体已结束
  */
-Function *parse(Token *tok) {
-
-  tok = skip(tok, "{");
+bool parseStmt(Function *prog, TokenId *rest, TokenId tok, uint32_t maxNodes) {
+  Nodes.len = Nodes.extLen = Nodes.listLen = 0;
+  prog->group = false;
+  if (equal(tok, "}")) {
+    *rest = tok + 1;
+    return false;
+  }
 
-  // 函数体存储语句的AST，locals存储局部变量
-  Function *prog = calloc(1, sizeof(Function));
-  prog->body = compoundStmt(&tok, tok);
+  // body存储语句的AST，locals存储局部变量
+  TokenId start = tok;
+  prog->body = stmt(&tok, tok);
+  if (maxNodes && !equal(tok, "}") && Nodes.len < maxNodes) {
+    uint32_t base = StmtStackLen;
+    pushStmt(prog->body);
+    while (!equal(tok, "}") && Nodes.len < maxNodes)
+      pushStmt(stmt(&tok, tok));
+    prog->body = newBlock(StmtStack + base, StmtStackLen - base, start);
+    prog->group = true;
+    StmtStackLen = base;
+  }
+  *rest = tok;
   prog->locals = locals;
-
-  return prog;
-}
\ No newline at end of file
+  prog->numLocals = locals ? locals->id + 1 : 0;
+  return true;
+}
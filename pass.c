@@ -0,0 +1,387 @@
+#include "rvcc.h"
+#include <time.h>
+
+/* 优化的管理 */
+
+// 各优化在这里注册名称、依赖和开关。-O设置默认开启的优化，
+// -f<name>和-fno-<name>单独开启或关闭，与在命令行中出现的顺序无关。
+// 对AST的优化按依赖排序后，对每条顶层语句依次运行；
+// 向量化、超优化的表、if转换和块排列在代码生成中进行，
+// 这里只负责它们的开关、统计和输出。
+
+typedef struct Pass Pass;
+struct Pass {
+  char *name;                  // 命令行中的名称，如-fno-sccp
+  int level;                   // 默认开启的最低优化级别
+  bool *enabled;               // 开关
+  char *dep;                   // 依赖的优化，需要在它之后运行
+  void (*begin)(void);         // 函数开始时调用
+  void (*run)(Function *prog); // 每条顶层语句调用，为空时在代码生成中进行
+  void (*end)(void);           // 函数结束时调用
+  char *unit;                  // IR大小的单位
+  int set;                     // 命令行中的-f为1，-fno为-1，未指定为0
+  bool print;                  // -print-after
+  // -ftime-report的统计
+  uint64_t runs;               // 运行次数
+  uint64_t ns;                 // 耗时（纳秒）
+  int64_t before;              // 运行前的IR大小
+  int64_t after;               // 运行后的IR大小
+  bool sized;                  // 是否统计了IR大小
+};
+
+static Pass Passes[PASS_NUM] = {
+    [PASS_SCCP] = {"sccp", 2, &OptSCCP, NULL, sccpBegin, sccp, sccpEnd,
+                   "nodes"},
+    [PASS_SCEV] = {"scev", 2, &OptScev, "sccp", scevBegin, scevLoops, scevEnd,
+                   "nodes"},
+    [PASS_UNROLL] = {"unroll-loops", 2, &OptUnroll, "scev", unrollBegin,
+                     unrollLoops, unrollEnd, "nodes"},
+    [PASS_CSE] = {"cse", 2, &OptCSE, "unroll-loops", cseBegin, cseAnalyze,
+                  cseEnd, "nodes"},
+    [PASS_VECTORIZE] = {"vectorize", 1, &OptVectorize, "cse"},
+    [PASS_SUPEROPT] = {"superopt", 1, &OptSuperopt, "vectorize",
+                       superoptBegin, NULL, superoptEnd, "insns"},
+    [PASS_IF_CONVERT] = {"if-convert", 1, &OptIfConvert, "superopt",
+                         ifConvertBegin, NULL, ifConvertEnd, "branches"},
+    [PASS_REORDER_BLOCKS] = {"reorder-blocks", 1, &OptReorderBlocks,
+                             "if-convert", .unit = "insns"},
+};
+
+// 按依赖排序后的运行顺序
+static PassId Order[PASS_NUM];
+
+// 优化级别，未指定-O时为1
+static int OptLevel = 1;
+
+// 编译开始的时间
+static uint64_t StartNs;
+
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 按名称查找优化
+ * @param  name
+ * @param  len 名称的长度
+ * @return Pass* 没有时返回NULL
+ */
+static Pass *findPass(char *name, size_t len) {
+  for (int i = 0; i < PASS_NUM; i++)
+    if (strlen(Passes[i].name) == len && !strncmp(Passes[i].name, name, len))
+      return &Passes[i];
+  return NULL;
+}
+
+/**
+ * @brief 解析与优化相关的命令行参数
+ * -O0、-O1、-O2，-f<pass>、-fno-<pass>，-print-after=<pass>
+ * @param  arg
+ * @return true 参数已处理
+ * @return false 不是与优化相关的参数
+ */
+bool passOption(char *arg) {
+  // -O，等同于-O1
+  if (!strncmp(arg, "-O", 2)) {
+    if (!arg[2])
+      OptLevel = 1;
+    else if (arg[2] >= '0' && arg[2] <= '2' && !arg[3])
+      OptLevel = arg[2] - '0';
+    else
+      error("unsupported optimization level: %s", arg);
+    return true;
+  }
+
+  if (!strncmp(arg, "-print-after=", 13)) {
+    char *name = arg + 13;
+    Pass *p = findPass(name, strlen(name));
+    if (!p)
+      error("unknown pass: %s", name);
+    p->print = true;
+    return true;
+  }
+
+  if (strncmp(arg, "-f", 2))
+    return false;
+  bool on = strncmp(arg, "-fno-", 5);
+  char *name = on ? arg + 2 : arg + 5;
+  Pass *p = findPass(name, strlen(name));
+  if (!p)
+    return false;
+  p->set = on ? 1 : -1;
+  return true;
+}
+
+/**
+ * @brief 命令行解析之后，确定开启的优化，按依赖排序
+ */
+void passInit(void) {
+  for (int i = 0; i < PASS_NUM; i++) {
+    Pass *p = &Passes[i];
+    *p->enabled = p->set ? p->set > 0 : OptLevel >= p->level;
+  }
+
+  // 每次选择依赖已经排好的优化，依赖有环时报错
+  bool done[PASS_NUM] = {0};
+  for (int n = 0; n < PASS_NUM; n++) {
+    int next = -1;
+    for (int i = 0; i < PASS_NUM && next < 0; i++) {
+      char *name = Passes[i].dep;
+      Pass *dep = name ? findPass(name, strlen(name)) : NULL;
+      if (!done[i] && (!dep || done[dep - Passes]))
+        next = i;
+    }
+    if (next < 0)
+      error("internal error: cyclic pass dependencies");
+    done[next] = true;
+    Order[n] = next;
+  }
+}
+
+/**
+ * @brief 是否需要输出优化的统计，是时返回当前的时间
+ * @return uint64_t 不需要时返回0
+ */
+uint64_t passClock(void) { return OptTimeReport ? nowNs() : 0; }
+
+/**
+ * @brief 记录优化运行一次的耗时和IR大小
+ * @param  id
+ * @param  start passClock的返回值
+ * @param  before 运行前的IR大小，小于0表示不统计
+ * @param  after 运行后的IR大小
+ */
+void passAccount(PassId id, uint64_t start, int64_t before, int64_t after) {
+  if (!OptTimeReport)
+    return;
+  Pass *p = &Passes[id];
+  p->runs++;
+  p->ns += nowNs() - start;
+  if (before >= 0) {
+    p->sized = true;
+    p->before += before;
+    p->after += after;
+  }
+}
+
+/**
+ * @brief 是否在优化之后输出IR，-print-after=<pass>，未启用的优化不输出
+ * @param  id
+ * @return true
+ * @return false
+ */
+bool passPrintAfter(PassId id) {
+  return Passes[id].print && *Passes[id].enabled;
+}
+
+/* 输出AST */
+
+// 输出公共子表达式消除的结果，只在它分析过当前语句后有效
+static bool DumpCse;
+
+// 二元运算符
+static char *binOpStr(NodeKind kind) {
+  switch (kind) {
+  case ND_ADD:
+    return "+";
+  case ND_SUB:
+    return "-";
+  case ND_MUL:
+    return "*";
+  case ND_DIV:
+    return "/";
+  case ND_EQ:
+    return "==";
+  case ND_NE:
+    return "!=";
+  case ND_LT:
+    return "<";
+  case ND_LE:
+    return "<=";
+  case ND_ASSIGN:
+    return "=";
+  default:
+    unreachable();
+    return NULL;
+  }
+}
+
+/**
+ * @brief 输出表达式，二元运算加上括号
+ * 公共子表达式消除之后，保存到sN的值输出为[sN := ...]，复用的值输出为sN
+ * @param  out
+ * @param  node
+ */
+static void dumpExpr(FILE *out, NodeId node) {
+  if (DumpCse && CseUse[node]) {
+    fprintf(out, "s%d", CseUse[node]);
+    return;
+  }
+  bool def = DumpCse && CseDef[node];
+  if (def)
+    fprintf(out, "[s%d := ", CseDef[node]);
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    fprintf(out, "%d", nodeVal(node));
+    break;
+  case ND_VAR:
+    fprintf(out, "%s", nodeVar(node)->name);
+    break;
+  case ND_NEG:
+    fprintf(out, "-");
+    dumpExpr(out, nodeLhs(node));
+    break;
+  case ND_ASSIGN:
+    dumpExpr(out, nodeLhs(node));
+    fprintf(out, " = ");
+    dumpExpr(out, nodeRhs(node));
+    break;
+  default:
+    fprintf(out, "(");
+    dumpExpr(out, nodeLhs(node));
+    fprintf(out, " %s ", binOpStr(nodeKind(node)));
+    dumpExpr(out, nodeRhs(node));
+    fprintf(out, ")");
+    break;
+  }
+
+  if (def)
+    fprintf(out, "]");
+}
+
+/**
+ * @brief 以源代码的形式输出语句
+ * @param  out
+ * @param  node
+ * @param  depth 缩进的层数
+ */
+static void dumpStmt(FILE *out, NodeId node, int depth) {
+  fprintf(out, "%*s", depth * 2, "");
+  switch (nodeKind(node)) {
+  case ND_IF:
+    fprintf(out, "if (");
+    dumpExpr(out, nodeCond(node));
+    fprintf(out, ")\n");
+    dumpStmt(out, nodeThen(node), depth + 1);
+    if (nodeEls(node)) {
+      fprintf(out, "%*selse\n", depth * 2, "");
+      dumpStmt(out, nodeEls(node), depth + 1);
+    }
+    return;
+  case ND_FOR:
+    fprintf(out, "for (");
+    if (nodeInit(node) && nodeKind(nodeInit(node)) == ND_EXPR_STMT)
+      dumpExpr(out, nodeLhs(nodeInit(node)));
+    fprintf(out, "; ");
+    if (nodeCond(node))
+      dumpExpr(out, nodeCond(node));
+    fprintf(out, "; ");
+    if (nodeInc(node))
+      dumpExpr(out, nodeInc(node));
+    fprintf(out, ")\n");
+    dumpStmt(out, nodeThen(node), depth + 1);
+    return;
+  case ND_BLOCK:
+    fprintf(out, "{\n");
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      dumpStmt(out, nodeBody(node, i), depth + 1);
+    fprintf(out, "%*s}\n", depth * 2, "");
+    return;
+  case ND_RETURN:
+    fprintf(out, "return ");
+    dumpExpr(out, nodeLhs(node));
+    fprintf(out, ";\n");
+    return;
+  case ND_EXPR_STMT:
+    dumpExpr(out, nodeLhs(node));
+    fprintf(out, ";\n");
+    return;
+  default:
+    unreachable();
+  }
+}
+
+/* 运行 */
+
+/**
+ * @brief 函数开始时，调用开启的优化的Begin，清空统计
+ */
+void passBegin(void) {
+  StartNs = passClock();
+  for (int n = 0; n < PASS_NUM; n++) {
+    Pass *p = &Passes[Order[n]];
+    p->runs = p->ns = 0;
+    p->before = p->after = 0;
+    p->sized = false;
+    if (*p->enabled && p->begin)
+      p->begin();
+  }
+}
+
+/**
+ * @brief 对当前的顶层语句依次运行开启的优化
+ * @param  prog
+ * @return false 语句已被删除
+ */
+bool passRun(Function *prog) {
+  for (int n = 0; n < PASS_NUM; n++) {
+    PassId id = Order[n];
+    Pass *p = &Passes[id];
+    if (!*p->enabled || !p->run)
+      continue;
+    // 语句被删除后，之后的优化不再运行
+    if (!prog->body)
+      return false;
+
+    uint64_t start = passClock();
+    int64_t before = OptTimeReport ? countNodes(prog->body) : -1;
+    p->run(prog);
+    passAccount(id, start, before, OptTimeReport ? countNodes(prog->body) : 0);
+
+    if (p->print) {
+      fprintf(DiagFile, "# IR after %s\n", p->name);
+      DumpCse = id == PASS_CSE;
+      if (!prog->body)
+        fprintf(DiagFile, "# statement removed\n");
+      else if (prog->group && nodeKind(prog->body) == ND_BLOCK)
+        for (uint32_t i = 0; i < nodeBodyLen(prog->body); i++)
+          dumpStmt(DiagFile, nodeBody(prog->body, i), 0);
+      else
+        dumpStmt(DiagFile, prog->body, 0);
+    }
+  }
+  return prog->body;
+}
+
+/**
+ * @brief 函数结束时，调用开启的优化的End，输出-ftime-report的统计
+ */
+void passEnd(void) {
+  for (int n = 0; n < PASS_NUM; n++) {
+    Pass *p = &Passes[Order[n]];
+    if (*p->enabled && p->end)
+      p->end();
+  }
+  if (!OptTimeReport)
+    return;
+
+  fprintf(DiagFile, "%-16s %8s %10s %10s %10s %8s\n", "pass", "runs",
+          "time(ms)", "IR before", "IR after", "delta");
+  for (int n = 0; n < PASS_NUM; n++) {
+    Pass *p = &Passes[Order[n]];
+    if (!*p->enabled)
+      continue;
+    fprintf(DiagFile, "%-16s %8llu %10.3f", p->name,
+            (unsigned long long)p->runs, p->ns / 1e6);
+    if (p->sized)
+      fprintf(DiagFile, " %10lld %10lld %+8lld %s\n", (long long)p->before,
+              (long long)p->after, (long long)(p->after - p->before), p->unit);
+    else
+      fprintf(DiagFile, " %10s %10s %8s\n", "-", "-", "-");
+  }
+  fprintf(DiagFile, "%-16s %8s %10.3f\n", "total", "",
+          (nowNs() - StartNs) / 1e6);
+}
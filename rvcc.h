@@ -4,8 +4,10 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,23 +24,88 @@ typedef enum TokenKind {
 } TokenKind;
 
 /**
- * @brief 终结符结构体
+ * @brief 终结符在终结符流中的下标
  */
-typedef struct Token Token;
-struct Token {
-  TokenKind kind; // Token种类
-  Token *next;    // 下一个Token
-  int val;        // Token的值
-  char *loc;      // Token的字符串位置
-  int len;        // Token的长度
+typedef uint32_t TokenId;
+
+/**
+ * @brief 终结符流，以并行数组（SoA）的形式连续存储终结符
+ * 终结符通过32位编号访问，下一个终结符即为编号+1。
+ * 词法分析按需进行：访问尚未分析的终结符时才继续扫描输入，
+ * 已处理完的终结符由releaseTokens释放，数组中只保存编号不小于base的终结符
+ */
+typedef struct TokenStream TokenStream;
+struct TokenStream {
+  uint8_t *kinds;    // Token种类
+  uint32_t *locs;    // Token在输入中的偏移量
+  uint32_t *lens;    // Token的长度
+  uint32_t len;      // 数组中Token的数量
+  uint32_t cap;      // 已分配的容量
+  TokenId base;      // 数组中第一个Token的编号
+  TokenId *numToks;  // 数字侧表：数字Token的编号，升序
+  int *numVals;      // 数字侧表：数字Token的值
+  uint32_t numLen;   // 数字侧表的长度
+  uint32_t numCap;   // 数字侧表已分配的容量
+  char *text;        // 内存中的输入文本窗口
+  uint32_t textBase; // text[0]在输入中的偏移量
 };
 
+// 当前的终结符流
+extern TokenStream Tokens;
+
+// 分析到编号为tok的终结符，返回它在数组中的下标
+uint32_t lexUntil(TokenId tok);
+
+static inline uint32_t tokIndex(TokenId tok) {
+  uint32_t i = tok - Tokens.base;
+  return i < Tokens.len ? i : lexUntil(tok);
+}
+
+// 先确定下标再访问数组，词法分析可能会使数组扩容
+static inline TokenKind tokKind(TokenId tok) {
+  uint32_t i = tokIndex(tok);
+  return Tokens.kinds[i];
+}
+// 流式输入时窗口会移动，返回的指针在继续词法分析之前有效
+static inline char *tokLoc(TokenId tok) {
+  uint32_t i = tokIndex(tok);
+  return Tokens.text + (Tokens.locs[i] - Tokens.textBase);
+}
+static inline int tokLen(TokenId tok) {
+  uint32_t i = tokIndex(tok);
+  return Tokens.lens[i];
+}
+int tokVal(TokenId tok);
+
+// 词法分析扫描空白符、标识符、数字时使用的路径
+typedef enum LexPath {
+  LEX_AUTO,   // 按CPU支持的指令集自动选择
+  LEX_SCALAR, // 逐字节扫描
+  LEX_SSE2,   // 每次扫描16字节
+  LEX_AVX2,   // 每次扫描32字节
+} LexPath;
+
+bool setLexPath(LexPath path);
+
+// 诊断信息的输出文件
+extern FILE *DiagFile;
+// 出错后的恢复点，为NULL时出错直接退出
+extern jmp_buf *ErrorRecover;
+
 void error(char *fmt, ...);
-void error_at(char *loc, char *fmt, ...);
-void errorTok(Token *tok, char *fmt, ...);
-bool equal(Token *tok, char *str);
-Token *skip(Token *tok, char *str);
-Token *tokenize(char *str);
+// 不应到达的位置，报告内部错误
+#define unreachable() error("internal error at %s:%d", __FILE__, __LINE__)
+void errorAt(char *loc, char *fmt, ...);
+void errorTok(TokenId tok, char *fmt, ...);
+void tokLineCol(TokenId tok, int *line, int *col);
+char *sourceName(void);
+int tokSourceText(TokenId start, TokenId end, char *buf, int size);
+void note(TokenId tok, char *fmt, ...);
+bool equal(TokenId tok, char *str);
+TokenId skip(TokenId tok, char *str);
+TokenId tokenize(char *str);
+TokenId tokenizeFile(char *path);
+void releaseTokens(TokenId tok);
 
 /* 生成AST（抽象语法树）*/
 
@@ -66,52 +133,339 @@ typedef enum NodeKind {
   ND_RETURN,    // return
 } NodeKind;
 
-// AST的节点结构体
+// AST节点在节点池中的下标，0表示空节点
+typedef uint32_t NodeId;
+
+// AST的节点结构体，按节点种类只存储所需的字段
 struct Node {
-  NodeKind kind; // 节点种类
-  Node *next;    // 下一个节点, 用于表达式语句
-  Token *tok;    // 节点对应的终结符
-  Node *lhs;     // 左子节点
-  Node *rhs;     // 右子节点
-
-  // `if`, `for`
-  Node *cond; // 条件表达式
-  Node *then; // then
-  Node *els;  // else
-  Node *init; // for的初始化
-  Node *inc;  // for的增量
-
-  Node *body; // 代码块
-  Obj *var;   // 存储ND_VAR种类的变量
-  int val;    // 存储ND_NUM种类的值
+  uint8_t kind; // 节点种类
+  TokenId tok;  // 节点对应的终结符
+  union {
+    // 二元、一元运算，表达式语句，return
+    struct {
+      NodeId lhs; // 左子节点
+      NodeId rhs; // 右子节点
+    };
+    // 代码块
+    struct {
+      uint32_t body;    // 语句在Lists中的起始下标
+      uint32_t bodyLen; // 语句的数量
+    };
+    uint32_t ext; // `if`, `for`，额外字段在Exts中的下标
+    Obj *var;     // 存储ND_VAR种类的变量
+    int val;      // 存储ND_NUM种类的值
+  };
 };
 
+// `if`, `for`节点的额外字段，存储在侧表中
+typedef struct NodeExt NodeExt;
+struct NodeExt {
+  NodeId cond; // 条件表达式
+  NodeId then; // then
+  NodeId els;  // else
+  NodeId init; // for的初始化
+  NodeId inc;  // for的增量
+};
+
+// 节点池，所有节点连续存储，通过NodeId访问
+typedef struct NodePool NodePool;
+struct NodePool {
+  Node *nodes;      // 节点
+  uint32_t len;     // 节点数量，包括0号空节点
+  uint32_t cap;     // 已分配的节点容量
+  NodeExt *exts;    // 控制流语句的额外字段
+  uint32_t extLen;  // 额外字段数量
+  uint32_t extCap;  // 已分配的额外字段容量
+  NodeId *lists;    // 代码块的语句列表
+  uint32_t listLen; // 语句列表长度
+  uint32_t listCap; // 已分配的语句列表容量
+};
+
+// 当前的节点池
+extern NodePool Nodes;
+
+// 节点池扩容后地址会变化，不要在新建节点后继续使用之前取得的指针
+static inline Node *nodeAt(NodeId n) { return &Nodes.nodes[n]; }
+static inline NodeExt *nodeExt(NodeId n) {
+  return &Nodes.exts[Nodes.nodes[n].ext];
+}
+
+static inline NodeKind nodeKind(NodeId n) { return Nodes.nodes[n].kind; }
+static inline TokenId nodeTok(NodeId n) { return Nodes.nodes[n].tok; }
+static inline NodeId nodeLhs(NodeId n) { return Nodes.nodes[n].lhs; }
+static inline NodeId nodeRhs(NodeId n) { return Nodes.nodes[n].rhs; }
+static inline int nodeVal(NodeId n) { return Nodes.nodes[n].val; }
+static inline Obj *nodeVar(NodeId n) { return Nodes.nodes[n].var; }
+static inline NodeId nodeCond(NodeId n) { return nodeExt(n)->cond; }
+static inline NodeId nodeThen(NodeId n) { return nodeExt(n)->then; }
+static inline NodeId nodeEls(NodeId n) { return nodeExt(n)->els; }
+static inline NodeId nodeInit(NodeId n) { return nodeExt(n)->init; }
+static inline NodeId nodeInc(NodeId n) { return nodeExt(n)->inc; }
+static inline uint32_t nodeBodyLen(NodeId n) { return Nodes.nodes[n].bodyLen; }
+static inline NodeId nodeBody(NodeId n, uint32_t i) {
+  return Nodes.lists[Nodes.nodes[n].body + i];
+}
+
+// 新建节点，新节点追加到节点池中
+NodeId newNode(NodeKind kind, TokenId tok);
+NodeId newCtrl(NodeKind kind, TokenId tok);
+NodeId newBlock(NodeId *stmts, uint32_t len, TokenId tok);
+NodeId newUnary(NodeKind kind, NodeId expr, TokenId tok);
+NodeId newBinary(NodeKind kind, NodeId lhs, NodeId rhs, TokenId tok);
+NodeId newVarNode(Obj *var, TokenId tok);
+NodeId newNum(int val, TokenId tok);
+NodeId copyNode(NodeId node);
+// 子树的节点数，作为代码大小的估计
+int countNodes(NodeId node);
+
 // 本地变量
 struct Obj {
   Obj *next;  // 指向下一对象
   char *name; // 变量名
   int offset; // fp的偏移量
+  int id;     // 变量编号，从0开始，分析时作为下标
 };
 
-// 函数
+// 函数，函数体按顶层语句逐条解析、优化和生成代码
 typedef struct Function Function;
 struct Function {
-  Node *body;     // 函数体
+  NodeId body;    // 当前的顶层语句，为0时表示已被删除
+  bool group;     // body是由一组顶层语句组成的代码块
   Obj *locals;    // 本地变量
+  int numLocals;  // 本地变量数量
   int stack_size; // 栈大小
 };
 
 /**
- * @brief 语法解析
+ * @brief 开始解析函数体
+ * @param  rest
+ * @param  tok
+ * @return Function*
+ */
+Function *parseBegin(TokenId *rest, TokenId tok);
+
+/**
+ * @brief 解析下一条顶层语句到prog->body，释放上一条语句的节点
+ * @param  prog
+ * @param  rest
+ * @param  tok
+ * @param  maxNodes 不为0时解析一组语句，节点数达到maxNodes时结束
+ * @return false 函数体已结束
+ */
+bool parseStmt(Function *prog, TokenId *rest, TokenId tok, uint32_t maxNodes);
+
+/**
+ * @brief 已解析的语句的最后一个终结符，用于报告
+ * @param  tok 语句的开头
+ * @return TokenId
+ */
+TokenId stmtEnd(TokenId tok);
+
+/* 命令行选项 */
+
+// 目标是否支持向量扩展（V），由-march设置
+extern bool OptRVV;
+// 目标是否支持条件清零扩展（Zicond），由-march设置
+extern bool OptZicond;
+// 输出各优化所做的变换
+extern bool OptReport;
+// 循环展开：是否开启、部分展开的展开因子、展开后的代码大小上限（节点数）
+extern bool OptUnroll;
+extern int OptUnrollFactor;
+extern int OptUnrollBudget;
+// 公共子表达式消除
+extern bool OptCSE;
+// 稀疏条件常量传播
+extern bool OptSCCP;
+// 标量演化，以最终值代替只计算递推的循环；输出分析的结果
+extern bool OptScev;
+extern bool OptDumpScev;
+// 向量化循环，需要-march支持向量扩展
+extern bool OptVectorize;
+// 小的表达式树使用超优化器搜索出的指令序列
+extern bool OptSuperopt;
+// 把只给一个变量赋值的if语句转换为无分支的选择，以及两侧和选择的指令数上限
+extern bool OptIfConvert;
+extern int OptIfConvertBudget;
+// 控制流图的跳转穿透和块排列
+extern bool OptReorderBlocks;
+// 输出各优化的耗时和IR大小的变化
+extern bool OptTimeReport;
+// 以注释标出估计的周期数，并输出最耗时的语句和循环
+extern bool OptCostReport;
+// 输出调试信息：源代码的行列和栈帧的CFI
+extern bool OptDebug;
+
+/* 优化 */
+
+// 各优化对顶层语句逐条进行，Begin和End在函数开始和结束时调用
+
+/**
+ * @brief 稀疏条件常量传播，变量的格值在顶层语句之间传递
+ * @param  prog
+ */
+void sccpBegin(void);
+void sccp(Function *prog);
+void sccpEnd(void);
+
+/**
+ * @brief 标量演化，循环的作用只是变量的最终值时以闭式代替
+ * @param  prog
+ */
+void scevBegin(void);
+void scevLoops(Function *prog);
+void scevEnd(void);
+
+/**
+ * @brief 循环展开
+ * @param  prog
+ */
+void unrollBegin(void);
+void unrollLoops(Function *prog);
+int64_t loopTrips(NodeId node);
+void unrollEnd(void);
+
+// 可用于保存公共子表达式的寄存器s1~s11
+#define CSE_NUM_REGS 11
+
+// 公共子表达式消除的结果，按NodeId索引，值为保存该值的寄存器sN，0表示无
+// CseDef：首次计算后保存到寄存器；CseUse：直接使用寄存器中的值
+extern uint8_t *CseDef;
+extern uint8_t *CseUse;
+// 使用到的寄存器数量，即s1~sN
+extern int CseNumRegs;
+
+/**
+ * @brief 公共子表达式消除的分析，值在一条顶层语句内复用
+ * @param  prog
+ */
+void cseBegin(void);
+void cseAnalyze(Function *prog);
+void cseEnd(void);
+
+/**
+ * @brief 超优化的表在代码生成中查询，Begin和End清空统计、输出报告
+ */
+void superoptBegin(void);
+void superoptEnd(void);
+
+/**
+ * @brief if转换在代码生成中进行，Begin和End清空统计、输出报告
+ */
+void ifConvertBegin(void);
+void ifConvertEnd(void);
+
+/* 优化的管理 */
+
+// 注册的优化，按依赖排序后运行
+typedef enum {
+  PASS_SCCP,           // 稀疏条件常量传播
+  PASS_SCEV,           // 标量演化
+  PASS_UNROLL,         // 循环展开
+  PASS_CSE,            // 公共子表达式消除
+  PASS_VECTORIZE,      // 向量化，在代码生成中进行
+  PASS_SUPEROPT,       // 查超优化的表，在代码生成中进行
+  PASS_IF_CONVERT,     // if转换，在代码生成中进行
+  PASS_REORDER_BLOCKS, // 跳转穿透和块排列，在代码生成中进行
+  PASS_NUM,
+} PassId;
+
+// 解析-O、-f<pass>、-fno-<pass>、-print-after=<pass>
+bool passOption(char *arg);
+// 命令行解析之后，确定开启的优化
+void passInit(void);
+
+/**
+ * @brief 运行开启的优化，passRun处理当前的顶层语句，返回false时语句已被删除
+ * Begin和End在函数开始和结束时调用，End输出-ftime-report的统计
+ * @param  prog
+ */
+void passBegin(void);
+bool passRun(Function *prog);
+void passEnd(void);
+
+// 在代码生成中进行的优化，记录耗时和IR大小，before小于0时不统计大小
+uint64_t passClock(void);
+void passAccount(PassId id, uint64_t start, int64_t before, int64_t after);
+bool passPrintAfter(PassId id);
+
+/* 控制流图 */
+
+// 基本块的编号
+typedef uint32_t BlockId;
+
+// 一条顶层语句的代码生成到基本块中，结束时化简、排列后输出
+void cfgBegin(int c, TokenId tok);
+BlockId cfgNewBlock(char *name, int c);
+void cfgSetBlock(BlockId b);
+BlockId cfgCurBlock(void);
+void cfgAppend(char *fmt, va_list ap);
+void cfgJump(BlockId target);
+void cfgBranch(char *cond, char *inv, BlockId taken, BlockId fall);
+void cfgReturn(void);
+void cfgMarkLoop(BlockId b, TokenId tok, int64_t trips);
+void cfgEnd(FILE *out);
+
+/* 静态周期估计 */
+
+// 选择处理器模型，-mtune=
+void costSetModel(char *name);
+
+/**
+ * @brief 估计一个基本块的周期数，costInsn按顺序发射一行汇编代码，
+ * costTaken计入预测为跳转的分支，costBlockEnd返回周期数
+ * @param  p
+ * @param  end
+ */
+void costBlockBegin(void);
+void costInsn(char *p, char *end);
+void costTaken(void);
+int costBlockEnd(void);
+
+/**
+ * @brief 记录语句和循环的周期数，函数结束时输出最耗时的条目
  * @param  tok
- * @return Node*
+ * @param  loop
+ * @param  cycles
  */
-Function *parse(Token *tok);
+void costBegin(void);
+void costRecord(TokenId tok, bool loop, int64_t cycles);
+void costEnd(void);
 
 /* 语义分析与代码生成 */
 
 /**
- * @brief 代码生成函数
- * @param  node
+ * @brief 代码生成函数，codegen生成当前的顶层语句
+ * @param  out
  */
+void codegenBegin(FILE *out);
 void codegen(Function *prog);
+void codegenEnd(Function *prog);
+
+/* 编译 */
+
+/**
+ * @brief 编译一个程序，汇编代码输出到out，诊断信息输出到DiagFile
+ * @param  input
+ * @param  out
+ */
+void compile(char *input, FILE *out);
+
+/**
+ * @brief 编译一个文件，path为"-"时读取标准输入
+ * @param  path
+ * @param  out
+ */
+void compileFile(char *path, FILE *out);
+
+/**
+ * @brief 编译出错返回服务循环后，释放未编译完的函数
+ */
+void compileAbort(void);
+
+/**
+ * @brief 编译服务器，处理带长度前缀的编译请求
+ * @param  path Unix域套接字的路径，为NULL时使用标准输入输出
+ * @return int
+ */
+int runServer(char *path);
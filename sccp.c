@@ -0,0 +1,506 @@
+#include "rvcc.h"
+
+/* 稀疏条件常量传播 */
+
+// 每个局部变量在程序的每一点有一个格值：未定义、常量、非常量。
+// 按代码的执行顺序抽象解释语法树：条件为常量时只有一条出边可执行，
+// 不可执行的分支不会影响变量的格值；循环在入口处合并入口与回边的状态，
+// 直到不再变化。分析结束后，值为常量的表达式替换为ND_NUM，
+// 条件恒定的if只保留可执行的分支，不可达的语句被删除。
+// 运算与代码生成一致，按32位进行，溢出时回绕。
+// 顶层语句逐条分析，上一条语句之后的状态即为下一条语句之前的状态。
+
+// 格值的种类
+typedef enum {
+  LAT_UNDEF, // 未定义：尚未执行到
+  LAT_CONST, // 常量
+  LAT_OVER,  // 非常量
+} LatKind;
+
+typedef struct LatVal LatVal;
+struct LatVal {
+  LatKind kind;
+  int64_t val;
+};
+
+// 程序中某一点所有变量的格值
+typedef struct State State;
+struct State {
+  LatVal *vars;
+  bool reachable; // 该点是否可达
+};
+
+// 变量数量
+static int NumVars;
+// 当前顶层语句之前的状态
+static State Entry;
+// 每个节点在所有执行中的格值的交汇，按NodeId索引
+static LatVal *NodeLat;
+// 语句是否可执行，按NodeId索引
+static bool *Executed;
+
+// 变换的数量，用于报告
+static int NumFolded;
+static int NumBranches;
+static int NumDead;
+
+static LatVal overdefined(void) { return (LatVal){LAT_OVER, 0}; }
+
+static LatVal constant(int64_t val) { return (LatVal){LAT_CONST, val}; }
+
+/**
+ * @brief 格的交汇运算
+ * @param  a
+ * @param  b
+ * @return LatVal
+ */
+static LatVal meet(LatVal a, LatVal b) {
+  if (a.kind == LAT_UNDEF)
+    return b;
+  if (b.kind == LAT_UNDEF)
+    return a;
+  if (a.kind == LAT_CONST && b.kind == LAT_CONST && a.val == b.val)
+    return a;
+  return overdefined();
+}
+
+static bool sameLat(LatVal a, LatVal b) {
+  return a.kind == b.kind && (a.kind != LAT_CONST || a.val == b.val);
+}
+
+static State newState(bool reachable) {
+  State s = {calloc(NumVars + 1, sizeof(LatVal)), reachable};
+  return s;
+}
+
+static State copyState(State *s) {
+  State t = newState(s->reachable);
+  memcpy(t.vars, s->vars, NumVars * sizeof(LatVal));
+  return t;
+}
+
+static void freeState(State *s) { free(s->vars); }
+
+/**
+ * @brief 将src合并到dst中
+ * @param  dst
+ * @param  src
+ */
+static void meetState(State *dst, State *src) {
+  if (!src->reachable)
+    return;
+  if (!dst->reachable) {
+    memcpy(dst->vars, src->vars, NumVars * sizeof(LatVal));
+    dst->reachable = true;
+    return;
+  }
+  for (int i = 0; i < NumVars; i++)
+    dst->vars[i] = meet(dst->vars[i], src->vars[i]);
+}
+
+static bool sameState(State *a, State *b) {
+  if (a->reachable != b->reachable)
+    return false;
+  for (int i = 0; i < NumVars; i++)
+    if (!sameLat(a->vars[i], b->vars[i]))
+      return false;
+  return true;
+}
+
+/**
+ * @brief 对常量做与代码生成一致的32位运算，溢出时回绕
+ * @param  kind
+ * @param  a
+ * @param  b
+ * @param  val
+ * @return true
+ * @return false 除零等不折叠的情况
+ */
+static bool foldBinary(NodeKind kind, int64_t a, int64_t b, int64_t *val) {
+  uint32_t x = a, y = b;
+  switch (kind) {
+  case ND_ADD:
+    *val = (int32_t)(x + y);
+    return true;
+  case ND_SUB:
+    *val = (int32_t)(x - y);
+    return true;
+  case ND_MUL:
+    *val = (int32_t)(x * y);
+    return true;
+  case ND_DIV:
+    // divw中INT32_MIN/-1的结果为INT32_MIN
+    if (b == 0)
+      return false;
+    *val = b == -1 ? (int32_t)(0 - x) : a / b;
+    return true;
+  case ND_EQ:
+    *val = a == b;
+    return true;
+  case ND_NE:
+    *val = a != b;
+    return true;
+  case ND_LT:
+    *val = a < b;
+    return true;
+  case ND_LE:
+    *val = a <= b;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief 在状态s下求表达式的格值，赋值会更新s
+ * @param  node
+ * @param  s
+ * @return LatVal
+ */
+static LatVal evalExpr(NodeId node, State *s) {
+  LatVal v;
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    v = constant(nodeVal(node));
+    break;
+  case ND_VAR:
+    v = s->vars[nodeVar(node)->id];
+    break;
+  case ND_NEG: {
+    LatVal a = evalExpr(nodeLhs(node), s);
+    v = a.kind == LAT_CONST ? constant((int32_t)(0 - (uint32_t)a.val)) : a;
+    break;
+  }
+  case ND_ASSIGN: {
+    // 左侧只取地址，右侧的值成为变量新的格值
+    v = evalExpr(nodeRhs(node), s);
+    if (nodeKind(nodeLhs(node)) == ND_VAR)
+      s->vars[nodeVar(nodeLhs(node))->id] = v;
+    break;
+  }
+  default: {
+    // 先右后左，与genExpr一致
+    LatVal b = evalExpr(nodeRhs(node), s);
+    LatVal a = evalExpr(nodeLhs(node), s);
+    int64_t val;
+    if (a.kind == LAT_CONST && b.kind == LAT_CONST &&
+        foldBinary(nodeKind(node), a.val, b.val, &val))
+      v = constant(val);
+    else if (a.kind == LAT_UNDEF || b.kind == LAT_UNDEF)
+      v = (LatVal){LAT_UNDEF, 0};
+    else
+      v = overdefined();
+    break;
+  }
+  }
+
+  NodeLat[node] = meet(NodeLat[node], v);
+  return v;
+}
+
+/**
+ * @brief 条件的格值是否为常量，返回常量的真假
+ * @param  v
+ * @param  taken
+ * @return true
+ * @return false
+ */
+static bool constCond(LatVal v, bool *taken) {
+  if (v.kind != LAT_CONST)
+    return false;
+  *taken = v.val != 0;
+  return true;
+}
+
+/**
+ * @brief 在状态s下执行语句，s变为语句之后的状态
+ * @param  node
+ * @param  s
+ */
+static void evalStmt(NodeId node, State *s) {
+  if (!node || !s->reachable)
+    return;
+  Executed[node] = true;
+
+  switch (nodeKind(node)) {
+  case ND_IF: {
+    NodeId then = nodeThen(node), els = nodeEls(node);
+    bool taken;
+    bool isConst = constCond(evalExpr(nodeCond(node), s), &taken);
+
+    // 只执行可执行的出边，两个分支的状态在if之后合并
+    State elsState = copyState(s);
+    if (isConst && !taken)
+      s->reachable = false;
+    else
+      evalStmt(then, s);
+    if (isConst && taken)
+      elsState.reachable = false;
+    else
+      evalStmt(els, &elsState);
+    meetState(s, &elsState);
+    freeState(&elsState);
+    return;
+  }
+  case ND_FOR: {
+    NodeId cond = nodeCond(node), then = nodeThen(node), inc = nodeInc(node);
+    evalStmt(nodeInit(node), s);
+    if (!s->reachable)
+      return;
+
+    // 循环入口的状态是入口和回边状态的交汇，迭代至不动点
+    State head = copyState(s);
+    State exit = newState(false);
+    for (;;) {
+      State body = copyState(&head);
+      bool taken = true;
+      bool isConst = true;
+      if (cond)
+        isConst = constCond(evalExpr(cond, &body), &taken);
+
+      // 条件为假的出边
+      exit.reachable = false;
+      if (!isConst || !taken)
+        meetState(&exit, &body);
+
+      // 条件为真的出边，执行循环体和inc
+      if (isConst && !taken)
+        body.reachable = false;
+      evalStmt(then, &body);
+      if (inc && body.reachable)
+        evalExpr(inc, &body);
+
+      State next = copyState(s);
+      meetState(&next, &body);
+      bool stable = sameState(&next, &head);
+      freeState(&head);
+      freeState(&body);
+      head = next;
+      if (stable)
+        break;
+    }
+
+    freeState(&head);
+    freeState(s);
+    *s = exit;
+    return;
+  }
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      evalStmt(nodeBody(node, i), s);
+    return;
+  case ND_RETURN:
+    evalExpr(nodeLhs(node), s);
+    s->reachable = false;
+    return;
+  case ND_EXPR_STMT:
+    evalExpr(nodeLhs(node), s);
+    return;
+  default:
+    return;
+  }
+}
+
+/**
+ * @brief 判断表达式是否没有副作用
+ * @param  node
+ * @return true
+ * @return false
+ */
+static bool isPure(NodeId node) {
+  switch (nodeKind(node)) {
+  case ND_NUM:
+  case ND_VAR:
+    return true;
+  case ND_ASSIGN:
+    return false;
+  case ND_NEG:
+    return isPure(nodeLhs(node));
+  default:
+    return isPure(nodeLhs(node)) && isPure(nodeRhs(node));
+  }
+}
+
+/**
+ * @brief 能否替换为ND_NUM
+ * @param  node
+ * @return true
+ * @return false
+ */
+static bool foldable(NodeId node) {
+  LatVal v = NodeLat[node];
+  return v.kind == LAT_CONST && isPure(node);
+}
+
+/**
+ * @brief 将值为常量的表达式原地替换为ND_NUM
+ * @param  node
+ */
+static void rewriteExpr(NodeId node) {
+  switch (nodeKind(node)) {
+  case ND_NUM:
+    return;
+  case ND_ASSIGN:
+    // 左侧为被赋值的变量，不能替换
+    rewriteExpr(nodeRhs(node));
+    return;
+  default:
+    break;
+  }
+
+  if (foldable(node)) {
+    NumFolded++;
+    Node *n = nodeAt(node);
+    n->kind = ND_NUM;
+    n->val = (int)NodeLat[node].val;
+    return;
+  }
+
+  if (nodeKind(node) == ND_VAR)
+    return;
+  if (nodeKind(node) != ND_NEG)
+    rewriteExpr(nodeRhs(node));
+  rewriteExpr(nodeLhs(node));
+}
+
+/**
+ * @brief 条件恒定时，保留求值条件的副作用
+ * @param  cond
+ * @param  stmt 条件之后执行的语句，可为0
+ * @return NodeId
+ */
+static NodeId keepCond(NodeId cond, NodeId stmt) {
+  NodeId stmts[2];
+  uint32_t len = 0;
+  if (!isPure(cond))
+    stmts[len++] = newUnary(ND_EXPR_STMT, cond, nodeTok(cond));
+  if (stmt)
+    stmts[len++] = stmt;
+  if (len == 1 && stmt)
+    return stmt;
+  return newBlock(stmts, len, nodeTok(cond));
+}
+
+/**
+ * @brief 替换常量，删除不可执行的分支和不可达的语句
+ * @param  node
+ * @return NodeId 替换后的节点
+ */
+static NodeId rewriteStmt(NodeId node) {
+  if (!node)
+    return 0;
+
+  switch (nodeKind(node)) {
+  case ND_IF: {
+    NodeId cond = nodeCond(node);
+    rewriteExpr(cond);
+    NodeId then = rewriteStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    NodeId els = rewriteStmt(nodeEls(node));
+    nodeExt(node)->els = els;
+
+    // 条件恒定，只保留可执行的分支
+    LatVal v = NodeLat[cond];
+    if (v.kind != LAT_CONST)
+      return node;
+    NumBranches++;
+    if (OptReport)
+      note(nodeTok(node), "sccp: condition is always %s, branch removed",
+           v.val ? "true" : "false");
+    return keepCond(cond, v.val ? then : els);
+  }
+  case ND_FOR: {
+    NodeId init = rewriteStmt(nodeInit(node));
+    nodeExt(node)->init = init;
+    NodeId cond = nodeCond(node);
+    if (cond)
+      rewriteExpr(cond);
+    NodeId then = rewriteStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    if (nodeInc(node))
+      rewriteExpr(nodeInc(node));
+
+    // 条件在进入循环时即为假，循环体不可执行
+    if (cond && NodeLat[cond].kind == LAT_CONST && !NodeLat[cond].val) {
+      NumBranches++;
+      if (OptReport)
+        note(nodeTok(node), "sccp: loop never entered, loop removed");
+      NodeId stmts[2];
+      uint32_t len = 0;
+      if (init)
+        stmts[len++] = init;
+      stmts[len++] = keepCond(cond, 0);
+      return newBlock(stmts, len, nodeTok(node));
+    }
+    return node;
+  }
+  case ND_BLOCK: {
+    // 删除不可达的语句，原地压缩语句列表
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++) {
+      NodeId stmt = nodeBody(node, i);
+      if (!Executed[stmt]) {
+        NumDead++;
+        continue;
+      }
+      stmt = rewriteStmt(stmt);
+      Nodes.lists[nodeAt(node)->body + len++] = stmt;
+    }
+    nodeAt(node)->bodyLen = len;
+    return node;
+  }
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+    rewriteExpr(nodeLhs(node));
+    return node;
+  default:
+    return node;
+  }
+}
+
+/**
+ * @brief 函数开始时，程序入口可达，清空统计
+ */
+void sccpBegin(void) {
+  NumVars = 0;
+  NumFolded = NumBranches = NumDead = 0;
+  freeState(&Entry);
+  Entry = newState(true);
+}
+
+/**
+ * @brief 稀疏条件常量传播入口函数，分析并改写当前的顶层语句
+ * @param  prog
+ */
+void sccp(Function *prog) {
+  // 语句中新出现的变量未初始化，值未知
+  Entry.vars = realloc(Entry.vars, (prog->numLocals + 1) * sizeof(LatVal));
+  for (int i = NumVars; i < prog->numLocals; i++)
+    Entry.vars[i] = overdefined();
+  NumVars = prog->numLocals;
+
+  // 之前的语句已经返回，当前语句不可达
+  if (!Entry.reachable) {
+    NumDead++;
+    prog->body = 0;
+    return;
+  }
+
+  NodeLat = calloc(Nodes.len + 1, sizeof(*NodeLat));
+  Executed = calloc(Nodes.len + 1, sizeof(*Executed));
+  evalStmt(prog->body, &Entry);
+  prog->body = rewriteStmt(prog->body);
+  free(NodeLat);
+  free(Executed);
+}
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void sccpEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile,
+            "sccp: %d expressions replaced by constants, %d branches folded, "
+            "%d unreachable statements removed\n",
+            NumFolded, NumBranches, NumDead);
+}
@@ -0,0 +1,938 @@
+#include "rvcc.h"
+
+/* 标量演化 */
+
+// 循环中的变量建模为迭代次数k的多项式，以链式递推{a,+,b,+,c}表示，
+// 第k次迭代开始时的值为 a + b*C(k,1) + c*C(k,2)。v = v + e 中e为多项式时，
+// v是e的部分和，次数加一；v = e 中e不读v时，v为e的值。
+// 系数是常量与循环入口处变量的值的线性组合。
+// 条件为归纳变量与常量或循环不变量的比较时求出循环次数n，
+// 循环的作用只是这些变量的最终值时，以它们在n处的值代替整个循环。
+// 运算与代码生成一致，按32位进行，溢出时回绕：多项式在k=0..SCEV_DEGREE处
+// 的值和C(n,j)都按模2^32计算，与逐次迭代的结果相同。
+// n为常量时最终值是入口值的线性组合；n在运行时确定时步长需为1或-1，
+// 次数不超过2，以原来的条件判断是否进入循环
+
+// 多项式的最高次数
+#define SCEV_DEGREE 4
+// 系数中变量的最大个数
+#define SCEV_SYMS 4
+// 循环中赋值的变量的最大个数
+#define SCEV_VARS 16
+
+// 系数：常量加上循环入口处变量的值的线性组合
+typedef struct Affine Affine;
+struct Affine {
+  uint32_t c;
+  int numSyms;
+  Obj *syms[SCEV_SYMS];
+  uint32_t coefs[SCEV_SYMS];
+};
+
+// 迭代次数k的多项式，以k=0..SCEV_DEGREE处的值表示
+typedef struct Scev Scev;
+struct Scev {
+  Affine vals[SCEV_DEGREE + 1];
+  int deg;       // 次数的上界
+  uint32_t self; // 被赋值的变量在本次迭代开始时的值的系数
+};
+
+// 循环中赋值的变量，按迭代中赋值的顺序排列
+typedef struct ScevVar ScevVar;
+struct ScevVar {
+  Obj *var;
+  NodeId assign; // 迭代中唯一的赋值
+  bool resolved; // 已求出递推
+  bool add;      // v = v + e；否则为v = e
+  Scev before;   // 迭代开始时的值，只用于v = v + e
+  Scev inc;      // 每次迭代的增量e，只用于v = v + e
+  Scev after;    // 赋值之后的值
+  Affine final[SCEV_DEGREE + 1]; // 最终值在二项式基C(n,j)下的系数
+};
+
+// 当前分析的循环
+static ScevVar Vars[SCEV_VARS];
+static int NumVars;
+// 入口处值为常量的变量，由for的初始化 v = 常量 得出
+static Obj *KnownVar;
+static int64_t KnownVal;
+// 正在求值的赋值在迭代中的位置，读取的变量的递推尚未求出时置位Pending
+static int CurPos;
+static bool Pending;
+// 不能替换的原因，用于-fdump-scev
+static char *Reason;
+
+// 循环次数
+typedef struct TripCount TripCount;
+struct TripCount {
+  ScevVar *iv;    // 归纳变量
+  bool isConst;   // 循环次数为常量
+  int64_t trips;  // 常量的循环次数
+  bool up;        // 运行时：递增时为 bound - i，递减时为 i - bound
+  NodeId bound;   // 运行时：循环不变的变量，为0时使用boundVal
+  int64_t boundVal;
+};
+
+// 替换的循环数量，用于报告
+static int NumReplaced;
+
+/* 系数和多项式的运算 */
+
+static Affine affConst(uint32_t c) { return (Affine){.c = c}; }
+
+static bool isConstAff(Affine *a) { return a->numSyms == 0; }
+
+static bool isZeroAff(Affine *a) { return !a->c && !a->numSyms; }
+
+/**
+ * @brief a += m*b
+ * @param  a
+ * @param  b
+ * @param  m
+ * @return false 变量过多
+ */
+static bool affAdd(Affine *a, Affine *b, uint32_t m) {
+  Affine r = *a;
+  r.c += m * b->c;
+  for (int i = 0; i < b->numSyms; i++) {
+    int j = 0;
+    while (j < r.numSyms && r.syms[j] != b->syms[i])
+      j++;
+    if (j == r.numSyms) {
+      if (r.numSyms == SCEV_SYMS)
+        return false;
+      r.syms[j] = b->syms[i];
+      r.coefs[r.numSyms++] = 0;
+    }
+    r.coefs[j] += m * b->coefs[i];
+  }
+
+  // 去掉系数为0的变量
+  a->c = r.c;
+  a->numSyms = 0;
+  for (int i = 0; i < r.numSyms; i++) {
+    if (!r.coefs[i])
+      continue;
+    a->syms[a->numSyms] = r.syms[i];
+    a->coefs[a->numSyms++] = r.coefs[i];
+  }
+  return true;
+}
+
+static Scev scevConst(Affine a) {
+  Scev s = {.deg = 0};
+  for (int t = 0; t <= SCEV_DEGREE; t++)
+    s.vals[t] = a;
+  return s;
+}
+
+/**
+ * @brief x += m*y
+ * @param  x
+ * @param  y
+ * @param  m
+ * @return false 变量过多
+ */
+static bool scevAdd(Scev *x, Scev *y, uint32_t m) {
+  for (int t = 0; t <= SCEV_DEGREE; t++)
+    if (!affAdd(&x->vals[t], &y->vals[t], m))
+      return false;
+  if (y->deg > x->deg)
+    x->deg = y->deg;
+  x->self += m * y->self;
+  return true;
+}
+
+static bool isConstScev(Scev *s) {
+  for (int t = 0; t <= SCEV_DEGREE; t++)
+    if (!isConstAff(&s->vals[t]))
+      return false;
+  return !s->self;
+}
+
+/**
+ * @brief 多项式的乘积，在各点的值逐点相乘
+ * @param  x
+ * @param  y
+ * @param  out
+ * @return false 次数过高，或两侧的系数都含有变量
+ */
+static bool scevMul(Scev *x, Scev *y, Scev *out) {
+  if (x->self || y->self || x->deg + y->deg > SCEV_DEGREE)
+    return false;
+  if (!isConstScev(x)) {
+    Scev *tmp = x;
+    x = y;
+    y = tmp;
+  }
+  if (!isConstScev(x))
+    return false;
+
+  *out = (Scev){.deg = x->deg + y->deg};
+  for (int t = 0; t <= SCEV_DEGREE; t++)
+    affAdd(&out->vals[t], &y->vals[t], x->vals[t].c);
+  return true;
+}
+
+/**
+ * @brief 二项式基C(k,j)下的系数，即k=0处的各阶前向差分，{a,+,b,...}中的a, b, ...
+ * @param  s
+ * @param  coefs
+ * @return false 变量过多
+ */
+static bool scevCoefs(Scev *s, Affine *coefs) {
+  Affine diff[SCEV_DEGREE + 1];
+  memcpy(diff, s->vals, sizeof(diff));
+  for (int j = 0; j <= SCEV_DEGREE; j++) {
+    coefs[j] = diff[0];
+    for (int t = 0; t + j < SCEV_DEGREE; t++) {
+      Affine d = diff[t + 1];
+      if (!affAdd(&d, &diff[t], -1))
+        return false;
+      diff[t] = d;
+    }
+  }
+  return true;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/**
+ * @brief 二项式系数C(n,j)模2^32
+ * j个连续整数的积能被j!整除，先从各因子中约去2..j再相乘
+ * @param  n
+ * @param  j
+ * @return uint32_t
+ */
+static uint32_t binom(uint64_t n, int j) {
+  if (n < (uint64_t)j)
+    return 0;
+  uint64_t f[SCEV_DEGREE];
+  for (int t = 0; t < j; t++)
+    f[t] = n - t;
+  for (uint64_t d = 2; d <= (uint64_t)j; d++) {
+    uint64_t rem = d;
+    for (int t = 0; t < j && rem > 1; t++) {
+      uint64_t g = gcd(f[t], rem);
+      f[t] /= g;
+      rem /= g;
+    }
+  }
+  uint32_t r = 1;
+  for (int t = 0; t < j; t++)
+    r *= (uint32_t)f[t];
+  return r;
+}
+
+/* 递推的分析 */
+
+static ScevVar *findVar(Obj *var) {
+  for (int i = 0; i < NumVars; i++)
+    if (Vars[i].var == var)
+      return &Vars[i];
+  return NULL;
+}
+
+/**
+ * @brief 变量在循环入口处的值
+ * @param  var
+ * @return Affine
+ */
+static Affine entryValue(Obj *var) {
+  if (var == KnownVar)
+    return affConst(KnownVal);
+  Affine a = {.numSyms = 1};
+  a.syms[0] = var;
+  a.coefs[0] = 1;
+  return a;
+}
+
+/**
+ * @brief 求表达式在第k次迭代中的值
+ * @param  node
+ * @param  self 正在赋值的变量
+ * @param  out
+ * @return false 不是多项式，或读取的变量的递推尚未求出（Pending）
+ */
+static bool evalExpr(NodeId node, Obj *self, Scev *out) {
+  NodeKind kind = nodeKind(node);
+  switch (kind) {
+  case ND_NUM:
+    *out = scevConst(affConst(nodeVal(node)));
+    return true;
+  case ND_VAR: {
+    Obj *var = nodeVar(node);
+    ScevVar *v = findVar(var);
+    if (var == self) {
+      *out = scevConst(affConst(0));
+      out->self = 1;
+      return true;
+    }
+    // 循环不变量
+    if (!v) {
+      *out = scevConst(entryValue(var));
+      return true;
+    }
+    if (!v->resolved) {
+      Pending = true;
+      return false;
+    }
+    // 迭代中已赋值的变量为赋值之后的值，否则为迭代开始时的值
+    if (v - Vars < CurPos) {
+      *out = v->after;
+      return true;
+    }
+    if (!v->add) {
+      Reason = "variable read before it is overwritten";
+      return false;
+    }
+    *out = v->before;
+    return true;
+  }
+  case ND_NEG: {
+    Scev x;
+    if (!evalExpr(nodeLhs(node), self, &x))
+      return false;
+    *out = scevConst(affConst(0));
+    scevAdd(out, &x, -1);
+    return true;
+  }
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL: {
+    Scev x, y;
+    if (!evalExpr(nodeLhs(node), self, &x) ||
+        !evalExpr(nodeRhs(node), self, &y))
+      return false;
+    if (kind == ND_MUL) {
+      if (scevMul(&x, &y, out))
+        return true;
+      Reason = "product is not a polynomial of degree at most 4";
+      return false;
+    }
+    *out = x;
+    if (scevAdd(out, &y, kind == ND_SUB ? -1 : 1))
+      return true;
+    Reason = "too many variables in a coefficient";
+    return false;
+  }
+  default:
+    Reason = "expression is not a polynomial";
+    return false;
+  }
+}
+
+/**
+ * @brief 求变量的递推
+ * @param  v
+ * @return false 不能求出，或读取的变量的递推尚未求出（Pending）
+ */
+static bool resolveVar(ScevVar *v) {
+  CurPos = v - Vars;
+  Scev r;
+  if (!evalExpr(nodeRhs(v->assign), v->var, &r))
+    return false;
+
+  // v = e
+  if (!r.self) {
+    v->add = false;
+    v->after = r;
+    v->resolved = true;
+    return true;
+  }
+  // v = v + e，迭代开始时的值是入口值加上e的部分和
+  if (r.self != 1) {
+    Reason = "not an add recurrence";
+    return false;
+  }
+  if (r.deg == SCEV_DEGREE) {
+    Reason = "sum is not a polynomial of degree at most 4";
+    return false;
+  }
+  v->add = true;
+  v->inc = r;
+  v->inc.self = 0;
+  v->before = (Scev){.deg = r.deg + 1};
+  v->before.vals[0] = entryValue(v->var);
+  for (int t = 0; t < SCEV_DEGREE; t++) {
+    v->before.vals[t + 1] = v->before.vals[t];
+    if (!affAdd(&v->before.vals[t + 1], &v->inc.vals[t], 1)) {
+      Reason = "too many variables in a coefficient";
+      return false;
+    }
+  }
+  v->after = v->before;
+  if (!scevAdd(&v->after, &v->inc, 1)) {
+    Reason = "too many variables in a coefficient";
+    return false;
+  }
+  v->resolved = true;
+  return true;
+}
+
+/**
+ * @brief 收集迭代中的赋值，语句只能是给变量赋值的表达式语句，每个变量只赋值一次
+ * @param  node
+ * @return false
+ */
+static bool collectAssigns(NodeId node) {
+  if (nodeKind(node) == ND_BLOCK) {
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      if (!collectAssigns(nodeBody(node, i)))
+        return false;
+    return true;
+  }
+  if (nodeKind(node) == ND_EXPR_STMT)
+    node = nodeLhs(node);
+  if (nodeKind(node) != ND_ASSIGN || nodeKind(nodeLhs(node)) != ND_VAR) {
+    Reason = "loop body has statements other than assignments";
+    return false;
+  }
+  Obj *var = nodeVar(nodeLhs(node));
+  if (findVar(var)) {
+    Reason = "variable assigned more than once per iteration";
+    return false;
+  }
+  if (NumVars == SCEV_VARS) {
+    Reason = "too many variables";
+    return false;
+  }
+  Vars[NumVars++] = (ScevVar){.var = var, .assign = node};
+  return true;
+}
+
+/**
+ * @brief 判断是否为常量，允许负号
+ * @param  node
+ * @param  val
+ * @return true
+ * @return false
+ */
+static bool isConst(NodeId node, int64_t *val) {
+  if (nodeKind(node) == ND_NUM) {
+    *val = nodeVal(node);
+    return true;
+  }
+  if (nodeKind(node) == ND_NEG && isConst(nodeLhs(node), val)) {
+    *val = -*val;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief 求循环次数。条件为归纳变量与常量或循环不变量的比较，
+ * 归纳变量的步长为常量，且取值都在int范围内，不会回绕
+ * @param  cond
+ * @param  tc
+ * @return false
+ */
+static bool analyzeTrips(NodeId cond, TripCount *tc) {
+  Reason = "condition is not a comparison of an induction variable";
+  if (!cond || (nodeKind(cond) != ND_LT && nodeKind(cond) != ND_LE))
+    return false;
+
+  // `>`和`>=`解析时交换了操作数，为 bound < i 和 bound <= i
+  NodeId lhs = nodeLhs(cond), rhs = nodeRhs(cond);
+  bool ivLeft = nodeKind(lhs) == ND_VAR && findVar(nodeVar(lhs));
+  NodeId ivNode = ivLeft ? lhs : rhs, bound = ivLeft ? rhs : lhs;
+  if (nodeKind(ivNode) != ND_VAR || !(tc->iv = findVar(nodeVar(ivNode))))
+    return false;
+  bool inclusive = nodeKind(cond) == ND_LE;
+
+  // 步长为常量
+  ScevVar *iv = tc->iv;
+  if (!iv->add || !isConstScev(&iv->inc))
+    return false;
+  for (int t = 1; t <= SCEV_DEGREE; t++)
+    if (iv->inc.vals[t].c != iv->inc.vals[0].c)
+      return false;
+  int64_t step = (int32_t)iv->inc.vals[0].c;
+  if (step == 0 || (step > 0) != ivLeft)
+    return false;
+
+  int64_t end;
+  bool constBound = isConst(bound, &end);
+  if (!constBound &&
+      (nodeKind(bound) != ND_VAR || findVar(nodeVar(bound)))) {
+    Reason = "loop bound is not invariant";
+    return false;
+  }
+
+  // 统一为 i < end 递增或 i > end 递减
+  if (constBound && inclusive)
+    end += ivLeft ? 1 : -1;
+  Affine *start = &iv->before.vals[0];
+  if (constBound && isConstAff(start)) {
+    int64_t s = (int32_t)start->c;
+    if (ivLeft)
+      tc->trips = s < end ? (end - s + step - 1) / step : 0;
+    else
+      tc->trips = s > end ? (s - end - step - 1) / -step : 0;
+    int64_t last = s + tc->trips * step;
+    if (last < INT32_MIN || last > INT32_MAX) {
+      Reason = "induction variable wraps around";
+      return false;
+    }
+    tc->isConst = true;
+    return true;
+  }
+
+  // 运行时的循环次数：步长为1或-1时取值恰好到达end，不会回绕
+  if (step != 1 && step != -1) {
+    Reason = "trip count is not constant and step is not 1 or -1";
+    return false;
+  }
+  if (!constBound && inclusive) {
+    Reason = "trip count is not constant and bound is inclusive";
+    return false;
+  }
+  if (constBound && (end < INT32_MIN || end > INT32_MAX)) {
+    Reason = "induction variable wraps around";
+    return false;
+  }
+  tc->isConst = false;
+  tc->up = ivLeft;
+  tc->bound = constBound ? 0 : bound;
+  tc->boundVal = end;
+  return true;
+}
+
+/**
+ * @brief 最终值在二项式基C(n,j)下的系数。v = e中最终值为e在n-1处的值，
+ * 由C(n-1,j) = sum (-1)^(j-i) C(n,i)换算
+ * @param  v
+ * @return false 变量过多
+ */
+static bool finalCoefs(ScevVar *v) {
+  Affine coefs[SCEV_DEGREE + 1];
+  if (!scevCoefs(v->add ? &v->before : &v->after, coefs))
+    return false;
+  if (v->add) {
+    memcpy(v->final, coefs, sizeof(coefs));
+    return true;
+  }
+  for (int i = 0; i <= SCEV_DEGREE; i++) {
+    v->final[i] = affConst(0);
+    for (int j = i; j <= SCEV_DEGREE; j++)
+      if (!affAdd(&v->final[i], &coefs[j], (j - i) % 2 ? -1 : 1))
+        return false;
+  }
+  return true;
+}
+
+// 最终值的次数
+static int finalDegree(ScevVar *v) {
+  int deg = SCEV_DEGREE;
+  while (deg > 0 && isZeroAff(&v->final[deg]))
+    deg--;
+  return deg;
+}
+
+/* 输出分析结果 */
+
+/**
+ * @brief 以源代码的形式输出系数，如"2*x - y + 3"
+ * @param  a
+ * @param  buf
+ * @param  end
+ * @return char* 输出之后的位置
+ */
+static char *affStr(Affine *a, char *buf, char *end) {
+  char *p = buf;
+  for (int i = 0; i <= a->numSyms && p < end; i++) {
+    // 常量在最后，为0时省略
+    int64_t val = (int32_t)(i < a->numSyms ? a->coefs[i] : a->c);
+    if (i == a->numSyms && !val && a->numSyms)
+      break;
+    if (i)
+      p += snprintf(p, end - p, val < 0 ? " - " : " + ");
+    else if (val < 0)
+      p += snprintf(p, end - p, "-");
+    int64_t mag = val < 0 ? -val : val;
+    if (i == a->numSyms)
+      p += snprintf(p, end - p, "%lld", (long long)mag);
+    else if (mag == 1)
+      p += snprintf(p, end - p, "%s", a->syms[i]->name);
+    else
+      p += snprintf(p, end - p, "%lld*%s", (long long)mag, a->syms[i]->name);
+  }
+  return p < end ? p : end;
+}
+
+/**
+ * @brief -fdump-scev输出循环中各变量的递推
+ * @param  tok
+ */
+static void dumpVars(TokenId tok) {
+  for (int i = 0; i < NumVars; i++) {
+    ScevVar *v = &Vars[i];
+    if (!v->resolved)
+      continue;
+    Affine coefs[SCEV_DEGREE + 1];
+    Scev *s = v->add ? &v->before : &v->after;
+    if (!scevCoefs(s, coefs))
+      continue;
+    int deg = s->deg;
+    while (deg > 0 && isZeroAff(&coefs[deg]))
+      deg--;
+    char buf[256], *p = buf, *end = buf + sizeof(buf);
+    for (int j = 0; j <= deg && p < end; j++) {
+      p += snprintf(p, end - p, j ? ",+," : "{");
+      p = affStr(&coefs[j], p, end);
+    }
+    note(tok, "scev: %s %s %s}", v->var->name, v->add ? "=" : ":=", buf);
+  }
+}
+
+/* 以最终值代替循环 */
+
+/**
+ * @brief 系数的表达式
+ * @param  a
+ * @param  tok
+ * @return NodeId
+ */
+static NodeId affNode(Affine *a, TokenId tok) {
+  NodeId node = 0;
+  for (int i = 0; i <= a->numSyms; i++) {
+    // 常量在最后，为0时省略
+    int32_t val = i < a->numSyms ? a->coefs[i] : a->c;
+    if (i == a->numSyms && node && !val)
+      break;
+    bool neg = val < 0 && val != INT32_MIN && node;
+    NodeId term = newNum(neg ? -val : val, tok);
+    if (i < a->numSyms) {
+      NodeId var = newVarNode(a->syms[i], tok);
+      if (val == -1 && !node)
+        term = newUnary(ND_NEG, var, tok);
+      else if (val == 1 || (neg && val == -1))
+        term = var;
+      else
+        term = newBinary(ND_MUL, var, term, tok);
+    }
+    node = node ? newBinary(neg ? ND_SUB : ND_ADD, node, term, tok) : term;
+  }
+  return node;
+}
+
+/**
+ * @brief 运行时的循环次数 bound - i 或 i - bound
+ * @param  tc
+ * @param  tok
+ * @return NodeId
+ */
+static NodeId tripNode(TripCount *tc, TokenId tok) {
+  NodeId bound = tc->bound ? copyNode(tc->bound) : newNum(tc->boundVal, tok);
+  NodeId iv = newVarNode(tc->iv->var, tok);
+  if (tc->up)
+    return newBinary(ND_SUB, bound, iv, tok);
+  return newBinary(ND_SUB, iv, bound, tok);
+}
+
+/**
+ * @brief 运行时的C(n,j)，j不超过2。C(n,2)在0<n<2^31时按
+ * (n/2)*(n-1) + (n-n/2*2)*((n-1)/2) 计算，除法都是整除
+ * @param  tc
+ * @param  j
+ * @param  tok
+ * @return NodeId
+ */
+static NodeId binomNode(TripCount *tc, int j, TokenId tok) {
+  if (j == 1)
+    return tripNode(tc, tok);
+  NodeId half = newBinary(ND_DIV, tripNode(tc, tok), newNum(2, tok), tok);
+  NodeId even = newBinary(ND_MUL, half,
+                          newBinary(ND_SUB, tripNode(tc, tok), newNum(1, tok),
+                                    tok),
+                          tok);
+  NodeId odd = newBinary(
+      ND_SUB, tripNode(tc, tok),
+      newBinary(ND_MUL,
+                newBinary(ND_DIV, tripNode(tc, tok), newNum(2, tok), tok),
+                newNum(2, tok), tok),
+      tok);
+  NodeId rest = newBinary(
+      ND_DIV,
+      newBinary(ND_SUB, tripNode(tc, tok), newNum(1, tok), tok),
+      newNum(2, tok), tok);
+  return newBinary(ND_ADD, even, newBinary(ND_MUL, odd, rest, tok), tok);
+}
+
+/**
+ * @brief 变量最终值的表达式
+ * @param  v
+ * @param  tc
+ * @param  tok
+ * @return NodeId
+ */
+static NodeId finalNode(ScevVar *v, TripCount *tc, TokenId tok) {
+  // 常量的循环次数：sum final[j]*C(n,j)
+  if (tc->isConst) {
+    Affine a = affConst(0);
+    for (int j = 0; j <= SCEV_DEGREE; j++)
+      affAdd(&a, &v->final[j], binom(tc->trips, j));
+    return affNode(&a, tok);
+  }
+
+  // 运行时的循环次数：步长为1或-1，归纳变量恰好到达边界
+  if (v == tc->iv)
+    return tc->bound ? copyNode(tc->bound) : newNum(tc->boundVal, tok);
+  NodeId node = affNode(&v->final[0], tok);
+  for (int j = 1; j <= finalDegree(v); j++) {
+    Affine *a = &v->final[j];
+    if (isZeroAff(a))
+      continue;
+    NodeId term = binomNode(tc, j, tok);
+    if (!isConstAff(a) || a->c != 1)
+      term = newBinary(ND_MUL, affNode(a, tok), term, tok);
+    node = newBinary(ND_ADD, node, term, tok);
+  }
+  return node;
+}
+
+/**
+ * @brief 最终值中是否读取变量在循环入口处的值
+ * @param  v
+ * @param  var
+ * @param  tc
+ * @return true
+ * @return false
+ */
+static bool readsEntry(ScevVar *v, Obj *var, TripCount *tc) {
+  int deg = finalDegree(v);
+  if (!tc->isConst && deg > 0 && var == tc->iv->var)
+    return true;
+  for (int j = 0; j <= deg; j++)
+    for (int i = 0; i < v->final[j].numSyms; i++)
+      if (v->final[j].syms[i] == var)
+        return true;
+  return false;
+}
+
+/**
+ * @brief 给变量赋最终值的语句。最终值读取入口处的值，
+ * 读取其他变量的赋值需要在给它赋值之前
+ * @param  tc
+ * @param  tok
+ * @param  stmts
+ * @return int 语句数，有循环依赖时返回-1
+ */
+static int finalStmts(TripCount *tc, TokenId tok, NodeId *stmts) {
+  bool done[SCEV_VARS] = {false};
+  int len = 0;
+  for (int n = 0; n < NumVars; n++) {
+    int pick = -1;
+    for (int i = 0; i < NumVars && pick < 0; i++) {
+      if (done[i])
+        continue;
+      pick = i;
+      for (int j = 0; j < NumVars; j++)
+        if (j != i && !done[j] && readsEntry(&Vars[j], Vars[i].var, tc))
+          pick = -1;
+    }
+    if (pick < 0) {
+      Reason = "final values depend on each other";
+      return -1;
+    }
+    done[pick] = true;
+
+    // 值不变的变量不需要赋值
+    ScevVar *v = &Vars[pick];
+    Affine *a = &v->final[0];
+    if (finalDegree(v) == 0 && !a->c && a->numSyms == 1 &&
+        a->syms[0] == v->var && a->coefs[0] == 1)
+      continue;
+    NodeId rhs = finalNode(v, tc, tok);
+    NodeId assign = newBinary(ND_ASSIGN, newVarNode(v->var, tok), rhs, tok);
+    stmts[len++] = newUnary(ND_EXPR_STMT, assign, tok);
+  }
+  return len;
+}
+
+/**
+ * @brief 分析for循环，能求出各变量的最终值时替换为计算最终值的语句
+ * 循环次数为常量时：init; v1 = ...; v2 = ...;
+ * 否则：init; if (cond) { v1 = ...; ... }，有二次项时
+ * init; if (cond) { if (0 < n) { v1 = ...; ... } else 原来的循环 }
+ * @param  node
+ * @return NodeId 替换后的节点
+ */
+static NodeId replaceLoop(NodeId node) {
+  TokenId tok = nodeTok(node);
+  NumVars = 0;
+  KnownVar = NULL;
+  Reason = NULL;
+
+  // 初始化为 v = 常量 时，v的入口值已知；初始化语句保留在替换后的语句中
+  NodeId init = nodeInit(node);
+  int64_t val;
+  if (init && nodeKind(init) == ND_EXPR_STMT &&
+      nodeKind(nodeLhs(init)) == ND_ASSIGN &&
+      nodeKind(nodeLhs(nodeLhs(init))) == ND_VAR &&
+      isConst(nodeRhs(nodeLhs(init)), &val)) {
+    KnownVar = nodeVar(nodeLhs(nodeLhs(init)));
+    KnownVal = (int32_t)val;
+  }
+
+  // 迭代中的赋值按顺序为循环体、inc
+  TripCount tc = {0};
+  bool ok = collectAssigns(nodeThen(node)) &&
+            (!nodeInc(node) || collectAssigns(nodeInc(node)));
+
+  // 按依赖的顺序求各变量的递推
+  for (int resolved = 0; ok && resolved < NumVars;) {
+    int progress = 0;
+    for (int i = 0; ok && i < NumVars; i++) {
+      if (Vars[i].resolved)
+        continue;
+      Pending = false;
+      if (resolveVar(&Vars[i]))
+        progress++;
+      else if (!Pending)
+        ok = false;
+    }
+    if (ok && !progress) {
+      Reason = "variables depend on each other";
+      ok = false;
+    }
+    resolved += progress;
+  }
+
+  ok = ok && analyzeTrips(nodeCond(node), &tc);
+  for (int i = 0; ok && i < NumVars; i++) {
+    if (!finalCoefs(&Vars[i])) {
+      Reason = "too many variables in a coefficient";
+      ok = false;
+    }
+  }
+
+  // 运行时的循环次数只支持到二次项
+  bool square = false;
+  for (int i = 0; ok && !tc.isConst && i < NumVars; i++) {
+    int deg = finalDegree(&Vars[i]);
+    if (deg > 2) {
+      Reason = "trip count is not constant and degree is higher than 2";
+      ok = false;
+    }
+    square |= deg == 2;
+  }
+
+  // 循环次数为常量时，初始化的变量之后被赋最终值，不需要保留初始化
+  NodeId stmts[SCEV_VARS + 1];
+  int len = 0;
+  if (init && !(ok && tc.isConst && tc.trips && findVar(KnownVar)))
+    stmts[len++] = init;
+  int num = 0;
+  if (ok && !(tc.isConst && tc.trips == 0)) {
+    num = finalStmts(&tc, tok, stmts + len);
+    ok = num >= 0;
+  }
+
+  if (OptDumpScev) {
+    dumpVars(tok);
+    if (!ok)
+      note(tok, "scev: loop not replaced: %s", Reason);
+    else if (tc.isConst)
+      note(tok, "scev: trip count %ld", (long)tc.trips);
+    else if (tc.bound)
+      note(tok, "scev: trip count %s - %s when the loop is entered",
+           tc.up ? nodeVar(tc.bound)->name : tc.iv->var->name,
+           tc.up ? tc.iv->var->name : nodeVar(tc.bound)->name);
+    else if (tc.up)
+      note(tok, "scev: trip count %ld - %s when the loop is entered",
+           (long)tc.boundVal, tc.iv->var->name);
+    else
+      note(tok, "scev: trip count %s %c %ld when the loop is entered",
+           tc.iv->var->name, tc.boundVal < 0 ? '+' : '-',
+           tc.boundVal < 0 ? -(long)tc.boundVal : (long)tc.boundVal);
+  }
+  if (!ok)
+    return node;
+
+  NumReplaced++;
+  if (OptReport)
+    note(tok, "scev: loop replaced by closed form, %s trip count",
+         tc.isConst ? "constant" : "runtime");
+  if (tc.isConst)
+    return newBlock(stmts, len + num, tok);
+
+  // 运行时的循环次数：以原来的条件判断是否进入循环，
+  // 有二次项时n需要小于2^31，否则执行原来的循环
+  NodeId then = newBlock(stmts + len, num, tok);
+  if (square) {
+    NodeId guard = newCtrl(ND_IF, tok);
+    NodeId pos = newBinary(ND_LT, newNum(0, tok), tripNode(&tc, tok), tok);
+    nodeExt(guard)->cond = pos;
+    nodeExt(guard)->then = then;
+    nodeExt(node)->init = 0;
+    nodeExt(guard)->els = node;
+    then = guard;
+  }
+  NodeId entered = newCtrl(ND_IF, tok);
+  NodeId cond = copyNode(nodeCond(node));
+  nodeExt(entered)->cond = cond;
+  nodeExt(entered)->then = then;
+  stmts[len] = entered;
+  return newBlock(stmts, len + 1, tok);
+}
+
+/**
+ * @brief 自底向上遍历语句，内层循环先替换
+ * @param  node
+ * @return NodeId 替换后的节点
+ */
+static NodeId scevStmt(NodeId node) {
+  if (!node)
+    return 0;
+
+  switch (nodeKind(node)) {
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++) {
+      NodeId stmt = scevStmt(nodeBody(node, i));
+      Nodes.lists[nodeAt(node)->body + i] = stmt;
+    }
+    return node;
+  case ND_IF: {
+    NodeId then = scevStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    NodeId els = scevStmt(nodeEls(node));
+    nodeExt(node)->els = els;
+    return node;
+  }
+  case ND_FOR: {
+    NodeId then = scevStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    return replaceLoop(node);
+  }
+  default:
+    return node;
+  }
+}
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void scevBegin(void) { NumReplaced = 0; }
+
+/**
+ * @brief 标量演化入口函数
+ * @param  prog
+ */
+void scevLoops(Function *prog) { prog->body = scevStmt(prog->body); }
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void scevEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile, "scev: %d loops replaced by closed forms\n",
+            NumReplaced);
+}
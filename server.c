@@ -0,0 +1,173 @@
+#include "rvcc.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* 编译服务器 */
+
+// 一个进程依次处理多个编译请求，省去每个程序启动进程的开销。
+// 请求：十进制的程序长度，换行，之后是程序本身
+//   12\n{ return 0; }
+// 应答：状态（0成功，1出错）、汇编代码长度、诊断信息长度，换行，
+// 之后依次是汇编代码和诊断信息
+//   0 345 0\n.globl main...
+// 出错时不返回汇编代码。每个请求开始时重置编译状态，
+// 出错时由ErrorRecover返回到服务循环，而不退出进程。
+
+// 单个请求的大小上限
+#define MAX_REQUEST (64 << 20)
+
+/**
+ * @brief 读取一个请求，程序以'\0'结尾
+ * @param  in
+ * @param  buf
+ * @param  cap
+ * @return int 1表示读取成功，0表示输入结束，-1表示请求格式错误
+ */
+static int readRequest(FILE *in, char **buf, size_t *cap) {
+  unsigned long len;
+  int n = fscanf(in, "%lu", &len);
+  if (n == EOF)
+    return 0;
+  if (n != 1 || fgetc(in) != '\n' || len > MAX_REQUEST)
+    return -1;
+
+  if (len + 1 > *cap) {
+    *cap = len + 1;
+    *buf = realloc(*buf, *cap);
+    if (!*buf)
+      error("out of memory");
+  }
+  if (fread(*buf, 1, len, in) != len)
+    return -1;
+  (*buf)[len] = '\0';
+  return 1;
+}
+
+/**
+ * @brief 写出应答
+ * @param  out
+ * @param  status
+ * @param  asmBuf
+ * @param  asmLen
+ * @param  diag
+ * @param  diagLen
+ */
+static void writeReply(FILE *out, int status, char *asmBuf, size_t asmLen,
+                       char *diag, size_t diagLen) {
+  fprintf(out, "%d %zu %zu\n", status, asmLen, diagLen);
+  fwrite(asmBuf, 1, asmLen, out);
+  fwrite(diag, 1, diagLen, out);
+  fflush(out);
+}
+
+/**
+ * @brief 编译一个请求中的程序，汇编代码和诊断信息写入内存后一并应答
+ * @param  input
+ * @param  out
+ */
+static void serveRequest(char *input, FILE *out) {
+  char *asmBuf = NULL, *diag = NULL;
+  size_t asmLen = 0, diagLen = 0;
+  FILE *asmFile = open_memstream(&asmBuf, &asmLen);
+  FILE *diagFile = open_memstream(&diag, &diagLen);
+  if (!asmFile || !diagFile)
+    error("open_memstream: %s", strerror(errno));
+
+  // 出错时从compile中返回到这里
+  jmp_buf env;
+  int status = 0;
+  DiagFile = diagFile;
+  ErrorRecover = &env;
+  if (setjmp(env) == 0) {
+    compile(input, asmFile);
+  } else {
+    status = 1;
+    compileAbort();
+  }
+  ErrorRecover = NULL;
+  DiagFile = stderr;
+
+  fclose(asmFile);
+  fclose(diagFile);
+  writeReply(out, status, asmBuf, status ? 0 : asmLen, diag, diagLen);
+  free(asmBuf);
+  free(diag);
+}
+
+/**
+ * @brief 处理一个输入流中的所有请求
+ * @param  in
+ * @param  out
+ */
+static void serve(FILE *in, FILE *out) {
+  char *buf = NULL;
+  size_t cap = 0;
+  for (;;) {
+    int r = readRequest(in, &buf, &cap);
+    if (r == 0)
+      break;
+    // 格式错误后无法找到下一个请求的开头，应答后关闭
+    if (r < 0) {
+      char *msg = "invalid request\n";
+      writeReply(out, 1, NULL, 0, msg, strlen(msg));
+      break;
+    }
+    serveRequest(buf, out);
+  }
+  free(buf);
+}
+
+/**
+ * @brief 在Unix域套接字上依次处理各个连接
+ * @param  path
+ */
+static void serveSocket(char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+    error("socket path too long: %s", path);
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    error("socket: %s", strerror(errno));
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    error("bind %s: %s", path, strerror(errno));
+  if (listen(fd, 16) < 0)
+    error("listen: %s", strerror(errno));
+
+  // 客户端提前断开时，写应答不应终止服务器
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR)
+        continue;
+      error("accept: %s", strerror(errno));
+    }
+    FILE *in = fdopen(conn, "r");
+    FILE *out = fdopen(dup(conn), "w");
+    if (!in || !out)
+      error("fdopen: %s", strerror(errno));
+    serve(in, out);
+    fclose(in);
+    fclose(out);
+  }
+}
+
+/**
+ * @brief 编译服务器入口函数
+ * @param  path
+ * @return int
+ */
+int runServer(char *path) {
+  if (path)
+    serveSocket(path);
+  else
+    serve(stdin, stdout);
+  return 0;
+}
@@ -9,14 +9,14 @@ assert() {
 
   # 运行程序，传入期待值，将生成结果写入tmp.s汇编文件。
   # 如果运行不成功，则会执行exit退出。成功时会短路exit操作
-  ./rvcc "$input" > tmp.s || exit
+  ./rvcc $RVCC_FLAGS "$input" > tmp.s || exit
   # 编译rvcc产生的汇编文件
   # gcc -o tmp tmp.s
   "$RISCV"/bin/riscv64-unknown-linux-gnu-gcc -static -o tmp tmp.s
 
   # 运行生成出来目标文件
   # ./tmp
-  "$RISCV"/bin/qemu-riscv64 -L "$RISCV"/sysroot ./tmp
+  "$RISCV"/bin/qemu-riscv64 ${QEMU_CPU:+-cpu "$QEMU_CPU"} -L "$RISCV"/sysroot ./tmp
   # $RISCV/bin/spike --isa=rv64gc $RISCV/riscv64-unknown-linux-gnu/bin/pk ./tmp
 
   # 获取程序返回值，存入 实际值
@@ -128,5 +128,347 @@ assert 3 '{ for (;;) {return 3;} return 5; }'
 # [17] 支持while语句
 echo "**** [17] 支持while语句 ****"
 assert 10 '{ i=0; while(i<10) { i=i+1; } return i; }'
+# [18] 向量化循环
+echo "**** [18] 向量化循环 -march=rv64gcv ****"
+# rvcc的参数，以及qemu模拟的CPU，需要支持向量扩展
+RVCC_FLAGS=-march=rv64gcv
+for vlen in 128 256; do
+QEMU_CPU="rv64,v=true,vlen=$vlen"
+assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 10 '{ j=0; for (i=0; i<10; i=i+1) j=j+i; return i; }'
+assert 0 '{ j=0; for (i=5; i<3; i=i+1) j=j+i; return j; }'
+assert 120 '{ p=1; for (i=1; i<=5; i=i+1) p=p*i; return p; }'
+assert 128 '{ p=1; for (i=0; i<7; i=1+i) p=2*p; return p; }'
+assert 229 '{ s=250; n=7; for (i=0; i<n; i=i+1) { s=s-i; ; } return s; }'
+assert 160 '{ x=0; for (i=0; i<100; i=i+1) x=x+(i*i)/(i+1)-i; return x+3; }'
+done
+RVCC_FLAGS=
+QEMU_CPU=
+
+# [19] 循环展开
+echo "**** [19] 循环展开 -funroll-loops ****"
+for RVCC_FLAGS in "-funroll-loops" "-funroll-loops -funroll-budget=30 -funroll-factor=3"; do
+assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 40 '{ s=0; for (i=10; i>0; i=i-1) s=s+i*i; return s-345; }'
+assert 30 '{ s=0; for (i=10; i>=1; i=i-3) s=s+i; return s+8; }'
+assert 0 '{ s=0; for (i=10; i<10; i=i+1) s=s+1; return s; }'
+assert 11 '{ s=0; for (i=0; i<=20; i=i+2) s=s+1; return s; }'
+assert 247 '{ s=0; for (i=0; i<1000; i=i+1) s=s+i; return s/1000+i/1000+i-1000+3; }'
+assert 57 '{ s=0; for (i=0; i<10; i=i+1) for (j=0; j<i; j=j+1) s=s+j; return s-63; }'
+assert 7 '{ for (i=0; i<100; i=i+1) if (i==7) return i; return 0; }'
+done
+RVCC_FLAGS=
+
+# [20] 公共子表达式消除
+echo "**** [20] 公共子表达式消除 -fcse ****"
+for RVCC_FLAGS in "-fcse" "-fcse -funroll-loops"; do
+assert 24 '{ a=3; b=4; return a*b+b*a; }'
+assert 21 '{ a=2; b=a*3; a=5; return a*3+b; }'
+assert 14 '{ a=3; b=4; if (a*b>10) return a*b+2; return a*b; }'
+assert 2 '{ a=1; c=3; if (a) c=a+1; else a=a+1; return c+(a+1)-2; }'
+assert 9 '{ a=2; b=a+1; c=0; for (i=0; i<3; i=i+1) c=c+(a+1); return b*c/3; }'
+assert 9 '{ a=1; s=0; for (i=0; i<3; i=i+1) { s=s+(a+1); a=a+1; } return s+(a+1)-5; }'
+assert 26 '{ a=3; b=4; x=a*b+1; y=a*b+1; return x+y; }'
+done
+RVCC_FLAGS=
+# 值在顶层语句之间复用
+if ./rvcc -O2 -fno-sccp -fopt-report '{ a=3; b=4; x=a*b+1; y=a*b+1; return x+y; }' \
+   2>&1 >/dev/null | grep -q '^cse: 3 hits'; then
+  echo "-fopt-report => cse across statements ok"
+else
+  echo "-fopt-report => no cse across statements"
+  exit 1
+fi
+
+# [21] 稀疏条件常量传播
+echo "**** [21] 稀疏条件常量传播 -fsccp ****"
+for RVCC_FLAGS in "-fsccp" "-fsccp -fcse -funroll-loops"; do
+assert 12 '{ a=3; b=a*4; if (b>10) return b; return 0; }'
+assert 2 '{ for (i=0; i<0; i=i+1) a=1; return 2; }'
+assert 2 '{ if (a=0) b=1; else b=2; return b; }'
+assert 1 '{ a=2147483647; b=a+1; return b<a; }'
+assert 7 '{ a=1; b=2; for (i=0; i<3; i=i+1) { if (a==1) b=b+1; else a=5; } return a+b+1; }'
+assert 9 '{ a=0; for (;;) { a=a+1; if (a==9) return a; } return 2; }'
+assert 55 '{ n=10; s=0; for (i=1; i<=n; i=i+1) s=s+i; return s; }'
+done
+RVCC_FLAGS=
+
+# [22] 编译服务器
+echo "**** [22] 编译服务器 --server ****"
+# 发送多个请求，出错的请求之后，服务器仍应正确编译后续的请求
+assertServer() {
+  good="$1"
+  bad="$2"
+  printf '%d\n%s%d\n%s%d\n%s' "${#good}" "$good" "${#bad}" "$bad" \
+    "${#good}" "$good" | ./rvcc --server > tmp.reply || exit
+  ./rvcc "$good" > tmp.expected
+  {
+    read -r status len diag; head -c "$len" > tmp.1.s; head -c "$diag" > /dev/null
+    read -r status2 len diag; head -c "$len" > /dev/null; head -c "$diag" > /dev/null
+    read -r status3 len diag; head -c "$len" > tmp.3.s
+  } < tmp.reply
+  if [ "$status$status2$status3" = "010" ] && cmp -s tmp.1.s tmp.expected &&
+     cmp -s tmp.3.s tmp.expected; then
+    echo "$good, $bad => ok"
+  else
+    echo "$good, $bad => server output differs"
+    exit 1
+  fi
+}
+assertServer '{ a=3; return a*4; }' '{ return 1+*2; }'
+assertServer '{ i=0; while(i<10) { i=i+1; } return i; }' '{ if (1 }'
+# 代码生成中报错的请求不影响之后的输出
+assertServer '{ return 1; }' '{ return (2=3)+1; }'
+
+# [23] 文件和标准输入
+echo "**** [23] 文件和标准输入 ****"
+# 从文件、重定向的标准输入和管道读入程序，输出应与命令行传入时一致
+assertFile() {
+  printf '%s' "$1" > tmp.c
+  ./rvcc "$1" > tmp.expected || exit
+  ./rvcc tmp.c > tmp.1.s && ./rvcc - < tmp.c > tmp.2.s &&
+    cat tmp.c | ./rvcc - > tmp.3.s || exit
+  if cmp -s tmp.1.s tmp.expected && cmp -s tmp.2.s tmp.expected &&
+     cmp -s tmp.3.s tmp.expected; then
+    echo "$1 => ok"
+  else
+    echo "$1 => output differs"
+    exit 1
+  fi
+}
+assertFile '{
+  i=0; j=0;
+  for (i=0; i<=10; i=i+1) j=i+j;
+  return j;
+}'
+assertFile '{ a=3; b=a*4; if (b>10) return b; return 0; }'
+# 出错时报告所在的文件和行
+printf '{\n  a=1;\n  return a+*2;\n}\n' > tmp.c
+if ./rvcc tmp.c 2>&1 >/dev/null | grep -q '^tmp.c:3: '; then
+  echo "tmp.c => error at line 3"
+else
+  echo "tmp.c => wrong error location"
+  exit 1
+fi
+
+# [24] 控制流图与块排列
+echo "**** [24] 控制流图与块排列 ****"
+for RVCC_FLAGS in "" "-fsccp -fcse -funroll-loops"; do
+assert 14 '{ s=0; for (i=0; i<10; i=i+1) { if (i>5) s=s+1; else s=s+2; } return s-2; }'
+assert 45 '{ s=0; for (i=0; i<10; i=i+1) for (j=0; j<i; j=j+1) s=s+1; return s; }'
+assert 6 '{ i=0; for (;;) { i=i+1; if (i>5) return i; } }'
+assert 3 '{ i=0; while (i<3) { if (i==1) { i=i+1; } else { i=i+1; } } return i; }'
+assert 4 '{ if (1) { if (0) return 3; } else return 5; return 4; }'
+done
+RVCC_FLAGS=
+
+# [25] 优化级别
+echo "**** [25] 优化级别 -O0 -O2 -fno-<pass> ****"
+for RVCC_FLAGS in "-O0" "-O2" "-O2 -fno-sccp -fno-reorder-blocks"; do
+assert 12 '{ a=3; b=a*4; if (b>10) return b; return 0; }'
+assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 9 '{ a=2; b=a+1; c=0; for (i=0; i<3; i=i+1) c=c+(a+1); return b*c/3; }'
+done
+RVCC_FLAGS=
+# -print-after输出优化后的语句，-ftime-report输出各优化的统计
+if ./rvcc -O2 -print-after=sccp '{ a=3; return a*4; }' 2>&1 >/dev/null |
+   grep -q '^return 12;$' &&
+   ./rvcc -O2 -ftime-report '{ a=3; return a*4; }' 2>&1 >/dev/null |
+   grep -q '^sccp '; then
+  echo "-print-after, -ftime-report => ok"
+else
+  echo "-print-after, -ftime-report => wrong output"
+  exit 1
+fi
+
+# [26] 静态周期估计
+echo "**** [26] 静态周期估计 -fcost-report ****"
+for RVCC_FLAGS in "-fcost-report" "-fcost-report -mtune=sifive-u74 -O2"; do
+assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 14 '{ s=0; for (i=0; i<10; i=i+1) { if (i>5) s=s+1; else s=s+2; } return s-2; }'
+done
+RVCC_FLAGS=
+# 循环标出每次迭代的周期数，语句计入循环的各次迭代
+# 报告中语句和循环分别按周期数从高到低排列，只列出语句本身
+printf '{\n  s=0;\n  for (i=0; i<10; i=i+1)\n    s=s+i/3;\n  return s;\n}\n' > tmp.c
+./rvcc -fcost-report tmp.c 2>tmp.report | grep -q '^# cost: loop at line 3: ' || exit
+STMT=$(sed -n '2s/^3: statement \([0-9]*\) cycles: for (i=0; i<10; i=i+1) s=s+i\/3;$/\1/p' tmp.report)
+LOOP=$(sed -n '5s/^3: loop \([0-9]*\) cycles per iteration: .*/\1/p' tmp.report)
+if [ -n "$STMT" ] && [ -n "$LOOP" ] && [ "$STMT" -ge $((LOOP * 10)) ]; then
+  echo "tmp.c => cost report ok"
+else
+  echo "tmp.c => wrong cost report"
+  exit 1
+fi
+
+# [27] 调试信息
+echo "**** [27] 调试信息 -g ****"
+for RVCC_FLAGS in "-g" "-g -O2"; do
+assert 55 '{ i=0; j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 14 '{ s=0; for (i=0; i<10; i=i+1) { if (i>5) s=s+1; else s=s+2; } return s-2; }'
+done
+RVCC_FLAGS=
+# 输出源文件名、语句所在的行和列，以及调用帧信息
+printf '{\n  a=1;\n  return a+2;\n}\n' > tmp.c
+./rvcc -g tmp.c > tmp.s || exit
+if grep -q '^  \.file 1 "tmp.c"$' tmp.s && grep -q '^  \.loc 1 3 ' tmp.s &&
+   grep -q '^  \.cfi_startproc$' tmp.s && grep -q '^  \.cfi_endproc$' tmp.s; then
+  echo "tmp.c => line and frame info ok"
+else
+  echo "tmp.c => wrong line and frame info"
+  exit 1
+fi
+# 公共子表达式使用的s1~sN保存在fp之下固定的位置，CFI中标出
+input='{ s=0; for (i=0; i<10; i=i+1) s=s+i; a=s*7+s; b=s*7-s; return a+b; }'
+if ./rvcc -g -O2 "$input" | grep -A1 '^\.L\.body:$' |
+   grep -q '^  \.cfi_offset s1, -16$' &&
+   ./rvcc -g -O2 "$input" | grep -A1 '^  sd s1, -8(fp)$' |
+   grep -q '^  \.cfi_offset s1, -16$'; then
+  echo "-g -O2 => saved register frame info ok"
+else
+  echo "-g -O2 => wrong saved register frame info"
+  exit 1
+fi
+
+# [28] 指令选择
+echo "**** [28] 指令选择 ****"
+for RVCC_FLAGS in "" "-O2" "-march=rv64gcv"; do
+# int为32位，溢出时回绕
+assert 1 '{ a=2147483647; b=a+1; return b==-2147483647-1; }'
+assert 1 '{ return 65536*65536==0; }'
+assert 1 '{ a=-2147483647-1; return a/-1==a; }'
+assert 1 '{ s=0; for (i=0; i<=4000; i=i+1) s=s+i*i*i; return s==-1663416064; }'
+# 立即数和大常量
+assert 1 '{ a=305419896; return a==305419896; }'
+assert 1 '{ a=2147481600; return a-2047==2147479553; }'
+assert 1 '{ a=-100000; return 100000+a==0; }'
+assert 3 '{ a=-7; return (a/2==-3)+(a/4==-1)+(a/1==-7); }'
+assert 4 '{ a=2047; return (a<2047)+(2047<=a)+(2046<a)+(a<=2047)+(a==2047)+(2048<a); }'
+done
+RVCC_FLAGS=
+# 执行的指令数不超过上限。每条指令作为一个翻译块，执行时记录一次，
+# 减去空程序执行的指令数即为程序多执行的指令数
+countInsns() {
+  ./rvcc $RVCC_FLAGS "$1" > tmp.s || exit
+  "$RISCV"/bin/riscv64-unknown-linux-gnu-gcc -static -o tmp tmp.s
+  "$RISCV"/bin/qemu-riscv64 ${QEMU_CPU:+-cpu "$QEMU_CPU"} -one-insn-per-tb \
+    -d exec,nochain -D tmp.log -L "$RISCV"/sysroot ./tmp
+  grep -c '^Trace' tmp.log
+}
+assertInsns() {
+  max="$1"
+  input="$2"
+  actual=$(($(countInsns "$input") - $(countInsns '{ return 0; }')))
+  if [ "$actual" -le "$max" ]; then
+    echo "$input => $actual instructions"
+  else
+    echo "$input => at most $max instructions expected, but got $actual"
+    exit 1
+  fi
+}
+assertInsns 108 '{ s=0; for (i=0; i<10; i=i+1) s=s+i; return s; }'
+assertInsns 18 '{ a=305419896; b=a*8+a/4; return b>1000; }'
+assertInsns 2109 '{ x=0; for (i=0; i<100; i=i+1) x=x+(i*i)/(i+1)-i; return x+3; }'
+RVCC_FLAGS=-O2
+assertInsns 69 '{ s=0; for (i=0; i<10; i=i+1) s=s+i; return s; }'
+assertInsns 2016 '{ x=0; for (i=0; i<100; i=i+1) x=x+(i*i)/(i+1)-i; return x+3; }'
+RVCC_FLAGS=
+
+# [29] 超优化
+echo "**** [29] 超优化 ****"
+for RVCC_FLAGS in "" "-fno-superopt" "-O2"; do
+assert 1 '{ a=3; b=5; return (a+b)*(a-b)==-16; }'
+assert 1 '{ a=65536; b=7; return a*a+b==b; }'
+assert 0 '{ a=46341; b=7; return a*a+b==b; }'
+assert 1 '{ a=-2147483647-1; return a+a==0; }'
+assert 0 '{ a=2147483647; return a<a+1; }'
+assert 1 '{ a=10; b=3; c=4; return a*b-c*a==-10; }'
+assert 3 '{ a=7; b=7; return (a<=b)+(a==b)*2+(a!=b)*4; }'
+assert 12 '{ a=-3; return -(a*5)+a; }'
+assert 20 '{ s=0; for (i=0; i<10; i=i+1) s=s+(i<5)*(i+i); return s; }'
+done
+RVCC_FLAGS=
+assertInsns 8 '{ a=3; b=5; return (a+b)*(a-b); }'
+assertInsns 1608 '{ s=0; for (i=0; i<100; i=i+1) { t=i*3; s=(s+t)*(s-t); } return s; }'
+# -fopt-report输出匹配的表达式数和节省的指令数，-print-after输出替换后的指令
+input='{ a=3; b=5; return (a+b)*(a-b); }'
+if ./rvcc -fopt-report "$input" 2>&1 >/dev/null |
+   grep -q '^superopt: 1 expressions matched, 6 instructions saved$' &&
+   ./rvcc -print-after=superopt "$input" 2>&1 >/dev/null |
+   grep -A1 '^# IR after superopt$' | grep -q '^# superoptimized '; then
+  echo "-fopt-report, -print-after => superopt ok"
+else
+  echo "-fopt-report, -print-after => wrong superopt output"
+  exit 1
+fi
+
+# [30] if转换
+echo "**** [30] if转换 -march=rv64gc_zicond ****"
+for RVCC_FLAGS in "" "-fno-if-convert" "-O2" "-march=rv64gc_zicond" \
+                  "-O2 -march=rv64gc_zicond -fif-convert-budget=100"; do
+# 使用Zicond时qemu模拟的CPU需要支持它
+case "$RVCC_FLAGS" in
+*zicond*) QEMU_CPU="rv64,zicond=true" ;;
+*) QEMU_CPU= ;;
+esac
+assert 3 '{ a=3; b=5; if (a<b) x=a; else x=b; return x; }'
+assert 5 '{ a=3; b=5; if (a>b) x=a; else x=b; return x; }'
+assert 7 '{ a=0; x=7; if (a) x=0; return x; }'
+assert 0 '{ a=-4; x=7; if (a) x=0; return x; }'
+assert 0 '{ a=2; x=7; if (a!=2) x=9; else x=0; return x; }'
+assert 9 '{ a=2; x=7; if (a==2) { x=a*a+5; } else { x=a-1; } return x; }'
+assert 11 '{ a=5; b=4; if (a<=b) x=a*b; else x=a+b*2+-2; return x; }'
+assert 30 '{ m=0; for (i=0; i<10; i=i+1) { if (i>m) m=i*5; } return m; }'
+assert 9 '{ s=0; for (i=0; i<10; i=i+1) { if (i-3*(i/3)) s=s+1; else s=s; } return s+3; }'
+done
+RVCC_FLAGS=
+QEMU_CPU=
+# 选择的指令序列代替分支，超过-fif-convert-budget时不转换，
+# -print-after输出转换后的指令
+input='{ a=3; b=5; if (a<b) x=a; else x=b; return x; }'
+if ./rvcc -march=rv64gc_zicond -fopt-report "$input" 2>&1 >tmp.s |
+   grep -q '^if-convert: 1 if statements converted$' &&
+   grep -q 'czero.nez' tmp.s && ! grep -q beqz tmp.s &&
+   ./rvcc -fif-convert-budget=4 "$input" | grep -q beqz; then
+  echo "-fopt-report, -fif-convert-budget => if-convert ok"
+else
+  echo "-fopt-report, -fif-convert-budget => wrong if-convert output"
+  exit 1
+fi
+if ./rvcc -march=rv64gc_zicond -print-after=if-convert "$input" 2>&1 >/dev/null |
+   grep -A20 '^# IR after if-convert$' | grep -q 'czero.nez'; then
+  echo "-print-after => if-convert ok"
+else
+  echo "-print-after => wrong if-convert output"
+  exit 1
+fi
+
+# [31] 标量演化
+echo "**** [31] 标量演化 ****"
+for RVCC_FLAGS in "-O2" "-fscev" "-O2 -fno-scev"; do
+assert 55 '{ j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+assert 10 '{ i=3; while (i<10) i=i+1; return i; }'
+assert 136 '{ n=5; s=0; t=0; for (i=n; i<20; i=i+1) { t=t+i; s=s+t; } return s; }'
+assert 1 '{ s=0; for (i=0; i<100000; i=i+1) s=s+i*i; return s==216474736; }'
+assert 31 '{ x=3; n=4; s=1; i=n; while (i>=0) { s=s+x*i; i=i-1; } return s; }'
+assert 40 '{ s=0; for (i=0; i<20; i=i+1) for (j=0; j<i; j=j+1) s=s+j; return s-1100; }'
+assert 7 '{ s=7; for (i=10; i>10; i=i-1) s=0; return s; }'
+assert 165 '{ s=0; t=0; for (i=30; i>=0; i=i-3) { t=i; s=s+t*2; } return s/2-t; }'
+done
+RVCC_FLAGS=-O2
+# 循环被闭式代替后，执行的指令数与循环次数无关
+assertInsns 20 '{ s=0; for (i=0; i<1000000; i=i+1) s=s+i; return s==1783293664; }'
+RVCC_FLAGS=
+input='{ j=0; for (i=0; i<=10; i=i+1) j=i+j; return j; }'
+if ./rvcc -O2 -fdump-scev "$input" 2>&1 >/dev/null |
+   grep -q 'scev: j = {j,+,0,+,1}' &&
+   ./rvcc -O2 -fdump-scev "$input" 2>&1 >/dev/null |
+   grep -q 'scev: trip count 11$'; then
+  echo "-fdump-scev => scev ok"
+else
+  echo "-fdump-scev => wrong scev output"
+  exit 1
+fi
+
 # 如果运行正常未提前退出，程序将显示OK
 echo OK
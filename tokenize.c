@@ -1,24 +1,130 @@
 #include "rvcc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /**
- * @brief 当前输入的字符串
+ * @brief 当前的终结符流
  */
-char *current_input;
+TokenStream Tokens;
+
+// 输入的来源
+typedef enum {
+  SRC_STRING, // 内存中的字符串
+  SRC_MMAP,   // 映射到内存的文件
+  SRC_STREAM, // 管道等无法映射的文件，通过窗口分段读入
+} SourceKind;
+
+// 输入，Tokens.text指向其在内存中的窗口
+typedef struct Source Source;
+struct Source {
+  SourceKind kind;
+  char *name;       // 输入的名称，用于诊断信息
+  char *cur;        // 下一个待分析的字符
+  char *end;        // 窗口中已读入字符的结尾
+  bool eof;         // 输入已全部读入窗口
+  bool done;        // 已生成EOF Token
+  int fd;           // 流式读取的文件
+  size_t cap;       // 流式读取的窗口容量
+  size_t mapLen;    // 映射的长度
+  uint32_t dropped; // 映射中已解除映射的字节数
+  uint32_t lineOff; // 检查点：最早的未释放Token所在行的行首偏移量
+  int line;         // 检查点所在的行号
+};
+
+static Source Src;
+
+// 行首的索引，starts[i]为检查点之后第i行的行首偏移量，starts[0]即检查点。
+// 需要时从scanned向后扫描换行符扩展索引，每个字符只扫描一次，
+// 查找行号时二分查找，不需要从检查点重新扫描
+typedef struct LineIndex LineIndex;
+struct LineIndex {
+  uint32_t *starts; // 行首偏移量，升序
+  uint32_t len;     // 行数
+  uint32_t cap;     // 已分配的容量
+  uint32_t scanned; // 已扫描到的偏移量
+};
+
+static LineIndex Lines;
 
 /**
  * @brief generate a new Token
+ * 终结符追加到终结符流的末尾，容量不足时按倍数扩容
  * @param  kind
  * @param  start
  * @param  end
- * @return Token*
+ * @return TokenId
  */
-Token *newToken(TokenKind kind, char *start, char *end) {
-  Token *tok = calloc(1, sizeof(Token));
-  tok->kind = kind;
-  tok->loc = start;
-  tok->len = end - start;
-  return tok;
+static TokenId newToken(TokenKind kind, char *start, char *end) {
+  TokenStream *ts = &Tokens;
+  if (ts->len == ts->cap) {
+    ts->cap = ts->cap ? ts->cap * 2 : 64;
+    ts->kinds = realloc(ts->kinds, ts->cap * sizeof(*ts->kinds));
+    ts->locs = realloc(ts->locs, ts->cap * sizeof(*ts->locs));
+    ts->lens = realloc(ts->lens, ts->cap * sizeof(*ts->lens));
+    if (!ts->kinds || !ts->locs || !ts->lens)
+      error("out of memory");
+  }
+  ts->kinds[ts->len] = kind;
+  ts->locs[ts->len] = ts->textBase + (start - ts->text);
+  ts->lens[ts->len] = end - start;
+  return ts->base + ts->len++;
+}
+
+/**
+ * @brief 将数字Token的值记录到侧表
+ * @param  tok
+ * @param  val
+ */
+static void addNumVal(TokenId tok, int val) {
+  TokenStream *ts = &Tokens;
+  if (ts->numLen == ts->numCap) {
+    ts->numCap = ts->numCap ? ts->numCap * 2 : 16;
+    ts->numToks = realloc(ts->numToks, ts->numCap * sizeof(*ts->numToks));
+    ts->numVals = realloc(ts->numVals, ts->numCap * sizeof(*ts->numVals));
+    if (!ts->numToks || !ts->numVals)
+      error("out of memory");
+  }
+  ts->numToks[ts->numLen] = tok;
+  ts->numVals[ts->numLen] = val;
+  ts->numLen++;
+}
+
+/**
+ * @brief 从侧表中查找数字Token的值，侧表按下标升序，二分查找
+ * @param  tok
+ * @return int
+ */
+int tokVal(TokenId tok) {
+  TokenStream *ts = &Tokens;
+  uint32_t lo = 0, hi = ts->numLen;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (ts->numToks[mid] < tok)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  assert(lo < ts->numLen && ts->numToks[lo] == tok);
+  return ts->numVals[lo];
+}
+
+// 诊断信息的输出文件，编译服务器将其重定向到应答中
+FILE *DiagFile;
+// 出错后的恢复点，编译服务器出错后返回到该处继续处理下一个请求
+jmp_buf *ErrorRecover;
+
+/**
+ * @brief 出错后退出，或返回到恢复点
+ */
+static void fail(void) {
+  if (ErrorRecover)
+    longjmp(*ErrorRecover, 1);
+  exit(1);
 }
 
 /**
@@ -30,27 +136,81 @@ void error(char *fmt, ...) {
   va_list ap;
   // va_start，初始化一个va_list，用于获取可变参数
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
+  vfprintf(DiagFile, fmt, ap);
+  fprintf(DiagFile, "\n");
   va_end(ap);
-  exit(1);
+  fail();
+}
+
+/**
+ * @brief 行首索引中loc所在行的下标，必要时扫描到loc为止扩展索引
+ * loc必须在检查点之后，即属于尚未释放的Token
+ * @param  loc
+ * @return uint32_t
+ */
+static uint32_t lineIndex(char *loc) {
+  LineIndex *li = &Lines;
+  uint32_t off = Tokens.textBase + (loc - Tokens.text);
+  if (off > li->scanned) {
+    char *p = Tokens.text + (li->scanned - Tokens.textBase);
+    for (; (p = memchr(p, '\n', loc - p)); p++) {
+      if (li->len == li->cap) {
+        li->cap = li->cap ? li->cap * 2 : 64;
+        li->starts = realloc(li->starts, li->cap * sizeof(*li->starts));
+        if (!li->starts)
+          error("out of memory");
+      }
+      li->starts[li->len++] = Tokens.textBase + (p + 1 - Tokens.text);
+    }
+    li->scanned = off;
+  }
+
+  // 最后一个不大于off的行首
+  uint32_t lo = 1, hi = li->len;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (li->starts[mid] <= off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
 }
 
 /**
- * @brief 出错位置
+ * @brief 计算loc所在的行号和行首
+ * @param  loc
+ * @param  lineStart
+ * @return int
+ */
+static int locLine(char *loc, char **lineStart) {
+  uint32_t i = lineIndex(loc);
+  *lineStart = Tokens.text + (Lines.starts[i] - Tokens.textBase);
+  return Src.line + i;
+}
+
+/**
+ * @brief 出错位置，输出所在行并标出出错的列
  * @param  loc
  * @param  fmt
  * @param  ap
  */
 static void verrotAt(char *loc, char *fmt, va_list ap) {
-  fprintf(stderr, "%s\n", current_input);
-  // 获取错误位置
-  int pos = loc - current_input;
+  char *start;
+  int line = locLine(loc, &start);
+  char *end = loc;
+  while (end < Src.end && *end != '\n')
+    end++;
+
+  // 输出文件名、行号和所在行
+  int indent = fprintf(DiagFile, "%s:%d: ", Src.name, line);
+  fprintf(DiagFile, "%.*s\n", (int)(end - start), start);
   // 输出错误位置
-  fprintf(stderr, "%*s", pos, "");
-  fprintf(stderr, "^ ");
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
+  int pos = loc - start + indent;
+  fprintf(DiagFile, "%*s", pos, "");
+  fprintf(DiagFile, "^ ");
+  vfprintf(DiagFile, fmt, ap);
+  fprintf(DiagFile, "\n");
 }
 
 /**
@@ -64,7 +224,7 @@ void errorAt(char *loc, char *fmt, ...) {
   va_start(ap, fmt);
   verrotAt(loc, fmt, ap);
   va_end(ap);
-  exit(1);
+  fail();
 }
 
 /**
@@ -73,12 +233,74 @@ void errorAt(char *loc, char *fmt, ...) {
  * @param  fmt
  * @param  ...
  */
-void errorTok(Token *tok, char *fmt, ...) {
+void errorTok(TokenId tok, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  verrotAt(tok->loc, fmt, ap);
+  verrotAt(tokLoc(tok), fmt, ap);
   va_end(ap);
-  exit(1);
+  fail();
+}
+
+/**
+ * @brief 计算终结符所在的行号和列号，从1开始
+ * @param  tok
+ * @param  line
+ * @param  col
+ */
+void tokLineCol(TokenId tok, int *line, int *col) {
+  char *loc = tokLoc(tok);
+  char *start;
+  *line = locLine(loc, &start);
+  *col = loc - start + 1;
+}
+
+/**
+ * @brief 输入的名称，文件名或"<stdin>"、"<input>"
+ * @return char*
+ */
+char *sourceName(void) { return Src.name; }
+
+/**
+ * @brief 复制从start到end（含）的源代码，用于报告
+ * 连续的空白合并为一个空格，跨行的语句也显示在一行中
+ * @param  start
+ * @param  end
+ * @param  buf
+ * @param  size buf的大小，超出时截断
+ * @return int start所在的行号
+ */
+int tokSourceText(TokenId start, TokenId end, char *buf, int size) {
+  char *loc = tokLoc(start);
+  char *last = tokLoc(end) + tokLen(end);
+  char *lineStart;
+  int line = locLine(loc, &lineStart);
+  int len = 0;
+  for (char *p = loc; p < last && len + 1 < size; p++) {
+    if (!isspace(*p))
+      buf[len++] = *p;
+    else if (!isspace(p[-1]))
+      buf[len++] = ' ';
+  }
+  buf[len] = '\0';
+  return line;
+}
+
+/**
+ * @brief 输出优化报告等提示信息，不退出
+ * @param  tok
+ * @param  fmt
+ * @param  ...
+ */
+void note(TokenId tok, char *fmt, ...) {
+  int line, col;
+  tokLineCol(tok, &line, &col);
+  fprintf(DiagFile, "%d:%d: note: ", line, col);
+
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(DiagFile, fmt, ap);
+  va_end(ap);
+  fprintf(DiagFile, "\n");
 }
 
 /**
@@ -88,23 +310,24 @@ void errorTok(Token *tok, char *fmt, ...) {
  * @return true
  * @return false
  */
-bool equal(Token *tok, char *str) {
+bool equal(TokenId tok, char *str) {
   // memcmp，比较两个内存区域的内容
   // 比较按照字典序，LHS<RHS回负值，LHS=RHS返回0，LHS>RHS返回正值
-  return memcmp(tok->loc, str, tok->len) == 0 && str[tok->len] == '\0';
+  int len = tokLen(tok);
+  return memcmp(tokLoc(tok), str, len) == 0 && str[len] == '\0';
 }
 
 /**
  * @brief skip token if it is expected symbol `-`
  * @param  tok
  * @param  str
- * @return Token*
+ * @return TokenId
  */
-Token *skip(Token *tok, char *str) {
+TokenId skip(TokenId tok, char *str) {
   if (!equal(tok, str)) {
     errorTok(tok, "expected '%s'", str);
   }
-  return tok->next;
+  return tok + 1;
 }
 
 /**
@@ -125,38 +348,203 @@ static bool isIdent1(char c) {
  */
 static bool isIdent2(char c) { return isIdent1(c) || ('0' <= c && c <= '9'); }
 
+/* 词法分析快速路径 */
+
+// 扫描函数：返回[p, end)中第一个不满足条件的字符位置，全部满足时返回end
+typedef char *(*ScanFn)(char *p, char *end);
+
+// 一组扫描函数，按CPU支持的指令集选择
+typedef struct LexOps LexOps;
+struct LexOps {
+  ScanFn skipSpace; // 跳过空白符，定位下一个有意义的字符
+  ScanFn identEnd;  // 查找标识符的结尾
+  ScanFn digitEnd;  // 查找数字的结尾
+};
+
+static char *skipSpaceScalar(char *p, char *end) {
+  while (p < end && isspace(*p))
+    ++p;
+  return p;
+}
+
+static char *identEndScalar(char *p, char *end) {
+  while (p < end && isIdent2(*p))
+    ++p;
+  return p;
+}
+
+static char *digitEndScalar(char *p, char *end) {
+  while (p < end && isdigit(*p))
+    ++p;
+  return p;
+}
+
+static const LexOps ScalarOps = {skipSpaceScalar, identEndScalar,
+                                 digitEndScalar};
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// 空白符为' '和['\t', '\r']，利用无符号饱和比较判断范围
+static inline __m128i spaceMask16(__m128i x) {
+  __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+  __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+  return _mm_or_si128(ctrl, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i digitMask16(__m128i x) {
+  __m128i t = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+  return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(9)), t);
+}
+
+// 标识符字符为[a-z, A-Z, 0-9, _]，字母统一转为小写后判断
+static inline __m128i identMask16(__m128i x) {
+  __m128i t = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+  __m128i under = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+  return _mm_or_si128(_mm_or_si128(alpha, under), digitMask16(x));
+}
+
+// 每次处理16个字节，找到第一个不满足条件的字节，剩余不足16字节时走标量路径
+#define SCAN_SSE2(name, mask, tail)                                            \
+  static char *name(char *p, char *end) {                                      \
+    while (end - p >= 16) {                                                    \
+      __m128i x = _mm_loadu_si128((const __m128i *)p);                         \
+      unsigned m = ~(unsigned)_mm_movemask_epi8(mask(x)) & 0xffff;             \
+      if (m)                                                                   \
+        return p + __builtin_ctz(m);                                           \
+      p += 16;                                                                 \
+    }                                                                          \
+    return tail(p, end);                                                       \
+  }
+
+SCAN_SSE2(skipSpaceSSE2, spaceMask16, skipSpaceScalar)
+SCAN_SSE2(identEndSSE2, identMask16, identEndScalar)
+SCAN_SSE2(digitEndSSE2, digitMask16, digitEndScalar)
+
+static const LexOps SSE2Ops = {skipSpaceSSE2, identEndSSE2, digitEndSSE2};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i spaceMask32(__m256i x) {
+  __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+  __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+  return _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+}
+
+AVX2 static inline __m256i digitMask32(__m256i x) {
+  __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(9)), t);
+}
+
+AVX2 static inline __m256i identMask32(__m256i x) {
+  __m256i t = _mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+                              _mm256_set1_epi8('a'));
+  __m256i alpha =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+  __m256i under = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(alpha, under), digitMask32(x));
+}
+
+// 每次处理32个字节，剩余的字节交给SSE2路径
+#define SCAN_AVX2(name, mask, tail)                                            \
+  AVX2 static char *name(char *p, char *end) {                                 \
+    while (end - p >= 32) {                                                    \
+      __m256i x = _mm256_loadu_si256((const __m256i *)p);                      \
+      unsigned m = ~(unsigned)_mm256_movemask_epi8(mask(x));                   \
+      if (m)                                                                   \
+        return p + __builtin_ctz(m);                                           \
+      p += 32;                                                                 \
+    }                                                                          \
+    return tail(p, end);                                                       \
+  }
+
+SCAN_AVX2(skipSpaceAVX2, spaceMask32, skipSpaceSSE2)
+SCAN_AVX2(identEndAVX2, identMask32, identEndSSE2)
+SCAN_AVX2(digitEndAVX2, digitMask32, digitEndSSE2)
+
+static const LexOps AVX2Ops = {skipSpaceAVX2, identEndAVX2, digitEndAVX2};
+#endif
+
+// 当前使用的扫描函数，为空时在首次词法分析时按CPU自动选择
+static const LexOps *Lex;
+
 /**
- * @brief Get the Number object
- * @param  tok
- * @return int
+ * @brief 选择词法分析的扫描路径
+ * @param  path
+ * @return true 当前CPU支持该路径
+ * @return false 不支持，保持原有路径不变
  */
-static int getNumber(Token *tok) {
-  if (tok->kind != TK_NUM) {
-    errorTok(tok, "expected a number");
+bool setLexPath(LexPath path) {
+  switch (path) {
+  case LEX_SCALAR:
+    Lex = &ScalarOps;
+    return true;
+#if defined(__x86_64__)
+  case LEX_SSE2:
+    Lex = &SSE2Ops;
+    return true;
+  case LEX_AVX2:
+    if (!__builtin_cpu_supports("avx2"))
+      return false;
+    Lex = &AVX2Ops;
+    return true;
+  case LEX_AUTO:
+    Lex = __builtin_cpu_supports("avx2") ? &AVX2Ops : &SSE2Ops;
+    return true;
+#else
+  case LEX_AUTO:
+    Lex = &ScalarOps;
+    return true;
+#endif
+  default:
+    return false;
   }
+}
 
-  return tok->val;
+/**
+ * @brief 将[start, end)中的数字转换为整数，与strtoul的结果一致，溢出时为ULONG_MAX
+ * @param  start
+ * @param  end
+ * @return int
+ */
+static int readNumber(char *start, char *end) {
+  unsigned long val = 0;
+  for (char *p = start; p < end; ++p) {
+    unsigned long d = *p - '0';
+    if (val > (ULONG_MAX - d) / 10) {
+      val = ULONG_MAX;
+      break;
+    }
+    val = val * 10 + d;
+  }
+  return val;
 }
 
 /**
- * @brief  判断str是否以sub_str开头
- * @param  str
- * @param  sub_str
- * @return true false
+ * @brief Get the Number object
+ * @param  tok
+ * @return int
  */
-static bool startsWith(char *str, char *sub_str) {
-  return strncmp(str, sub_str, strlen(sub_str)) == 0;
+static int getNumber(TokenId tok) {
+  if (tokKind(tok) != TK_NUM) {
+    errorTok(tok, "expected a number");
+  }
+
+  return tokVal(tok);
 }
 
 /**
  * @brief 判断运算符
  * @param  p
+ * @param  end
  * @return int
  */
-static int readPunct(char *p) {
+static int readPunct(char *p, char *end) {
   // 2字符运算符
-  if (startsWith(p, "==") || startsWith(p, "!=") || startsWith(p, "<=") ||
-      startsWith(p, ">=")) {
+  if (end - p >= 2 && p[1] == '=' &&
+      (p[0] == '=' || p[0] == '!' || p[0] == '<' || p[0] == '>')) {
     return 2;
   }
 
@@ -165,7 +553,7 @@ static int readPunct(char *p) {
 }
 
 static char *kwrods[] = {"return", "if", "else", "for"};
-static bool isKeyword(Token *tok) { 
+static bool isKeyword(TokenId tok) { 
     for (int i = 0; i < sizeof(kwrods) / sizeof(*kwrods); i++) {
         if (equal(tok, kwrods[i])) {
             return true;
@@ -175,69 +563,250 @@ static bool isKeyword(Token *tok) {
     return false;
 }
 
+/* 输入 */
+
+// 流式读取时窗口的初始容量
+#define STREAM_CHUNK (64 << 10)
+// 映射的输入中，已释放的部分积累到该大小后解除映射
+#define MMAP_RELEASE (1 << 20)
 
 /**
- * @brief 标记关键字终结符
- * @param  tok
+ * @brief 关闭上一次编译的输入
+ */
+static void closeSource(void) {
+  if (Src.kind == SRC_MMAP)
+    munmap(Tokens.text + Src.dropped, Src.mapLen - Src.dropped);
+  if (Src.kind == SRC_STREAM)
+    free(Tokens.text);
+  if (Src.fd > 0)
+    close(Src.fd);
+  Src = (Source){0};
+}
+
+/**
+ * @brief 开始分析新的输入，text为输入在内存中的窗口
+ * @param  kind
+ * @param  name
+ * @param  text
+ * @param  len
+ * @return TokenId 第一个Token的编号
  */
-static void convertKeywords(Token *tok) {
-  for (Token *t = tok; t->kind != TK_EOF; t = t->next) {
-    if (isKeyword(t)) {
-      t->kind = TK_KEYWORD;
+static TokenId openSource(SourceKind kind, char *name, char *text, size_t len) {
+  Src.kind = kind;
+  Src.name = name;
+  Src.cur = text;
+  Src.end = text + len;
+  Src.eof = kind != SRC_STREAM;
+  Src.line = 1;
+  Lines.len = Lines.scanned = 0;
+  if (!Lines.cap) {
+    Lines.cap = 64;
+    Lines.starts = malloc(Lines.cap * sizeof(*Lines.starts));
+    if (!Lines.starts)
+      error("out of memory");
+  }
+  Lines.starts[Lines.len++] = 0;
+  Tokens.text = text;
+  Tokens.textBase = 0;
+  Tokens.base = Tokens.len = Tokens.numLen = 0;
+  if (!Lex)
+    setLexPath(LEX_AUTO);
+  return 0;
+}
+
+/**
+ * @brief 流式读取时读入更多输入，窗口中检查点之前的字符被丢弃
+ * @return true 读入了新的字符
+ * @return false 输入已结束
+ */
+static bool refill(void) {
+  if (Src.eof)
+    return false;
+
+  // 丢弃已释放的行，空间仍不足一半时扩大窗口
+  size_t used = Src.end - Tokens.text;
+  if (Src.cap - used < Src.cap / 2) {
+    size_t drop = Src.lineOff - Tokens.textBase;
+    size_t cur = Src.cur - Tokens.text - drop;
+    memmove(Tokens.text, Tokens.text + drop, used - drop);
+    used -= drop;
+    Tokens.textBase += drop;
+    if (Src.cap - used < Src.cap / 2) {
+      Src.cap *= 2;
+      Tokens.text = realloc(Tokens.text, Src.cap);
+      if (!Tokens.text)
+        error("out of memory");
     }
+    Src.cur = Tokens.text + cur;
+    Src.end = Tokens.text + used;
+  }
+
+  ssize_t n;
+  while ((n = read(Src.fd, Src.end, Src.cap - used)) < 0) {
+    if (errno != EINTR)
+      error("%s: %s", Src.name, strerror(errno));
   }
+  if ((uint64_t)Tokens.textBase + used + n > UINT32_MAX)
+    error("%s: input too large", Src.name);
+  Src.end += n;
+  Src.eof = n == 0;
+  return n > 0;
 }
 
 /**
- * @brief 解析过程
- * @param  p
- * @return Token*
- */
-Token *tokenize(char *p) {
-  current_input = p;
-  Token head = {};
-  Token *cur = &head;
-  while (*p) {
-    if (isspace(*p)) {
-      ++p;
-      continue;
+ * @brief 分析下一个Token
+ * Token可能被窗口截断，此时读入更多输入后重新分析
+ */
+static void lexToken(void) {
+  for (;;) {
+    char *p = Lex->skipSpace(Src.cur, Src.end);
+    Src.cur = p;
+    if (p == Src.end) {
+      if (refill())
+        continue;
+      // 解析结束
+      newToken(TK_EOF, p, p);
+      Src.done = true;
+      return;
     }
 
-    // 解析数字
+    TokenKind kind;
+    char *q;
     if (isdigit(*p)) {
-      cur = cur->next = newToken(TK_NUM, p, p);
-      const char *old_p = p;
-      cur->val = strtoul(p, &p, 10);
-      cur->len = p - old_p;
-      continue;
+      // 解析数字
+      kind = TK_NUM;
+      q = Lex->digitEnd(p + 1, Src.end);
+    } else if (isIdent1(*p)) {
+      // 解析标记符或关键字
+      kind = TK_IDENT;
+      q = Lex->identEnd(p + 1, Src.end);
+    } else {
+      // 解析符号，需要看到下一个字符才能判断2字符运算符
+      if (Src.end - p < 2 && refill())
+        continue;
+      int punct_len = readPunct(p, Src.end);
+      if (!punct_len)
+        errorAt(p, "invalid token");
+      kind = TK_PUNCT;
+      q = p + punct_len;
     }
-
-    // 解析标记符或关键字
-    if (isIdent1(*p)) {
-      char *start = p;
-      do {
-        ++p;
-      } while (isIdent2(*p));
-      cur = cur->next = newToken(TK_IDENT, start, p);
+    if (q == Src.end && kind != TK_PUNCT && refill())
       continue;
-    }
 
-    // 解析符号
-    int punct_len = readPunct(p);
-    if (punct_len) {
-      cur = cur->next = newToken(TK_PUNCT, p, p + punct_len);
-      p += punct_len;
-      continue;
-    }
+    TokenId tok = newToken(kind, p, q);
+    if (kind == TK_NUM)
+      addNumVal(tok, readNumber(p, q));
+    // 标记关键字终结符
+    if (kind == TK_IDENT && isKeyword(tok))
+      Tokens.kinds[tok - Tokens.base] = TK_KEYWORD;
+    Src.cur = q;
+    return;
+  }
+}
+
+/**
+ * @brief 按需词法分析，直到编号为tok的Token
+ * EOF之后的编号都对应EOF Token
+ * @param  tok
+ * @return uint32_t tok在数组中的下标
+ */
+uint32_t lexUntil(TokenId tok) {
+  if (tok < Tokens.base)
+    error("internal error: token %u already released", tok);
+  while (tok - Tokens.base >= Tokens.len) {
+    if (Src.done)
+      return Tokens.len - 1;
+    lexToken();
+  }
+  return tok - Tokens.base;
+}
 
-    errorAt(p, "invalid token");
+/**
+ * @brief 释放编号小于tok的Token，之后不再访问它们
+ * 检查点移动到tok所在的行首，之前的输入不再保留
+ * @param  tok
+ */
+void releaseTokens(TokenId tok) {
+  TokenStream *ts = &Tokens;
+  uint32_t n = tok - ts->base;
+  if (n > ts->len)
+    n = ts->len;
+  uint32_t loc = n < ts->len ? ts->locs[n]
+                             : ts->textBase + (uint32_t)(Src.cur - ts->text);
+  memmove(ts->kinds, ts->kinds + n, (ts->len - n) * sizeof(*ts->kinds));
+  memmove(ts->locs, ts->locs + n, (ts->len - n) * sizeof(*ts->locs));
+  memmove(ts->lens, ts->lens + n, (ts->len - n) * sizeof(*ts->lens));
+  ts->len -= n;
+  ts->base += n;
+
+  uint32_t k = 0;
+  while (k < ts->numLen && ts->numToks[k] < ts->base)
+    k++;
+  memmove(ts->numToks, ts->numToks + k, (ts->numLen - k) * sizeof(*ts->numToks));
+  memmove(ts->numVals, ts->numVals + k, (ts->numLen - k) * sizeof(*ts->numVals));
+  ts->numLen -= k;
+
+  // 移动检查点，丢弃之前的行首
+  uint32_t line = lineIndex(ts->text + (loc - ts->textBase));
+  Lines.len -= line;
+  memmove(Lines.starts, Lines.starts + line, Lines.len * sizeof(*Lines.starts));
+  Src.line += line;
+  Src.lineOff = Lines.starts[0];
+
+  // 映射的输入中，检查点之前的页不再访问，解除映射
+  if (Src.kind == SRC_MMAP && Src.lineOff - Src.dropped >= MMAP_RELEASE) {
+    uint32_t end = Src.lineOff & ~(uint32_t)(sysconf(_SC_PAGESIZE) - 1);
+    munmap(ts->text + Src.dropped, end - Src.dropped);
+    Src.dropped = end;
   }
+}
+
+/**
+ * @brief 开始分析内存中的字符串
+ * @param  p
+ * @return TokenId
+ */
+TokenId tokenize(char *p) {
+  closeSource();
+  return openSource(SRC_STRING, "<input>", p, strlen(p));
+}
 
-  // 解析结束
-  cur->next = newToken(TK_EOF, p, p);
+/**
+ * @brief 开始分析文件，path为"-"时读取标准输入
+ * 普通文件映射到内存，其他文件通过窗口分段读入
+ * @param  path
+ * @return TokenId
+ */
+TokenId tokenizeFile(char *path) {
+  closeSource();
+  bool isStdin = !strcmp(path, "-");
+  char *name = isStdin ? "<stdin>" : path;
+  int fd = isStdin ? 0 : open(path, O_RDONLY);
+  if (fd < 0)
+    error("cannot open %s: %s", path, strerror(errno));
 
-  // 标记关键字终结符
-  convertKeywords(head.next);
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    error("%s: %s", name, strerror(errno));
+  if (S_ISREG(st.st_mode) && st.st_size > UINT32_MAX)
+    error("%s: input too large", name);
 
-  return head.next;
-}
\ No newline at end of file
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text != MAP_FAILED) {
+      posix_madvise(text, st.st_size, POSIX_MADV_SEQUENTIAL);
+      TokenId tok = openSource(SRC_MMAP, name, text, st.st_size);
+      Src.fd = fd;
+      Src.mapLen = st.st_size;
+      return tok;
+    }
+  }
+
+  char *text = malloc(STREAM_CHUNK);
+  if (!text)
+    error("out of memory");
+  TokenId tok = openSource(SRC_STREAM, name, text, 0);
+  Src.fd = fd;
+  Src.cap = STREAM_CHUNK;
+  return tok;
+}
@@ -0,0 +1,78 @@
+// 编译服务器的客户端：将程序发送到 rvcc --server=PATH，输出汇编代码
+// 用法：./rvcc-client PATH 程序...
+// 汇编代码写到标准输出，诊断信息写到标准错误，有程序编译失败时返回1
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// 系统调用失败
+static void fatal(char *msg) {
+  fprintf(stderr, "rvcc-client: %s: %s\n", msg, strerror(errno));
+  exit(1);
+}
+
+// 应答格式错误
+static void badReply(void) {
+  fprintf(stderr, "rvcc-client: invalid reply from server\n");
+  exit(1);
+}
+
+// 从应答中读取len字节写到out
+static void copyN(FILE *in, FILE *out, size_t len) {
+  char buf[4096];
+  while (len) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    if (fread(buf, 1, n, in) != n)
+      badReply();
+    fwrite(buf, 1, n, out);
+    len -= n;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s PATH PROGRAM...\n", argv[0]);
+    return 1;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "rvcc-client: socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, argv[1]);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    fatal("socket");
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    fatal(argv[1]);
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  if (!in || !out)
+    fatal("fdopen");
+
+  // 每发送一个请求，读取它的应答
+  int ret = 0;
+  for (int i = 2; i < argc; i++) {
+    fprintf(out, "%zu\n%s", strlen(argv[i]), argv[i]);
+    fflush(out);
+
+    int status;
+    size_t asmLen, diagLen;
+    if (fscanf(in, "%d %zu %zu", &status, &asmLen, &diagLen) != 3 ||
+        fgetc(in) != '\n')
+      badReply();
+    copyN(in, stdout, asmLen);
+    copyN(in, stderr, diagLen);
+    if (status)
+      ret = 1;
+  }
+  return ret;
+}
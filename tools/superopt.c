@@ -0,0 +1,971 @@
+// 超优化器：对由+、-、*、取负和比较组成的小表达式树，枚举RV64IM指令序列，
+// 找出指令数最少（其次延迟最小）的等价序列，输出代码生成查询的表
+// 用法：./superopt > superopt.inc，即make superopt-table
+//
+// 表达式树最多3个运算节点，叶子为变量x、y和至多一个常量，3个运算节点的树
+// 只有变量；比较只在树的根部。变量按首次出现的顺序命名，满足交换律的运算
+// 取字典序最小的形式。计算相同函数的树分为一个等价类，共用找到的序列。
+// 指令序列的值为符号扩展到64位的int，只使用结果仍符号扩展的指令，
+// 因此可以按32位模拟。候选序列先按一组输入的输出值匹配，再用初步检查的输入
+// 比较，最后验证两个变量在0附近和INT_MIN、INT_MAX附近的所有组合，
+// 以及更多的随机输入，覆盖溢出的情况；验证失败的反例加入初步检查的输入。
+// 只输出比代码生成中的指令选择指令更少的序列，子树中有多余运算的树
+// （如x - x）属于代数化简，不输出。
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 表达式树 */
+
+typedef enum {
+  T_X,
+  T_Y,
+  T_NUM,
+  T_NEG,
+  T_ADD,
+  T_SUB,
+  T_MUL,
+  T_EQ,
+  T_NE,
+  T_LT,
+  T_LE,
+} TreeKind;
+
+typedef struct Tree Tree;
+struct Tree {
+  TreeKind kind;
+  int val;       // T_NUM的值
+  int numConsts; // 子树中常量的数量
+  int ops;       // 子树中运算节点的数量
+  Tree *lhs;
+  Tree *rhs;
+};
+
+// 叶子中的常量
+static int Consts[] = {-1, 0, 1, 2, 3, 4, 5, 8, 10};
+#define NUM_CONSTS (int)(sizeof(Consts) / sizeof(*Consts))
+
+// 运算节点的最大数量
+#define MAX_OPS 3
+
+// 按运算节点的数量存储所有的树
+static Tree **Trees[MAX_OPS + 1];
+static int NumTrees[MAX_OPS + 1];
+static int CapTrees[MAX_OPS + 1];
+
+static Tree *newTree(TreeKind kind, int val, Tree *lhs, Tree *rhs) {
+  Tree *t = calloc(1, sizeof(Tree));
+  t->kind = kind;
+  t->val = val;
+  t->lhs = lhs;
+  t->rhs = rhs;
+  t->numConsts = (kind == T_NUM) + (lhs ? lhs->numConsts : 0) +
+                 (rhs ? rhs->numConsts : 0);
+  t->ops = (kind > T_NUM) + (lhs ? lhs->ops : 0) + (rhs ? rhs->ops : 0);
+  return t;
+}
+
+static void addTree(int ops, Tree *t) {
+  if (NumTrees[ops] == CapTrees[ops]) {
+    CapTrees[ops] = CapTrees[ops] ? CapTrees[ops] * 2 : 64;
+    Trees[ops] = realloc(Trees[ops], CapTrees[ops] * sizeof(Tree *));
+  }
+  Trees[ops][NumTrees[ops]++] = t;
+}
+
+static bool isCompare(TreeKind kind) { return kind >= T_EQ; }
+
+static bool isCommutative(TreeKind kind) {
+  return kind == T_ADD || kind == T_MUL || kind == T_EQ || kind == T_NE;
+}
+
+/**
+ * @brief 生成所有的树，常量最多一个，常量不取负
+ * 比较的结果只在树的根部，不作为其他运算的操作数
+ */
+static void genTrees(void) {
+  addTree(0, newTree(T_X, 0, NULL, NULL));
+  addTree(0, newTree(T_Y, 0, NULL, NULL));
+  for (int i = 0; i < NUM_CONSTS; i++)
+    addTree(0, newTree(T_NUM, Consts[i], NULL, NULL));
+
+  for (int ops = 1; ops <= MAX_OPS; ops++) {
+    for (int i = 0; i < NumTrees[ops - 1]; i++) {
+      Tree *t = Trees[ops - 1][i];
+      if (t->kind != T_NUM && !isCompare(t->kind) &&
+          (ops < MAX_OPS || !t->numConsts))
+        addTree(ops, newTree(T_NEG, 0, t, NULL));
+    }
+    for (int l = 0; l < ops; l++) {
+      int r = ops - 1 - l;
+      for (int i = 0; i < NumTrees[l]; i++) {
+        for (int j = 0; j < NumTrees[r]; j++) {
+          Tree *a = Trees[l][i], *b = Trees[r][j];
+          // 最大的树只由变量组成
+          int consts = a->numConsts + b->numConsts;
+          if (consts > 1 || (ops == MAX_OPS && consts) ||
+              isCompare(a->kind) || isCompare(b->kind))
+            continue;
+          for (TreeKind k = T_ADD; k <= T_LE; k++)
+            addTree(ops, newTree(k, 0, a, b));
+        }
+      }
+    }
+  }
+}
+
+static int32_t wrap(int64_t v) { return (int32_t)(uint32_t)v; }
+
+static int32_t evalTree(Tree *t, int32_t x, int32_t y) {
+  switch (t->kind) {
+  case T_X:
+    return x;
+  case T_Y:
+    return y;
+  case T_NUM:
+    return t->val;
+  case T_NEG:
+    return wrap(-(int64_t)evalTree(t->lhs, x, y));
+  default:
+    break;
+  }
+  int64_t a = evalTree(t->lhs, x, y), b = evalTree(t->rhs, x, y);
+  switch (t->kind) {
+  case T_ADD:
+    return wrap(a + b);
+  case T_SUB:
+    return wrap(a - b);
+  case T_MUL:
+    return wrap(a * b);
+  case T_EQ:
+    return a == b;
+  case T_NE:
+    return a != b;
+  case T_LT:
+    return a < b;
+  default:
+    return a <= b;
+  }
+}
+
+/* 规范形式 */
+
+static char *OpNames[] = {
+    [T_NEG] = "neg", [T_ADD] = "+", [T_SUB] = "-",  [T_MUL] = "*",
+    [T_EQ] = "==",   [T_NE] = "!=", [T_LT] = "<",   [T_LE] = "<=",
+};
+
+// 序列化时的状态：交换律运算是否交换操作数，变量的命名
+typedef struct {
+  int mask;  // 按前序第i个满足交换律的运算交换操作数
+  int nth;   // 已经过的满足交换律的运算数量
+  int names; // 已命名的变量数量
+  int name[2]; // T_X、T_Y的名称，-1为未命名
+} Canon;
+
+static void serialize(Tree *t, Canon *c, char *buf) {
+  switch (t->kind) {
+  case T_X:
+  case T_Y: {
+    int v = t->kind - T_X;
+    if (c->name[v] < 0)
+      c->name[v] = c->names++;
+    strcat(buf, c->name[v] ? "y" : "x");
+    return;
+  }
+  case T_NUM:
+    sprintf(buf + strlen(buf), "%d", t->val);
+    return;
+  case T_NEG:
+    strcat(buf, "(neg ");
+    serialize(t->lhs, c, buf);
+    strcat(buf, ")");
+    return;
+  default:
+    break;
+  }
+  bool swap = isCommutative(t->kind) && (c->mask >> c->nth++ & 1);
+  sprintf(buf + strlen(buf), "(%s ", OpNames[t->kind]);
+  serialize(swap ? t->rhs : t->lhs, c, buf);
+  strcat(buf, " ");
+  serialize(swap ? t->lhs : t->rhs, c, buf);
+  strcat(buf, ")");
+}
+
+static int countCommutative(Tree *t) {
+  if (!t || t->kind < T_NEG)
+    return 0;
+  return isCommutative(t->kind) + countCommutative(t->lhs) +
+         countCommutative(t->rhs);
+}
+
+/**
+ * @brief 规范形式：交换律运算的各种交换中字典序最小的序列化结果
+ * 与代码生成中的superoptKey一致
+ * @param  t
+ * @param  key
+ * @return bool 树中的y先于x出现，变量需交换
+ */
+static bool canonical(Tree *t, char *key) {
+  int n = countCommutative(t);
+  bool swapXY = false;
+  key[0] = '\0';
+  for (int mask = 0; mask < 1 << n; mask++) {
+    char buf[48] = "";
+    Canon c = {mask, 0, 0, {-1, -1}};
+    serialize(t, &c, buf);
+    if (!key[0] || strcmp(buf, key) < 0) {
+      strcpy(key, buf);
+      swapXY = c.name[1] == 0;
+    }
+  }
+  return swapXY;
+}
+
+/* 指令序列 */
+
+// 寄存器：0为zero，1、2为x、y，之后为序列中各指令的结果
+#define MAX_LEN 3
+#define NUM_REGS (3 + MAX_LEN)
+
+typedef enum {
+  // 寄存器-寄存器
+  I_ADDW,
+  I_SUBW,
+  I_MULW,
+  I_SLT,
+  I_SLTU,
+  I_XOR,
+  I_OR,
+  I_AND,
+  // 寄存器-立即数
+  I_ADDIW,
+  I_SLTI,
+  I_SLTIU,
+  I_XORI,
+  I_ORI,
+  I_ANDI,
+  // 移位
+  I_SLLIW,
+  I_SRLIW,
+  I_SRAIW,
+  I_NUM,
+} InsnOp;
+
+static char *InsnNames[] = {
+    "addw", "subw", "mulw", "slt",   "sltu", "xor",   "or",    "and",   "addiw",
+    "slti", "sltiu", "xori", "ori", "andi", "slliw", "srliw", "sraiw",
+};
+
+typedef struct {
+  InsnOp op;
+  int a;   // 第一个源寄存器
+  int b;   // 第二个源寄存器
+  int imm; // 立即数
+} Insn;
+
+static bool isRegOp(InsnOp op) { return op <= I_AND; }
+static bool isShift(InsnOp op) { return op >= I_SLLIW; }
+
+static int32_t evalInsn(InsnOp op, int32_t a, int32_t b, int imm) {
+  uint32_t ua = a, ub = b;
+  switch (op) {
+  case I_ADDW:
+    return (int32_t)(ua + ub);
+  case I_SUBW:
+    return (int32_t)(ua - ub);
+  case I_MULW:
+    return (int32_t)(ua * ub);
+  case I_SLT:
+    return a < b;
+  case I_SLTU:
+    return ua < ub;
+  case I_XOR:
+    return a ^ b;
+  case I_OR:
+    return a | b;
+  case I_AND:
+    return a & b;
+  case I_ADDIW:
+    return (int32_t)(ua + (uint32_t)imm);
+  case I_SLTI:
+    return a < imm;
+  case I_SLTIU:
+    return ua < (uint32_t)imm;
+  case I_XORI:
+    return a ^ imm;
+  case I_ORI:
+    return a | imm;
+  case I_ANDI:
+    return a & imm;
+  case I_SLLIW:
+    return (int32_t)(ua << imm);
+  case I_SRLIW:
+    return (int32_t)(ua >> imm);
+  case I_SRAIW:
+    return a >> imm;
+  default:
+    abort();
+  }
+}
+
+static int32_t evalSeq(Insn *seq, int len, int32_t x, int32_t y) {
+  int32_t r[NUM_REGS] = {0, x, y};
+  for (int i = 0; i < len; i++)
+    r[3 + i] = evalInsn(seq[i].op, r[seq[i].a], r[seq[i].b], seq[i].imm);
+  return r[2 + len];
+}
+
+// 延迟：乘法4个周期，其他1个周期，与cost.c中rocket的模型一致
+static int insnLatency(InsnOp op) { return op == I_MULW ? 4 : 1; }
+
+/**
+ * @brief 序列的关键路径长度，从x、y就绪开始
+ * @param  seq
+ * @param  len
+ * @return int
+ */
+static int seqLatency(Insn *seq, int len) {
+  int ready[NUM_REGS] = {0};
+  for (int i = 0; i < len; i++) {
+    int t = ready[seq[i].a];
+    if (isRegOp(seq[i].op) && ready[seq[i].b] > t)
+      t = ready[seq[i].b];
+    ready[3 + i] = t + insnLatency(seq[i].op);
+  }
+  return ready[2 + len];
+}
+
+// 序列读取的变量，第0位为x，第1位为y
+static int seqUses(Insn *seq, int len) {
+  int uses = 0;
+  for (int i = 0; i < len; i++) {
+    for (int k = 0; k < 2; k++) {
+      int r = k ? seq[i].b : seq[i].a;
+      if (k && !isRegOp(seq[i].op))
+        break;
+      if (r == 1 || r == 2)
+        uses |= 1 << (r - 1);
+    }
+  }
+  return uses;
+}
+
+/* 代码生成中指令选择的模型 */
+
+// 与codegen.c中genExprNode、genImmOp、genBinOp一致：
+// 每次出现的变量都以lw装入，常量在12位以内时使用立即数指令
+
+static bool isImm(int64_t v) { return v >= -2048 && v <= 2047; }
+
+static bool isPow2(int v) { return v > 0 && !(v & (v - 1)); }
+
+/**
+ * @brief 一侧为常量的运算的指令数
+ * @return int 不能使用立即数指令时返回-1
+ */
+static int immCost(TreeKind kind, int64_t c, bool left) {
+  switch (kind) {
+  case T_ADD:
+    return isImm(c) ? 1 : -1;
+  case T_SUB:
+    return left ? (isImm(c) ? 1 + (c != 0) : -1) : (isImm(-c) ? 1 : -1);
+  case T_MUL:
+    if (c == 0 || c == -1)
+      return 1;
+    return isPow2(c) ? c > 1 : -1;
+  case T_EQ:
+  case T_NE:
+    return isImm(c) ? 1 + (c != 0) : -1;
+  case T_LT:
+  case T_LE: {
+    int64_t bound = left != (kind == T_LE) ? c + 1 : c;
+    return isImm(bound) ? 1 + left : -1;
+  }
+  default:
+    return -1;
+  }
+}
+
+static int binCost(TreeKind kind) {
+  return kind == T_EQ || kind == T_NE || kind == T_LE ? 2 : 1;
+}
+
+static bool isLeaf(Tree *t) { return t->kind <= T_NUM; }
+
+/**
+ * @brief 指令选择生成的指令数
+ * @param  t
+ * @return int
+ */
+static int naiveCost(Tree *t) {
+  switch (t->kind) {
+  case T_X:
+  case T_Y:
+  case T_NUM:
+    return 1;
+  case T_NEG:
+    return naiveCost(t->lhs) + 1;
+  default:
+    break;
+  }
+
+  if (t->lhs->kind == T_NUM || t->rhs->kind == T_NUM) {
+    bool left = t->lhs->kind == T_NUM;
+    int c = left ? t->lhs->val : t->rhs->val;
+    int n = naiveCost(left ? t->rhs : t->lhs);
+    int k = immCost(t->kind, c, left);
+    // 不能使用立即数指令时，常量以li装入
+    return k >= 0 ? n + k : n + 1 + binCost(t->kind);
+  }
+
+  int n = naiveCost(t->lhs) + naiveCost(t->rhs) + binCost(t->kind);
+  // 两侧都不是叶子时经过栈：压栈、弹栈各两条指令
+  if (!isLeaf(t->lhs) && !isLeaf(t->rhs))
+    n += 4;
+  return n;
+}
+
+/* 搜索 */
+
+// 待搜索的树
+typedef struct Target Target;
+struct Target {
+  char key[48];
+  Tree *tree;
+  bool swapXY;    // 规范形式中x、y与树中相反
+  int naiveInsns; // 指令选择的指令数
+  int cls;        // 所属的等价类
+};
+
+// 初步检查用的输入，开始时有NUM_CHECK个，验证失败时加入反例
+#define NUM_CHECK 64
+#define MAX_CHECK 512
+static int32_t CheckX[MAX_CHECK], CheckY[MAX_CHECK];
+static int NumChecks;
+
+// 等价类：计算相同函数的树，共用找到的序列
+typedef struct Class Class;
+struct Class {
+  Target *rep;   // 代表的树
+  int maxNaive;  // 各树中指令选择的最多指令数
+  int bestInsns; // 找到的最好序列的指令数（包括装入变量），0为未找到
+  int bestLat;
+  int bestLen;
+  Insn best[MAX_LEN];
+  int32_t check[MAX_CHECK]; // 初步检查的输入上的输出值
+  int next; // 匹配输入上输出值相同的下一个等价类
+};
+
+static Target *Targets;
+static int NumTargets;
+static Class *Classes;
+static int NumClasses;
+
+// 匹配用的输入
+#define NUM_VEC 8
+static int32_t VecX[NUM_VEC] = {0, 1, -1, 7, -100, 2147483647, 123456, -9};
+static int32_t VecY[NUM_VEC] = {3, -5, 2, 7, 99, -2147483647 - 1, 1000, -9};
+
+// 按输出值索引等价类，开放定址
+static int *Buckets;
+static uint64_t *BucketKeys;
+static int NumBuckets;
+
+static uint64_t hashVec(int32_t *v, int n) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+  for (int i = 0; i < n; i++)
+    h = (h ^ (uint32_t)v[i]) * 0xff51afd7ed558ccdULL;
+  return h ^ (h >> 29);
+}
+
+static int *findBucket(uint64_t h) {
+  for (int i = h & (NumBuckets - 1);; i = (i + 1) & (NumBuckets - 1)) {
+    if (Buckets[i] < 0 || BucketKeys[i] == h) {
+      BucketKeys[i] = h;
+      return &Buckets[i];
+    }
+  }
+}
+
+static int32_t evalTarget(Target *t, int32_t x, int32_t y) {
+  return t->swapXY ? evalTree(t->tree, y, x) : evalTree(t->tree, x, y);
+}
+
+// 验证用的取值：0附近，INT_MIN、INT_MAX附近，以及2的幂和它们的相邻值、
+// 相反数，乘法溢出后低位为0的情况（如65536 * 65536）由后者覆盖
+static int32_t Domain[256];
+static int DomainLen;
+
+static uint64_t Rng = 88172645463325252ULL;
+static uint32_t rnd(void) {
+  Rng ^= Rng << 13;
+  Rng ^= Rng >> 7;
+  Rng ^= Rng << 17;
+  return (uint32_t)Rng;
+}
+
+// 待验证的函数：一棵树或一个指令序列
+typedef struct {
+  Target *tree;
+  Insn *seq;
+  int len;
+} Func;
+
+static int32_t evalFunc(Func *f, int32_t x, int32_t y) {
+  return f->tree ? evalTarget(f->tree, x, y) : evalSeq(f->seq, f->len, x, y);
+}
+
+// 最近一次验证失败的输入
+static int32_t FailX, FailY;
+
+static bool differ(Target *t, Func *f, int32_t x, int32_t y) {
+  if (evalFunc(f, x, y) == evalTarget(t, x, y))
+    return false;
+  FailX = x;
+  FailY = y;
+  return true;
+}
+
+/**
+ * @brief 验证函数与树在所有测试的输入上相同
+ * 先用初步检查的输入排除大部分不等价的函数，之后是两个变量在验证的取值中的
+ * 所有组合，以及更多的随机输入
+ * @param  t
+ * @param  f
+ * @return true
+ * @return false 不同时反例在FailX、FailY中
+ */
+static bool verify(Target *t, Func *f) {
+  for (int i = 0; i < NumChecks; i++)
+    if (differ(t, f, CheckX[i], CheckY[i]))
+      return false;
+  for (int i = 0; i < DomainLen; i++)
+    for (int j = 0; j < DomainLen; j++)
+      if (differ(t, f, Domain[i], Domain[j]))
+        return false;
+  // 每次验证使用相同的随机输入
+  uint64_t saved = Rng;
+  bool ok = true;
+  for (int i = 0; i < 4000 && ok; i++) {
+    // 随机的值，三分之一为小的值，三分之一的低位为0
+    int32_t x = rnd(), y = rnd();
+    if (i % 3 == 1) {
+      x = (int32_t)x >> 20;
+      y = (int32_t)y >> 20;
+    } else if (i % 3 == 2) {
+      x = (uint32_t)x << (rnd() & 31);
+      y = (uint32_t)y << (rnd() & 31);
+    }
+    ok = !differ(t, f, x, y);
+  }
+  Rng = saved;
+  return ok;
+}
+
+/**
+ * @brief 把反例加入初步检查的输入，之后匹配相同的函数时不再需要完整的验证
+ * 代表等价类的树比指令序列少得多，逐个计算它们在反例上的输出值
+ * @param  x
+ * @param  y
+ */
+static void addCheck(int32_t x, int32_t y) {
+  if (NumChecks == MAX_CHECK)
+    return;
+  for (int i = 0; i < NumClasses; i++)
+    Classes[i].check[NumChecks] = evalTarget(Classes[i].rep, x, y);
+  CheckX[NumChecks] = x;
+  CheckY[NumChecks] = y;
+  NumChecks++;
+}
+
+// 验证的次数，用于报告
+static long NumVerified;
+
+/**
+ * @brief 序列的输出值与某些等价类相同，验证后记录更好的序列
+ * @param  seq
+ * @param  len
+ * @param  out 在匹配输入上的输出值
+ */
+static void tryMatch(Insn *seq, int len, int32_t *out) {
+  int *b = findBucket(hashVec(out, NUM_VEC));
+  if (*b < 0)
+    return;
+  // 每个读取的变量装入一次，之后执行序列
+  int uses = seqUses(seq, len);
+  int loads = (uses & 1) + (uses >> 1 & 1);
+  int insns = loads + len;
+  int lat = (loads ? 2 : 0) + seqLatency(seq, len);
+  int32_t check[MAX_CHECK];
+  int checked = 0;
+  for (int i = *b; i >= 0; i = Classes[i].next) {
+    Class *c = &Classes[i];
+    // 不比指令选择好，或不比已找到的序列好
+    if (insns > c->maxNaive)
+      continue;
+    if (c->bestInsns && (c->bestInsns < insns ||
+                         (c->bestInsns == insns && c->bestLat <= lat)))
+      continue;
+    // 先比较初步检查的输入上的输出值
+    for (; checked < NumChecks; checked++)
+      check[checked] = evalSeq(seq, len, CheckX[checked], CheckY[checked]);
+    if (memcmp(check, c->check, NumChecks * sizeof(int32_t)))
+      continue;
+    NumVerified++;
+    if (!verify(c->rep, &(Func){.seq = seq, .len = len})) {
+      addCheck(FailX, FailY);
+      continue;
+    }
+    c->bestInsns = insns;
+    c->bestLat = lat;
+    c->bestLen = len;
+    memcpy(c->best, seq, len * sizeof(Insn));
+  }
+}
+
+// 立即数
+static int Imms[64];
+static int NumImms;
+static int Shifts[] = {1, 2, 3, 4, 31};
+#define NUM_SHIFTS (int)(sizeof(Shifts) / sizeof(*Shifts))
+
+static void addImm(int v) {
+  if (!isImm(v))
+    return;
+  for (int i = 0; i < NumImms; i++)
+    if (Imms[i] == v)
+      return;
+  Imms[NumImms++] = v;
+}
+
+// 当前枚举的序列和各寄存器在匹配输入上的值
+static Insn Seq[MAX_LEN];
+static int32_t Vals[NUM_REGS][NUM_VEC];
+
+/**
+ * @brief 枚举第pos条指令，之后递归
+ * 最后一条指令的结果为序列的值，每条指令的结果都需要被之后的指令使用
+ * @param  pos
+ * @param  len 序列的长度
+ */
+static void enumerate(int pos, int len) {
+  int numRegs = 3 + pos;
+  int dst = 3 + pos;
+  bool last = pos == len - 1;
+
+  for (InsnOp op = 0; op < I_NUM; op++) {
+    int numB = isRegOp(op) ? numRegs : 1;
+    int numImm = isRegOp(op) ? 1 : isShift(op) ? NUM_SHIFTS : NumImms;
+    for (int a = 0; a < numRegs; a++) {
+      for (int b = 0; b < numB; b++) {
+        // 满足交换律的运算只取一种顺序
+        if (isRegOp(op) && op != I_SUBW && op != I_SLT && op != I_SLTU &&
+            b < a)
+          continue;
+        for (int k = 0; k < numImm; k++) {
+          int imm = isRegOp(op) ? 0 : isShift(op) ? Shifts[k] : Imms[k];
+          // 最后一条指令需要使用上一条指令的结果，更早的结果在最后检查
+          if (last && pos > 0 && a != dst - 1 &&
+              (!isRegOp(op) || b != dst - 1))
+            continue;
+          // 不改变值的指令，只作为拷贝单独出现
+          if (!isRegOp(op) && !isShift(op) && imm == 0 && a != 0 &&
+              op != I_SLTI && op != I_SLTIU && op != I_ANDI && len > 1)
+            continue;
+
+          Seq[pos] = (Insn){op, a, b, imm};
+          for (int i = 0; i < NUM_VEC; i++)
+            Vals[dst][i] = evalInsn(op, Vals[a][i], Vals[b][i], imm);
+          if (!last) {
+            enumerate(pos + 1, len);
+            continue;
+          }
+
+          // 检查每条指令的结果都被使用
+          bool used[NUM_REGS] = {0};
+          for (int i = 0; i < len; i++) {
+            used[Seq[i].a] = true;
+            if (isRegOp(Seq[i].op))
+              used[Seq[i].b] = true;
+          }
+          bool dead = false;
+          for (int i = 0; i < len - 1; i++)
+            dead |= !used[3 + i];
+          if (!dead)
+            tryMatch(Seq, len, Vals[dst]);
+        }
+      }
+    }
+  }
+}
+
+/* 输出 */
+
+// 寄存器在代码生成中的名称：x在a1中，y在a2中，中间结果在a3、a4中，结果写入a0
+static char *regName(int r, int len) {
+  static char *names[] = {"zero", "a1", "a2", "a3", "a4", "a5"};
+  return r == 2 + len ? "a0" : names[r];
+}
+
+static void printInsn(Insn *in, int i, int len) {
+  char *rd = regName(3 + i, len), *ra = regName(in->a, len);
+  char *rb = regName(in->b, len);
+  // 使用伪指令的形式，只读取zero的指令为常量
+  if (in->a == 0 && (in->b == 0 || !isRegOp(in->op)))
+    printf("\"li %s, %d\"", rd, evalInsn(in->op, 0, 0, in->imm));
+  else if (in->op == I_ADDIW && in->imm == 0)
+    printf("\"mv %s, %s\"", rd, ra);
+  else if (in->op == I_SUBW && in->a == 0)
+    printf("\"negw %s, %s\"", rd, rb);
+  else if (in->op == I_SLTIU && in->imm == 1)
+    printf("\"seqz %s, %s\"", rd, ra);
+  else if (in->op == I_SLTU && in->a == 0)
+    printf("\"snez %s, %s\"", rd, rb);
+  else if (in->op == I_XORI && in->imm == -1)
+    printf("\"not %s, %s\"", rd, ra);
+  else if (isRegOp(in->op))
+    printf("\"%s %s, %s, %s\"", InsnNames[in->op], rd, ra, rb);
+  else
+    printf("\"%s %s, %s, %d\"", InsnNames[in->op], rd, ra, in->imm);
+}
+
+static int cmpTarget(const void *a, const void *b) {
+  return strcmp(((Target *)a)->key, ((Target *)b)->key);
+}
+
+// 按匹配和初步检查的输入上的输出值排序，相同的树可能属于同一个等价类
+typedef struct {
+  uint64_t hash;
+  int idx;
+} Print;
+
+static int cmpPrint(const void *a, const void *b) {
+  const Print *x = a, *y = b;
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->idx - y->idx;
+}
+
+// 树在匹配和初步检查的输入上的输出值
+static void evalOuts(Target *t, int32_t *out) {
+  for (int k = 0; k < NUM_VEC; k++)
+    out[k] = evalTarget(t, VecX[k], VecY[k]);
+  for (int k = 0; k < NUM_CHECK; k++)
+    out[NUM_VEC + k] = evalTarget(t, CheckX[k], CheckY[k]);
+}
+
+/**
+ * @brief 把树分为等价类，同一类的树都经过验证
+ */
+static void genClasses(void) {
+  Print *prints = calloc(NumTargets, sizeof(Print));
+  for (int i = 0; i < NumTargets; i++) {
+    int32_t out[NUM_VEC + NUM_CHECK];
+    evalOuts(&Targets[i], out);
+    prints[i] = (Print){hashVec(out, NUM_VEC + NUM_CHECK), i};
+  }
+  qsort(prints, NumTargets, sizeof(Print), cmpPrint);
+
+  Classes = calloc(NumTargets, sizeof(Class));
+  // first为输出值相同的一组树中第一个等价类
+  for (int i = 0, first = 0; i < NumTargets; i++) {
+    if (i && prints[i].hash != prints[i - 1].hash)
+      first = NumClasses;
+    Target *t = &Targets[prints[i].idx];
+    int32_t out[NUM_VEC + NUM_CHECK];
+    evalOuts(t, out);
+    // 与输出值相同的等价类比较
+    int c = first;
+    for (; c < NumClasses; c++) {
+      NumVerified++;
+      if (verify(Classes[c].rep, &(Func){.tree = t}))
+        break;
+    }
+    if (c == NumClasses) {
+      Classes[NumClasses++] = (Class){.rep = t};
+      memcpy(Classes[c].check, out + NUM_VEC, NUM_CHECK * sizeof(int32_t));
+    }
+    t->cls = c;
+    if (t->naiveInsns > Classes[c].maxNaive)
+      Classes[c].maxNaive = t->naiveInsns;
+  }
+  free(prints);
+
+  // 按匹配输入上的输出值建立索引
+  NumBuckets = 1;
+  while (NumBuckets < NumClasses * 2)
+    NumBuckets *= 2;
+  Buckets = malloc(NumBuckets * sizeof(int));
+  BucketKeys = malloc(NumBuckets * sizeof(uint64_t));
+  memset(Buckets, -1, NumBuckets * sizeof(int));
+  for (int i = NumClasses - 1; i >= 0; i--) {
+    int32_t out[NUM_VEC];
+    for (int k = 0; k < NUM_VEC; k++)
+      out[k] = evalTarget(Classes[i].rep, VecX[k], VecY[k]);
+    int *b = findBucket(hashVec(out, NUM_VEC));
+    Classes[i].next = *b;
+    *b = i;
+  }
+}
+
+/* 多余的运算 */
+
+// 所有的树（不重命名变量）按初步检查的输入上的输出值排序，
+// idx为运算节点数，输出值相同时运算少的在前
+static Print *Raw;
+static int NumRaw;
+
+static uint64_t rawHash(Tree *t) {
+  int32_t out[NUM_CHECK];
+  for (int k = 0; k < NUM_CHECK; k++)
+    out[k] = evalTree(t, CheckX[k], CheckY[k]);
+  return hashVec(out, NUM_CHECK);
+}
+
+static void genRaw(void) {
+  for (int ops = 0; ops <= MAX_OPS; ops++)
+    NumRaw += NumTrees[ops];
+  Raw = calloc(NumRaw, sizeof(Print));
+  int n = 0;
+  for (int ops = 0; ops <= MAX_OPS; ops++)
+    for (int i = 0; i < NumTrees[ops]; i++)
+      Raw[n++] = (Print){rawHash(Trees[ops][i]), ops};
+  qsort(Raw, NumRaw, sizeof(Print), cmpPrint);
+}
+
+/**
+ * @brief 计算与树相同的值最少需要的运算节点数
+ * 只比较初步检查的输入上的输出值，仅用于决定是否生成表项
+ * @param  t
+ * @return int
+ */
+static int minOps(Tree *t) {
+  uint64_t h = rawHash(t);
+  int lo = 0, hi = NumRaw;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (Raw[mid].hash < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return Raw[lo].idx;
+}
+
+/**
+ * @brief 树中没有多余的运算：每棵真子树都不能用更少的运算计算
+ * 如x - x、(x + y) - y这样的子树属于代数化简，不为它们生成表项
+ * @param  t
+ * @return true
+ * @return false
+ */
+static bool reduced(Tree *t) {
+  Tree *kids[] = {t->lhs, t->rhs};
+  for (int i = 0; i < 2; i++) {
+    Tree *s = kids[i];
+    if (s && s->ops && (minOps(s) < s->ops || !reduced(s)))
+      return false;
+  }
+  return true;
+}
+
+int main(void) {
+  genTrees();
+
+  // 去掉规范形式相同的树
+  int total = 0;
+  for (int ops = 1; ops <= MAX_OPS; ops++)
+    total += NumTrees[ops];
+  Targets = calloc(total, sizeof(Target));
+  for (int ops = 1; ops <= MAX_OPS; ops++) {
+    for (int i = 0; i < NumTrees[ops]; i++) {
+      Target *t = &Targets[NumTargets++];
+      t->tree = Trees[ops][i];
+      t->swapXY = canonical(t->tree, t->key);
+      t->naiveInsns = naiveCost(t->tree);
+    }
+  }
+  qsort(Targets, NumTargets, sizeof(Target), cmpTarget);
+  int n = 0;
+  for (int i = 0; i < NumTargets; i++)
+    if (!n || strcmp(Targets[i].key, Targets[n - 1].key))
+      Targets[n++] = Targets[i];
+  NumTargets = n;
+
+  // 初步检查：-3~3的所有组合，使相等、乘积等条件成立，其余为随机的值
+  for (int i = 0; i < NUM_CHECK; i++) {
+    CheckX[i] = i < 49 ? i % 7 - 3 : (int32_t)rnd();
+    CheckY[i] = i < 49 ? i / 7 - 3 : (int32_t)rnd() >> (i & 1 ? 0 : 24);
+  }
+  NumChecks = NUM_CHECK;
+  for (int i = -16; i < 16; i++)
+    Domain[DomainLen++] = i;
+  for (int i = 0; i < 16; i++) {
+    Domain[DomainLen++] = INT32_MIN + i;
+    Domain[DomainLen++] = INT32_MAX - i;
+  }
+  for (int k = 4; k < 31; k++) {
+    int32_t p = (int32_t)(1u << k);
+    int32_t vals[] = {p - 1, p, p + 1, -p - 1, -p, -p + 1};
+    for (int i = 0; i < 6; i++)
+      if (vals[i] < -16 || vals[i] >= 16)
+        Domain[DomainLen++] = vals[i];
+  }
+  genClasses();
+  genRaw();
+  fprintf(stderr, "superopt: %d trees, %d classes\n", NumTargets, NumClasses);
+
+  // 立即数：常量和相邻的值，及其相反数
+  for (int i = -1; i <= 1; i++)
+    addImm(i);
+  for (int i = 0; i < NUM_CONSTS; i++) {
+    addImm(Consts[i] - 1);
+    addImm(Consts[i]);
+    addImm(Consts[i] + 1);
+    addImm(-Consts[i]);
+  }
+
+  for (int k = 0; k < NUM_VEC; k++) {
+    Vals[0][k] = 0;
+    Vals[1][k] = VecX[k];
+    Vals[2][k] = VecY[k];
+  }
+  for (int len = 1; len <= MAX_LEN; len++) {
+    enumerate(0, len);
+    fprintf(stderr, "superopt: length %d searched, %ld verifications\n", len,
+            NumVerified);
+  }
+
+  // 输出比指令选择更好的序列
+  bool *emit = calloc(NumTargets, sizeof(bool));
+  int found = 0;
+  for (int i = 0; i < NumTargets; i++) {
+    Target *t = &Targets[i];
+    Class *c = &Classes[t->cls];
+    emit[i] = c->bestInsns && c->bestInsns < t->naiveInsns && reduced(t->tree);
+    found += emit[i];
+  }
+
+  printf("// 由tools/superopt.c生成，不要手动修改：make superopt-table\n");
+  printf("// %d棵表达式树，%d个等价类，%ld次验证，%d个更好的序列\n",
+         NumTargets, NumClasses, NumVerified, found);
+  printf("// 规范形式，节省的指令数，读取的变量（第0位为x），指令序列\n");
+  for (int i = 0; i < NumTargets; i++) {
+    if (!emit[i])
+      continue;
+    Target *t = &Targets[i];
+    Class *c = &Classes[t->cls];
+    printf("{\"%s\", %d, %d, {", t->key, t->naiveInsns - c->bestInsns,
+           seqUses(c->best, c->bestLen));
+    for (int k = 0; k < c->bestLen; k++) {
+      if (k)
+        printf(", ");
+      printInsn(&c->best[k], k, c->bestLen);
+    }
+    printf("}},\n");
+  }
+  return 0;
+}
@@ -0,0 +1,299 @@
+#include "rvcc.h"
+
+/* 循环展开 */
+
+// 循环次数可在编译期确定的for循环：for (i=start; i<end 等; i=i+step)
+typedef struct CountedLoop CountedLoop;
+struct CountedLoop {
+  Obj *iv;       // 归纳变量
+  int64_t start; // 初值
+  int64_t step;  // 步长，非0
+  int64_t trips; // 循环次数
+};
+
+/**
+ * @brief 判断是否为常量，允许负号
+ * @param  node
+ * @param  val
+ * @return true
+ * @return false
+ */
+static bool isConst(NodeId node, int64_t *val) {
+  if (nodeKind(node) == ND_NUM) {
+    *val = nodeVal(node);
+    return true;
+  }
+  if (nodeKind(node) == ND_NEG && isConst(nodeLhs(node), val)) {
+    *val = -*val;
+    return true;
+  }
+  return false;
+}
+
+static bool isVarNode(NodeId node, Obj *var) {
+  return nodeKind(node) == ND_VAR && nodeVar(node) == var;
+}
+
+/**
+ * @brief 判断子树中是否给变量赋值
+ * @param  node
+ * @param  var
+ * @return true
+ * @return false
+ */
+static bool assignsVar(NodeId node, Obj *var) {
+  if (!node)
+    return false;
+
+  switch (nodeKind(node)) {
+  case ND_NUM:
+  case ND_VAR:
+    return false;
+  case ND_IF:
+  case ND_FOR: {
+    NodeExt *e = nodeExt(node);
+    return assignsVar(e->cond, var) || assignsVar(e->then, var) ||
+           assignsVar(e->els, var) || assignsVar(e->init, var) ||
+           assignsVar(e->inc, var);
+  }
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++)
+      if (assignsVar(nodeBody(node, i), var))
+        return true;
+    return false;
+  case ND_ASSIGN:
+    if (isVarNode(nodeLhs(node), var))
+      return true;
+    break;
+  default:
+    break;
+  }
+  return assignsVar(nodeLhs(node), var) || assignsVar(nodeRhs(node), var);
+}
+
+/**
+ * @brief 识别循环次数为常量的for循环
+ * init为i=常量，inc为i=i+常量或i=i-常量，cond为i与常量的比较，
+ * 循环体内不给i赋值。i的值都在int范围内，展开前后语义一致
+ * @param  node
+ * @param  l
+ * @return true
+ * @return false
+ */
+static bool analyzeCountedLoop(NodeId node, CountedLoop *l) {
+  NodeId init = nodeInit(node), cond = nodeCond(node), inc = nodeInc(node);
+  if (!init || !cond || !inc || nodeKind(init) != ND_EXPR_STMT)
+    return false;
+
+  // init: i = start
+  NodeId assign = nodeLhs(init);
+  if (nodeKind(assign) != ND_ASSIGN || nodeKind(nodeLhs(assign)) != ND_VAR ||
+      !isConst(nodeRhs(assign), &l->start))
+    return false;
+  l->iv = nodeVar(nodeLhs(assign));
+
+  // inc: i = i + step, i = step + i, i = i - step
+  if (nodeKind(inc) != ND_ASSIGN || !isVarNode(nodeLhs(inc), l->iv))
+    return false;
+  NodeId rhs = nodeRhs(inc);
+  if (nodeKind(rhs) == ND_ADD && isVarNode(nodeLhs(rhs), l->iv) &&
+      isConst(nodeRhs(rhs), &l->step)) {
+  } else if (nodeKind(rhs) == ND_ADD && isVarNode(nodeRhs(rhs), l->iv) &&
+             isConst(nodeLhs(rhs), &l->step)) {
+  } else if (nodeKind(rhs) == ND_SUB && isVarNode(nodeLhs(rhs), l->iv) &&
+             isConst(nodeRhs(rhs), &l->step)) {
+    l->step = -l->step;
+  } else {
+    return false;
+  }
+  if (l->step == 0)
+    return false;
+
+  // cond: i < end, i <= end, i > end, i >= end
+  // `>`和`>=`解析时交换了操作数，为 end < i 和 end <= i
+  int64_t end;
+  bool ivLeft;
+  if (nodeKind(cond) != ND_LT && nodeKind(cond) != ND_LE)
+    return false;
+  if (isVarNode(nodeLhs(cond), l->iv) && isConst(nodeRhs(cond), &end))
+    ivLeft = true;
+  else if (isVarNode(nodeRhs(cond), l->iv) && isConst(nodeLhs(cond), &end))
+    ivLeft = false;
+  else
+    return false;
+  bool inclusive = nodeKind(cond) == ND_LE;
+
+  // 统一为 i < end 递增或 i > end 递减
+  if (ivLeft) {
+    if (l->step < 0)
+      return false;
+    if (inclusive)
+      end++;
+    l->trips = l->start < end ? (end - l->start + l->step - 1) / l->step : 0;
+  } else {
+    if (l->step > 0)
+      return false;
+    if (inclusive)
+      end--;
+    l->trips =
+        l->start > end ? (l->start - end - l->step - 1) / -l->step : 0;
+  }
+
+  // 归纳变量的所有取值都应在int范围内
+  int64_t last = l->start + l->trips * l->step;
+  if (last < INT32_MIN || last > INT32_MAX)
+    return false;
+
+  return !assignsVar(nodeThen(node), l->iv);
+}
+
+/**
+ * @brief 循环次数为常量的for循环的循环次数
+ * @param  node
+ * @return int64_t 不是这样的循环时为-1
+ */
+int64_t loopTrips(NodeId node) {
+  CountedLoop l;
+  return analyzeCountedLoop(node, &l) ? l.trips : -1;
+}
+
+/**
+ * @brief 将 times 份 {body; inc;} 追加到语句列表中
+ * @param  stmts
+ * @param  len
+ * @param  node
+ * @param  times
+ */
+static void appendIterations(NodeId *stmts, uint32_t *len, NodeId node,
+                             int64_t times) {
+  for (int64_t i = 0; i < times; i++) {
+    stmts[(*len)++] = copyNode(nodeThen(node));
+    NodeId inc = copyNode(nodeInc(node));
+    stmts[(*len)++] = newUnary(ND_EXPR_STMT, inc, nodeTok(node));
+  }
+}
+
+// 展开的循环数量，用于报告
+static int NumFull;
+static int NumPartial;
+
+/**
+ * @brief 尝试展开一个for循环，返回替换后的节点
+ * 循环次数较少时完全展开；否则按展开因子部分展开，
+ * 余下的 trips % factor 次迭代在循环前按顺序执行
+ * @param  node
+ * @return NodeId
+ */
+static NodeId unrollLoop(NodeId node) {
+  CountedLoop l;
+  if (!analyzeCountedLoop(node, &l))
+    return node;
+
+  TokenId tok = nodeTok(node);
+  int iterSize = countNodes(nodeThen(node)) + countNodes(nodeInc(node)) + 1;
+
+  // 完全展开：init; {body; inc;} * trips
+  if (l.trips * iterSize <= OptUnrollBudget) {
+    uint32_t len = 0;
+    NodeId *stmts = calloc(2 * l.trips + 1, sizeof(NodeId));
+    stmts[len++] = copyNode(nodeInit(node));
+    appendIterations(stmts, &len, node, l.trips);
+    NodeId block = newBlock(stmts, len, tok);
+    free(stmts);
+
+    NumFull++;
+    if (OptReport)
+      note(tok, "unroll: loop fully unrolled, %ld iterations", (long)l.trips);
+    return block;
+  }
+
+  // 部分展开：展开因子受代码大小上限约束
+  int64_t factor = OptUnrollFactor;
+  if (factor * iterSize > OptUnrollBudget)
+    factor = OptUnrollBudget / iterSize;
+  if (factor > l.trips)
+    factor = l.trips;
+  if (factor < 2)
+    return node;
+
+  // init; {body; inc;} * (trips % factor);
+  // for (; cond;) { {body; inc;} * factor }
+  int64_t rem = l.trips % factor;
+  uint32_t len = 0;
+  NodeId *stmts = calloc(2 * factor + 1, sizeof(NodeId));
+  stmts[len++] = copyNode(nodeInit(node));
+  appendIterations(stmts, &len, node, rem);
+  NodeId init = newBlock(stmts, len, tok);
+
+  len = 0;
+  appendIterations(stmts, &len, node, factor);
+  NodeId body = newBlock(stmts, len, tok);
+  free(stmts);
+
+  NodeId cond = copyNode(nodeCond(node));
+  NodeId loop = newCtrl(ND_FOR, tok);
+  nodeExt(loop)->init = init;
+  nodeExt(loop)->cond = cond;
+  nodeExt(loop)->then = body;
+
+  NumPartial++;
+  if (OptReport)
+    note(tok,
+         "unroll: loop partially unrolled by %ld, %ld iterations, %ld "
+         "peeled as remainder",
+         (long)factor, (long)l.trips, (long)rem);
+  return loop;
+}
+
+/**
+ * @brief 自底向上遍历语句，内层循环先展开
+ * @param  node
+ * @return NodeId 替换后的节点
+ */
+static NodeId unrollStmt(NodeId node) {
+  if (!node)
+    return 0;
+
+  switch (nodeKind(node)) {
+  case ND_BLOCK:
+    for (uint32_t i = 0; i < nodeBodyLen(node); i++) {
+      NodeId stmt = unrollStmt(nodeBody(node, i));
+      Nodes.lists[nodeAt(node)->body + i] = stmt;
+    }
+    return node;
+  case ND_IF: {
+    NodeId then = unrollStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    NodeId els = unrollStmt(nodeEls(node));
+    nodeExt(node)->els = els;
+    return node;
+  }
+  case ND_FOR: {
+    NodeId then = unrollStmt(nodeThen(node));
+    nodeExt(node)->then = then;
+    return unrollLoop(node);
+  }
+  default:
+    return node;
+  }
+}
+
+/**
+ * @brief 函数开始时清空统计
+ */
+void unrollBegin(void) { NumFull = NumPartial = 0; }
+
+/**
+ * @brief 循环展开入口函数
+ * @param  prog
+ */
+void unrollLoops(Function *prog) { prog->body = unrollStmt(prog->body); }
+
+/**
+ * @brief 函数结束时输出报告
+ */
+void unrollEnd(void) {
+  if (OptReport)
+    fprintf(DiagFile, "unroll: %d loops fully unrolled, %d partially unrolled\n",
+            NumFull, NumPartial);
+}